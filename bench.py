@@ -45,13 +45,15 @@ NCPUS = [  1,  2,  3
 REPS = 5
 
 KEYGEN = 0
+PLACEMENT = 0
 WORKLOAD = 0
 
 BIN = 'build/src/bench/random'
 
-def bench(algorithm, nthreads, seed, outfile, options):
+def bench(algorithm, nthreads, placement, seed, outfile, options):
     output = subprocess.check_output([ BIN
                                      , '-k', str(options.keygen)
+                                     , '-m', str(placement)
                                      , '-p', str(nthreads)
                                      , '-s', str(seed)
                                      , '-w', str(options.workload)
@@ -59,6 +61,8 @@ def bench(algorithm, nthreads, seed, outfile, options):
                                      ])
 
     outstr = '%s, %d, %s' % (algorithm, nthreads, output.strip())
+    if len(options.placement.split(',')) > 1:
+        outstr = '%s, %d, %d, %s' % (algorithm, nthreads, placement, output.strip())
 
     print outstr
     f.write(outstr + '\n')
@@ -69,6 +73,9 @@ if __name__ == '__main__':
             help = "Comma-separated list of %s" % ALGORITHMS)
     parser.add_option("-k", "--keygen", dest = "keygen", default = KEYGEN,
             help = "Keygen (0: uniform, 1: ascending, 2: descending, 3: restricted8, 4:restricted16)")
+    parser.add_option("-m", "--placement", dest = "placement", default = str(PLACEMENT),
+            help = "Comma-separated list of NUMA placements (0: default, 1: local, 2: remote), "
+                   "runs with several placements add the placement to the output")
     parser.add_option("-p", "--nthreads", dest = "nthreads", default = ",".join(map(str, NCPUS)),
             help = "Comma-separated list of thread counts")
     parser.add_option("-o", "--outfile", dest = "outfile", default = '/dev/null',
@@ -91,8 +98,16 @@ if __name__ == '__main__':
         except:
             parser.error('Invalid element count')
 
+    placements = list()
+    for m in options.placement.split(','):
+        try:
+            placements.append(int(m))
+        except:
+            parser.error('Invalid placement')
+
     with open(options.outfile, 'a') as f:
         for a in algorithms:
             for n in nthreads:
-                for r in xrange(options.reps):
-                    bench(a, n, r, f, options)
+                for m in placements:
+                    for r in xrange(options.reps):
+                        bench(a, n, m, r, f, options)
@@ -61,6 +61,8 @@ static std::string DEFAULT_OUTPUT_FILE = "out.txt";
 #define PQ_KLSM32768   "klsm32768"
 #define PQ_KLSM65536   "klsm65536"
 #define PQ_KLSM131072  "klsm131072"
+#define PQ_KLSMDYN     "klsmdyn"
+#define PQ_KLSMADAPT   "klsmadapt"
 #define PQ_MULTIQC2    "multiqC2"
 #define PQ_MULTIQC4    "multiqC4"
 #define PQ_MULTIQC8    "multiqC8"
@@ -108,6 +110,8 @@ struct settings {
     size_t max_generated_random_weight;
     std::string output_file;
     std::string type;
+    int relaxation;
+    bool decrease_key;
 };
 
 struct edge_t {
@@ -119,6 +123,19 @@ struct vertex_t {
     size_t num_edges;
     std::atomic<size_t> distance;
     edge_t *edges;
+
+    /* Used only by the decrease-key mode: refers to the vertex' current queue
+     * item. The lock only protects the handle slot, decrease_key() itself is
+     * lock-free. */
+    std::atomic_flag handle_lock;
+    kpq::item_handle<size_t, size_t> handle;
+};
+
+struct thread_stats {
+    unsigned long nodes_processed;
+    unsigned long inserts;
+    unsigned long decrease_keys;
+    unsigned long stale_deletes;
 };
 
 static void
@@ -126,18 +143,23 @@ usage()
 {
     fprintf(stderr,
             "USAGE: shortest_paths -i input_file [-n num_threads] [-w end_of_range]\n"
-            "                      [-s seed] pq\n"
+            "                      [-s seed] [-r relaxation] [-d] pq\n"
             "       -i: The input graph file *\n"
             "       -n: Number of threads (default = %d)\n"
             "       -w: Generate random weights between 0 and end_of_range\n"
             "       -s: The random number generator seed (default = %d)\n"
             "       -o: Output file name (default = %s)\n"
+            "       -d: Use decrease_key() instead of reinserting improved nodes\n"
+            "           (k-lsm variants only)\n"
+            "       -r: The relaxation bound used by '%s', and the maximal bound used\n"
+            "           by '%s' (default = %d)\n"
             "       pq: The data structure to use as the backing priority queue\n"
             "           (one of '%s', '%s', '%s', '%s', '%s', '%s',\n"
             "                   '%s', '%s', '%s', '%s', '%s', '%s',\n"
             "                   '%s', '%s', '%s', '%s', '%s', '%s',\n"
             "                   '%s', '%s', '%s', '%s', '%s', '%s',\n"
-            "                   '%s', '%s', '%s', '%s', '%s')\n"
+            "                   '%s', '%s', '%s', '%s', '%s', '%s',\n"
+            "                   '%s')\n"
             "\n"
             "Output:\n"
             "The program output the time used for calculating the shortest paths and\n"
@@ -145,6 +167,8 @@ usage()
             "character) to standard output. Note that the number of nodes processed\n"
             "by the algorithm can be more than the number of nodes in the graph if\n"
             "more than one thread is used.\n"
+            "The number of inserts, decrease_key() calls and stale deletes (i.e. of\n"
+            "nodes already processed with a shorter distance) is printed to stderr.\n"
             "\n"
 	    "IMPORTANT: The automatic pinning of threads to hardware threads\n"
 	    "using hwloc appears to be broken on some machines. To fix this,\n"
@@ -157,13 +181,14 @@ usage()
             DEFAULT_NTHREADS,
             DEFAULT_SEED,
             DEFAULT_OUTPUT_FILE.c_str(),
+            PQ_KLSMDYN, PQ_KLSMADAPT, DEFAULT_RELAXATION,
             PQ_CADM, PQ_CAIN, PQ_CAPQ, PQ_CATREE, PQ_DLSM, PQ_GLOBALLOCK,
             PQ_KLSM, PQ_KLSM16, PQ_KLSM128, PQ_KLSM256, PQ_KLSM512,
             PQ_KLSM1024, PQ_KLSM2048, PQ_KLSM4096, PQ_KLSM8192, PQ_KLSM16384,
             PQ_KLSM32768, PQ_KLSM65536, PQ_KLSM131072, PQ_MULTIQC2,
             PQ_MULTIQC4, PQ_MULTIQC8, PQ_MULTIQC16, PQ_MULTIQC32,
             PQ_MULTIQC64, PQ_MULTIQC128, PQ_MULTIQC256, PQ_LINDEN,
-            PQ_SPRAYLIST);
+            PQ_SPRAYLIST, PQ_KLSMDYN, PQ_KLSMADAPT);
     exit(EXIT_FAILURE);
 }
 
@@ -192,6 +217,8 @@ read_graph(std::string file_path,
         data[i].num_edges = 0;
         data[i].distance.store(std::numeric_limits<size_t>::max(), std::memory_order_relaxed);
         data[i].edges = NULL;
+        data[i].handle_lock.clear();
+        data[i].handle = kpq::item_handle<size_t, size_t>::EMPTY();
     }
     for (size_t i = 0; i < n; i++) {
         current_edge_index[i] = 0;
@@ -277,15 +304,78 @@ delete_graph(vertex_t *data,
     delete[] data;
 }
 
+/**
+ * Queues the given node with its improved distance and returns true if
+ * the node's previous queue item has been updated through decrease_key().
+ */
+template <class T>
+static bool
+update_node(T *pq,
+            vertex_t *,
+            const size_t node,
+            const size_t distance,
+            const bool)
+{
+    pq->insert(distance, node);
+    return false;
+}
+
+template <int Rlx>
+static bool
+update_node(kpq::k_lsm<size_t, size_t, Rlx> *pq,
+            vertex_t *v,
+            const size_t node,
+            const size_t distance,
+            const bool decrease_key)
+{
+    if (!decrease_key) {
+        pq->insert(distance, node);
+        return false;
+    }
+
+    while (v->handle_lock.test_and_set(std::memory_order_acquire)) {
+        /* Wait. */
+    }
+
+    /* If the distance has been improved further in the meantime, the
+     * corresponding update takes care of the queue. */
+
+    bool decreased = false;
+    if (v->distance.load(std::memory_order_relaxed) == distance) {
+        decreased = pq->decrease_key(v->handle, distance);
+        if (!decreased) {
+            pq->insert(distance, node, v->handle);
+        }
+    }
+
+    v->handle_lock.clear(std::memory_order_release);
+    return decreased;
+}
+
+template <class T>
+static bool
+supports_decrease_key(T *)
+{
+    return false;
+}
+
+template <int Rlx>
+static bool
+supports_decrease_key(kpq::k_lsm<size_t, size_t, Rlx> *)
+{
+    return true;
+}
+
 template <class T>
 static void
 bench_thread(T *pq,
              const int number_of_threads,
              const int thread_id,
              vertex_t *graph,
-             unsigned long *nodes_processed_writeback)
+             const bool decrease_key,
+             thread_stats *stats_writeback)
 {
-    unsigned long nodes_processed = 0;
+    thread_stats stats = { 0, 0, 0, 0 };
 #ifdef MANUAL_PINNING
     int cpu = 4 * (thread_id % 16) + thread_id / 16;
     cpu_set_t cpuset;
@@ -407,9 +497,10 @@ bench_thread(T *pq,
         const size_t v_dist = v->distance.load(std::memory_order_relaxed);
         if (distance > v_dist) {
             /*Dead node... ignore*/
+            stats.stale_deletes++;
             continue;
         }
-        nodes_processed++;
+        stats.nodes_processed++;
         for (size_t i = 0; i < v->num_edges; i++) {
             const edge_t *e = &v->edges[i];
             const size_t new_dist = v_dist + e->weight;
@@ -427,7 +518,11 @@ bench_thread(T *pq,
             } while (!dist_updated && w_dist > new_dist);
 
             if (dist_updated) {
-                pq->insert(new_dist, e->target);
+                if (update_node(pq, w, e->target, new_dist, decrease_key)) {
+                    stats.decrease_keys++;
+                } else {
+                    stats.inserts++;
+                }
                 if (wt.threads_waiting_to_succeed.load(std::memory_order_acquire) > 0) {
                     // Notify threads that there is still work to do
                     for (int i = ARRAY_PADDING; i < number_of_threads; i++) {
@@ -454,7 +549,7 @@ bench_thread(T *pq,
             }
         }
     }
-    *nodes_processed_writeback = nodes_processed;
+    *stats_writeback = stats;
 #ifdef PAPI
     int papi2 = PAPI_read_counters(g_values[thread_id], G_EVENT_COUNT);
     if (PAPI_OK != papi2) {
@@ -473,6 +568,11 @@ bench(T *pq,
         return -1;
     }
 
+    if (settings.decrease_key && !supports_decrease_key(pq)) {
+        fprintf(stderr, "The given data structure does not support decrease_key().\n");
+        return -1;
+    }
+
     int ret = 0;
     size_t number_of_nodes;
     vertex_t *graph = read_graph(settings.graph_file,
@@ -491,8 +591,7 @@ bench(T *pq,
     /* Start all threads. */
 
     std::vector<std::thread> threads(settings.num_threads);
-    size_t *number_of_nodes_processed_for_thread =
-        new size_t [settings.num_threads];
+    thread_stats *stats_for_thread = new thread_stats[settings.num_threads];
     wt.threads_waiting_to_succeed = 0;
     for (int i = 0; i < settings.num_threads; i++) {
         threads[i] = std::thread(bench_thread<T>,
@@ -500,7 +599,8 @@ bench(T *pq,
                                  settings.num_threads,
                                  i,
                                  graph,
-                                 &number_of_nodes_processed_for_thread[i]);
+                                 settings.decrease_key,
+                                 &stats_for_thread[i]);
     }
 
     /* Begin benchmark. */
@@ -513,14 +613,15 @@ bench(T *pq,
         thread.join();
     }
 
-    size_t total_number_of_nodes_processed = 0;
+    thread_stats total = { 0, 0, 0, 0 };
 
     for (int i = 0; i < settings.num_threads; i++) {
-        total_number_of_nodes_processed =
-            total_number_of_nodes_processed +
-            number_of_nodes_processed_for_thread[i];
+        total.nodes_processed += stats_for_thread[i].nodes_processed;
+        total.inserts         += stats_for_thread[i].inserts;
+        total.decrease_keys   += stats_for_thread[i].decrease_keys;
+        total.stale_deletes   += stats_for_thread[i].stale_deletes;
     }
-    delete[] number_of_nodes_processed_for_thread;
+    delete[] stats_for_thread;
 
     clock_gettime(CLOCK_MONOTONIC, &end);
     /* End benchmark. */
@@ -530,7 +631,9 @@ bench(T *pq,
                 settings.output_file);
 
     const double elapsed = timediff_in_s(start, end);
-    fprintf(stdout, "%f %lu", elapsed, total_number_of_nodes_processed);
+    fprintf(stdout, "%f %lu", elapsed, total.nodes_processed);
+    fprintf(stderr, "inserts: %lu, decrease_keys: %lu, stale deletes: %lu\n",
+            total.inserts, total.decrease_keys, total.stale_deletes);
 
     delete_graph(graph, number_of_nodes);
     return ret;
@@ -541,11 +644,15 @@ main(int argc,
      char **argv)
 {
     int ret = 0;
-    struct settings s = { DEFAULT_NTHREADS, "", DEFAULT_SEED, 0, DEFAULT_OUTPUT_FILE, PQ_DLSM};
+    struct settings s = { DEFAULT_NTHREADS, "", DEFAULT_SEED, 0, DEFAULT_OUTPUT_FILE, PQ_DLSM,
+                          DEFAULT_RELAXATION, false };
 
     int opt;
-    while ((opt = getopt(argc, argv, "i:n:w:o:p:s:")) != -1) {
+    while ((opt = getopt(argc, argv, "di:n:w:o:p:r:s:")) != -1) {
         switch (opt) {
+        case 'd':
+            s.decrease_key = true;
+            break;
         case 'i':
             errno = 0;
             s.graph_file = optarg;
@@ -567,6 +674,13 @@ main(int argc,
                 usage();
             }
             break;
+        case 'r':
+            errno = 0;
+            s.relaxation = strtol(optarg, NULL, 0);
+            if (errno != 0 || s.relaxation < 1) {
+                usage();
+            }
+            break;
         case 's':
             errno = 0;
             s.seed = strtol(optarg, NULL, 0);
@@ -675,6 +789,13 @@ main(int argc,
     } else if (s.type == PQ_KLSM131072) {
         kpq::k_lsm<size_t, size_t, 131072> pq;
         ret = bench(&pq, s);
+    } else if (s.type == PQ_KLSMDYN) {
+        kpq::k_lsm<size_t, size_t, kpq::DYNAMIC_RELAXATION> pq(s.relaxation);
+        ret = bench(&pq, s);
+    } else if (s.type == PQ_KLSMADAPT) {
+        kpq::k_lsm<size_t, size_t, kpq::DYNAMIC_RELAXATION> pq(s.relaxation);
+        pq.set_adaptive_relaxation(1, s.relaxation);
+        ret = bench(&pq, s);
     } else if (s.type == PQ_GLOBALLOCK) {
         kpqbench::GlobalLock<size_t, size_t> pq;
         ret = bench(&pq, s);
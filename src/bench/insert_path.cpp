@@ -0,0 +1,242 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <ctime>
+#include <future>
+#include <getopt.h>
+#include <random>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#include "dist_lsm/dist_lsm.h"
+#include "k_lsm/k_lsm.h"
+#include "shared_lsm/shared_lsm.h"
+#include "util.h"
+
+/**
+ * Measures the insert path at a constant, high queue occupancy: each thread
+ * fills its share of the queue and then alternates between deleting one item
+ * and inserting another. Most items of each item allocator are thus live,
+ * and items freed by deletions are often owned by other threads.
+ */
+
+constexpr int DEFAULT_NINSERTS = 1 << 20;
+constexpr int DEFAULT_NTHREADS = 1;
+constexpr int DEFAULT_SEED     = 0;
+constexpr int DEFAULT_SIZE     = 1 << 20;
+constexpr int RELAXATION       = 256;
+
+#define PQ_DLSM "dlsm"
+#define PQ_KLSM "klsm"
+#define PQ_SLSM "slsm"
+
+struct settings {
+    std::string type;
+    int ninserts;
+    int nthreads;
+    int seed;
+    int size;
+};
+
+struct result {
+    uint64_t cycles;
+    double elapsed;
+};
+
+static hwloc_wrapper hwloc;
+
+static std::atomic<int> fill_barrier;
+static std::atomic<bool> start_barrier(false);
+
+static void
+usage()
+{
+    fprintf(stderr,
+            "USAGE: insert_path [-i size] [-n ninserts] [-p nthreads] [-s seed] pq\n"
+            "       -i: Specifies the queue occupancy (default = %d)\n"
+            "       -n: Specifies the number of inserts per thread (default = %d)\n"
+            "       -p: Specifies the number of threads (default = %d)\n"
+            "       -s: Specifies the value used to seed the random number generator (default = %d)\n"
+            "       pq: The data structure to use as the backing priority queue\n"
+            "           (one of '%s', '%s', '%s')\n",
+            DEFAULT_SIZE,
+            DEFAULT_NINSERTS,
+            DEFAULT_NTHREADS,
+            DEFAULT_SEED,
+            PQ_DLSM, PQ_KLSM, PQ_SLSM);
+    exit(EXIT_FAILURE);
+}
+
+template <class PriorityQueue>
+static void
+bench_thread(PriorityQueue *pq,
+             const int thread_id,
+             const struct settings &settings,
+             std::promise<result> &&promise)
+{
+    std::mt19937 gen(settings.seed + thread_id);
+    std::uniform_int_distribution<uint32_t> rand_int;
+
+    hwloc.pin_to_core(thread_id);
+
+    const int slice_size = settings.size / settings.nthreads;
+    const int initial_size = (thread_id == settings.nthreads - 1) ?
+                             settings.size - thread_id * slice_size : slice_size;
+    for (int i = 0; i < initial_size; i++) {
+        const uint32_t k = rand_int(gen);
+        pq->insert(k, k);
+    }
+    fill_barrier.fetch_sub(1, std::memory_order_relaxed);
+
+    while (!start_barrier.load(std::memory_order_relaxed)) {
+        /* Wait. */
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t cycles = 0;
+    uint32_t v;
+    for (int i = 0; i < settings.ninserts; i++) {
+        pq->delete_min(v);
+
+        const uint32_t k = rand_int(gen);
+        const uint64_t insert_start = rdtsc();
+        pq->insert(k, k);
+        cycles += rdtsc() - insert_start;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    promise.set_value({ cycles, timediff_in_s(start, end) });
+}
+
+template <class PriorityQueue>
+static int
+bench(PriorityQueue *pq,
+      const struct settings &settings)
+{
+    fill_barrier = settings.nthreads;
+
+    std::vector<std::future<result>> futures;
+    std::vector<std::thread> threads(settings.nthreads);
+    for (int i = 0; i < settings.nthreads; i++) {
+        std::promise<result> p;
+        futures.push_back(p.get_future());
+        threads[i] = std::thread(bench_thread<PriorityQueue>, pq, i, settings,
+                                 std::move(p));
+    }
+
+    while (fill_barrier.load(std::memory_order_relaxed) != 0) {
+        /* Wait. */
+    }
+    start_barrier.store(true, std::memory_order_relaxed);
+
+    uint64_t cycles = 0;
+    double elapsed = 0;
+    for (auto &f : futures) {
+        const result r = f.get();
+        cycles += r.cycles;
+        elapsed = std::max(elapsed, r.elapsed);
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    /* Elapsed time, cycles per insert and peak memory usage in KB. */
+    const double ninserts = (double)settings.ninserts * settings.nthreads;
+    fprintf(stdout, "%1.8f %.2f %ld\n", elapsed, cycles / ninserts, usage.ru_maxrss);
+
+    return 0;
+}
+
+int
+main(int argc,
+     char **argv)
+{
+    int ret = 0;
+    struct settings settings = { "", DEFAULT_NINSERTS, DEFAULT_NTHREADS,
+                                 DEFAULT_SEED, DEFAULT_SIZE };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:p:s:")) != -1) {
+        switch (opt) {
+        case 'i':
+            errno = 0;
+            settings.size = strtol(optarg, NULL, 0);
+            if (errno != 0) {
+                usage();
+            }
+            break;
+        case 'n':
+            errno = 0;
+            settings.ninserts = strtol(optarg, NULL, 0);
+            if (errno != 0) {
+                usage();
+            }
+            break;
+        case 'p':
+            errno = 0;
+            settings.nthreads = strtol(optarg, NULL, 0);
+            if (errno != 0) {
+                usage();
+            }
+            break;
+        case 's':
+            errno = 0;
+            settings.seed = strtol(optarg, NULL, 0);
+            if (errno != 0) {
+                usage();
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (settings.size < 0 || settings.ninserts < 1 || settings.nthreads < 1) {
+        usage();
+    }
+
+    if (optind != argc - 1) {
+        usage();
+    }
+
+    settings.type = argv[optind];
+    if (settings.type == PQ_DLSM) {
+        kpq::dist_lsm<uint32_t, uint32_t, RELAXATION> pq;
+        ret = bench(&pq, settings);
+    } else if (settings.type == PQ_KLSM) {
+        kpq::k_lsm<uint32_t, uint32_t, RELAXATION> pq;
+        ret = bench(&pq, settings);
+    } else if (settings.type == PQ_SLSM) {
+        kpq::shared_lsm<uint32_t, uint32_t, RELAXATION> pq;
+        ret = bench(&pq, settings);
+    } else {
+        usage();
+    }
+
+    return ret;
+}
@@ -45,6 +45,7 @@
 #include "sequential_lsm/lsm.h"
 #include "shared_lsm/shared_lsm.h"
 #include "util/counters.h"
+#include "util/memory_resource.h"
 #include "itree.h"
 #include "util.h"
 
@@ -59,6 +60,8 @@
 #define PQ_KLSM128    "klsm128"
 #define PQ_KLSM256    "klsm256"
 #define PQ_KLSM4096   "klsm4096"
+#define PQ_KLSMDYN    "klsmdyn"
+#define PQ_KLSMADAPT  "klsmadapt"
 #define PQ_LINDEN     "linden"
 #define PQ_LSM        "lsm"
 #define PQ_MLSM       "mlsm"
@@ -104,6 +107,13 @@ enum {
     KEYS_COUNT,
 };
 
+enum {
+    PLACEMENT_DEFAULT = 0,
+    PLACEMENT_LOCAL,
+    PLACEMENT_REMOTE,
+    PLACEMENT_COUNT,
+};
+
 constexpr int DEFAULT_SEED       = 0;
 constexpr int DEFAULT_SIZE       = 1000000;  // Matches benchmarks from klsm paper.
 constexpr int DEFAULT_NTHREADS   = 1;
@@ -116,6 +126,8 @@ constexpr int DEFAULT_SLEEP      = 10;
 constexpr auto DEFAULT_COUNTERS  = false;
 constexpr auto DEFAULT_WORKLOAD  = WORKLOAD_UNIFORM;
 constexpr auto DEFAULT_KEYS      = KEYS_UNIFORM;
+constexpr auto DEFAULT_PLACEMENT = PLACEMENT_DEFAULT;
+constexpr int DEFAULT_VALUE_SIZE = sizeof(VAL_TYPE);
 
 struct settings {
     int nthreads;
@@ -125,11 +137,18 @@ struct settings {
     bool print_counters;
     int keys;
     int workload;
+    int relaxation;
+    int value_size;
+    int placement;
 
     bool are_valid() const {
         if (nthreads < 1
                 || size < 1
+                || relaxation < 1
+                || (value_size != DEFAULT_VALUE_SIZE
+                    && value_size != 8 && value_size != 64 && value_size != 256)
                 || keys < 0 || keys >= KEYS_COUNT
+                || placement < 0 || placement >= PLACEMENT_COUNT
                 || workload < 0 || workload >= WORKLOAD_COUNT) {
             return false;
         }
@@ -140,6 +159,50 @@ struct settings {
 
 static hwloc_wrapper hwloc;
 
+/**
+ * Places memory on the NUMA node following the one of the allocating thread.
+ * Since the k-lsm allocates the state of each thread on that thread, this
+ * turns a thread's accesses to its own lsm into remote accesses, the
+ * counterpart of kpq::numa_local_resource.
+ */
+class remote_numa_resource : public kpq::memory_resource {
+public:
+    remote_numa_resource(const int nodes) :
+        m_nodes(nodes)
+    {
+    }
+
+private:
+    static constexpr size_t THRESHOLD = 1024;
+
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        if (bytes < THRESHOLD) {
+            return kpq::get_system_resource()->allocate(bytes, alignment);
+        }
+
+        const size_t size = kpq::round_up(bytes, kpq::page_size());
+        void *p = kpq::alloc_aligned_pages(size, alignment);
+        kpq::bind_pages(p, size, (kpq::current_numa_node() + 1) % m_nodes);
+        return p;
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t alignment) override
+    {
+        if (bytes < THRESHOLD) {
+            kpq::get_system_resource()->deallocate(p, bytes, alignment);
+        } else {
+            kpq::free_pages(p, kpq::round_up(bytes, kpq::page_size()));
+        }
+    }
+
+private:
+    const int m_nodes;
+};
+
 static std::atomic<int> fill_barrier;
 static std::atomic<bool> start_barrier(false);
 static std::atomic<bool> end_barrier(false);
@@ -182,27 +245,38 @@ static void
 usage()
 {
     fprintf(stderr,
-            "USAGE: random [-c] [-i size] [-k keys] [-p nthreads] [-s seed] [-w workload] pq\n"
+            "USAGE: random [-c] [-i size] [-k keys] [-m placement] [-p nthreads] [-r relaxation] [-s seed] [-v value size] [-w workload] pq\n"
             "       -c: Print performance counters (default = %d)\n"
             "       -i: Specifies the initial size of the priority queue (default = %d)\n"
             "       -k: Specifies the key generation type, one of %d: uniform, %d: ascending, %d: descending,"
             "           %d: restricted (8-bit), %d: restricted (16-bit) (default = %d)\n"
+            "       -m: Specifies the NUMA placement of the memory of the lsm variants, one of\n"
+            "           %d: the library default, %d: the node of the owning thread,\n"
+            "           %d: a node other than that of the owning thread (default = %d)\n"
             "       -p: Specifies the number of threads (default = %d)\n"
+            "       -r: Specifies the relaxation bound used by '%s', and the maximal bound\n"
+            "           used by '%s' (default = %d)\n"
             "       -s: Specifies the value used to seed the random number generator (default = %d)\n"
+            "       -v: Specifies the size of values in bytes used by '%s', '%s', '%s' and '%s',\n"
+            "           one of 8, 64, 256 (default = %d)\n"
             "       -w: Specifies the workload type, one of %d: uniform, %d: split, %d: producer, %d: alternating (default = %d)\n"
             "       pq: The data structure to use as the backing priority queue\n"
             "           (one of '%s', '%s', '%s', '%s', '%s', '%s',\n"
             "                   '%s', '%s', '%s', '%s', '%s', '%s',\n"
             "                   '%s', '%s', '%s', '%s', '%s', '%s',\n"
-            "                   '%s')\n",
+            "                   '%s', '%s', '%s')\n",
             DEFAULT_COUNTERS,
             DEFAULT_SIZE,
             KEYS_UNIFORM, KEYS_ASCENDING, KEYS_DESCENDING, KEYS_RESTRICTED_8, KEYS_RESTRICTED_16, DEFAULT_KEYS,
+            PLACEMENT_DEFAULT, PLACEMENT_LOCAL, PLACEMENT_REMOTE, DEFAULT_PLACEMENT,
             DEFAULT_NTHREADS,
+            PQ_KLSMDYN, PQ_KLSMADAPT, DEFAULT_RELAXATION,
             DEFAULT_SEED,
+            PQ_KLSM16, PQ_KLSM128, PQ_KLSM256, PQ_KLSM4096, DEFAULT_VALUE_SIZE,
             WORKLOAD_UNIFORM, WORKLOAD_SPLIT, WORKLOAD_PRODUCER, WORKLOAD_ALTERNATING, DEFAULT_WORKLOAD,
             PQ_CADM, PQ_CAIN, PQ_CAPQ, PQ_CATREE, PQ_CHEAP, PQ_DLSM, PQ_GLOBALLOCK, PQ_KLSM16,
-            PQ_KLSM128, PQ_KLSM256, PQ_KLSM4096, PQ_LINDEN, PQ_LSM, PQ_MLSM, PQ_MULTIQ, PQ_SEQUENCE,
+            PQ_KLSM128, PQ_KLSM256, PQ_KLSM4096, PQ_KLSMDYN, PQ_KLSMADAPT,
+            PQ_LINDEN, PQ_LSM, PQ_MLSM, PQ_MULTIQ, PQ_SEQUENCE,
             PQ_SKIP, PQ_SLSM, PQ_SPRAY);
     exit(EXIT_FAILURE);
 }
@@ -636,6 +710,82 @@ evaluate_quality(std::vector<void *> &insertion_sequences,
 }
 #endif
 
+/**
+ * A value of N bytes, e.g. a task descriptor. Payloads are constructed in
+ * place; beyond 16 bytes, they are moved out of the k-lsm only after a
+ * successful take.
+ */
+template <int N>
+struct payload {
+    payload() { }
+    explicit payload(const VAL_TYPE v) : m_val(v) { }
+
+    VAL_TYPE m_val;
+    uint8_t m_padding[N - sizeof(VAL_TYPE)];
+};
+
+/** Exposes a queue storing payload<N> values through the VAL_TYPE interface
+ *  used by bench_thread(). */
+template <class PriorityQueue, int N>
+class payload_queue {
+public:
+    void insert(const KEY_TYPE &key,
+                const VAL_TYPE &val)
+    {
+        m_pq.emplace(key, val);
+    }
+
+    bool delete_min(VAL_TYPE &val)
+    {
+        KEY_TYPE key;
+        if (!m_pq.delete_min(key, m_payload)) {
+            return false;
+        }
+        val = m_payload.m_val;
+        return true;
+    }
+
+    void init_thread(const size_t nthreads) { m_pq.init_thread(nthreads); }
+    constexpr static bool supports_concurrency() { return PriorityQueue::supports_concurrency(); }
+
+private:
+    PriorityQueue m_pq;
+    static thread_local payload<N> m_payload;
+};
+
+template <class PriorityQueue, int N>
+thread_local payload<N> payload_queue<PriorityQueue, N>::m_payload;
+
+template <class PriorityQueue>
+static int
+bench(PriorityQueue *pq,
+      const struct settings &settings);
+
+/** Runs the k-lsm with the value size given in settings. */
+template <int Rlx>
+static int
+bench_klsm(const struct settings &settings)
+{
+    switch (settings.value_size) {
+    case 8: {
+        payload_queue<kpq::k_lsm<KEY_TYPE, payload<8>, Rlx>, 8> pq;
+        return bench(&pq, settings);
+    }
+    case 64: {
+        payload_queue<kpq::k_lsm<KEY_TYPE, payload<64>, Rlx>, 64> pq;
+        return bench(&pq, settings);
+    }
+    case 256: {
+        payload_queue<kpq::k_lsm<KEY_TYPE, payload<256>, Rlx>, 256> pq;
+        return bench(&pq, settings);
+    }
+    default: {
+        kpq::k_lsm<KEY_TYPE, VAL_TYPE, Rlx> pq;
+        return bench(&pq, settings);
+    }
+    }
+}
+
 template <class PriorityQueue>
 static int
 bench(PriorityQueue *pq,
@@ -803,10 +953,13 @@ main(int argc,
                                , DEFAULT_COUNTERS
                                , DEFAULT_KEYS
                                , DEFAULT_WORKLOAD
+                               , DEFAULT_RELAXATION
+                               , DEFAULT_VALUE_SIZE
+                               , DEFAULT_PLACEMENT
                                };
 
     int opt;
-    while ((opt = getopt(argc, argv, "ci:k:n:p:s:w:")) != -1) {
+    while ((opt = getopt(argc, argv, "ci:k:m:n:p:r:s:v:w:")) != -1) {
         switch (opt) {
         case 'c':
             settings.print_counters = true;
@@ -817,12 +970,21 @@ main(int argc,
         case 'k':
             settings.keys = safe_parse_int_arg(optarg);
             break;
+        case 'm':
+            settings.placement = safe_parse_int_arg(optarg);
+            break;
         case 'p':
             settings.nthreads = safe_parse_int_arg(optarg);
             break;
+        case 'r':
+            settings.relaxation = safe_parse_int_arg(optarg);
+            break;
         case 's':
             settings.seed = safe_parse_int_arg(optarg);
             break;
+        case 'v':
+            settings.value_size = safe_parse_int_arg(optarg);
+            break;
         case 'w':
             settings.workload = safe_parse_int_arg(optarg);
             break;
@@ -840,6 +1002,16 @@ main(int argc,
         usage();
     }
 
+    /* Must be set before the queues are constructed. Threads are pinned to
+     * cores in order, runs with increasing thread counts thus spill over
+     * to further sockets. */
+    remote_numa_resource remote_resource(hwloc.numa_nodes());
+    if (settings.placement == PLACEMENT_LOCAL) {
+        kpq::set_default_resource(kpq::get_numa_local_resource());
+    } else if (settings.placement == PLACEMENT_REMOTE) {
+        kpq::set_default_resource(&remote_resource);
+    }
+
 #ifndef ENABLE_QUALITY
     if (settings.type == PQ_CADM) {
         kpqbench::CPPCAPQ<true, false, true> pq;
@@ -865,16 +1037,19 @@ main(int argc,
         kpqbench::GlobalLock<KEY_TYPE, VAL_TYPE> pq;
         ret = bench(&pq, settings);
     } else if (settings.type == PQ_KLSM16) {
-        kpq::k_lsm<KEY_TYPE, VAL_TYPE, 16> pq;
-        ret = bench(&pq, settings);
+        ret = bench_klsm<16>(settings);
     } else if (settings.type == PQ_KLSM128) {
-        kpq::k_lsm<KEY_TYPE, VAL_TYPE, 128> pq;
-        ret = bench(&pq, settings);
+        ret = bench_klsm<128>(settings);
     } else if (settings.type == PQ_KLSM256) {
-        kpq::k_lsm<KEY_TYPE, VAL_TYPE, 256> pq;
-        ret = bench(&pq, settings);
+        ret = bench_klsm<256>(settings);
     } else if (settings.type == PQ_KLSM4096) {
-        kpq::k_lsm<KEY_TYPE, VAL_TYPE, 4096> pq;
+        ret = bench_klsm<4096>(settings);
+    } else if (settings.type == PQ_KLSMDYN) {
+        kpq::k_lsm<KEY_TYPE, VAL_TYPE, kpq::DYNAMIC_RELAXATION> pq(settings.relaxation);
+        ret = bench(&pq, settings);
+    } else if (settings.type == PQ_KLSMADAPT) {
+        kpq::k_lsm<KEY_TYPE, VAL_TYPE, kpq::DYNAMIC_RELAXATION> pq(settings.relaxation);
+        pq.set_adaptive_relaxation(1, settings.relaxation);
         ret = bench(&pq, settings);
 #ifndef ENABLE_QUALITY
     } else if (settings.type == PQ_LINDEN) {
@@ -61,6 +61,13 @@ hwloc_wrapper::pin_to_core(const int id)
     hwloc_bitmap_free(cpuset);
 }
 
+int
+hwloc_wrapper::numa_nodes() const
+{
+    const int n = hwloc_get_nbobjs_by_type(m_p->m_topology, HWLOC_OBJ_NODE);
+    return (n < 1) ? 1 : n;
+}
+
 double
 timediff_in_s(const struct timespec &start,
               const struct timespec &end)
@@ -34,6 +34,9 @@ public:
 
     void pin_to_core(const int id);
 
+    /** Returns the number of NUMA nodes of the machine. */
+    int numa_nodes() const;
+
 private:
     hwloc_wrapper_private *m_p;
 };
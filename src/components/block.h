@@ -20,10 +20,16 @@
 #ifndef __BLOCK_H
 #define __BLOCK_H
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <functional>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "util/mm.h"
 #include "util/thread_local_ptr.h"
 #include "item.h"
 
@@ -36,20 +42,36 @@ namespace kpq
  * otherwise it has been processed by another thread and possibly reused.
  *
  * A block is always of capacity 2^i, i \in N_0. For all owned items, if the index i < j
- * then i.key < j.key.
+ * then i.key < j.key with respect to Compare.
+ *
+ * References are stored as an array of block_items. With ENABLE_SOA_BLOCKS,
+ * they are instead stored as a structure of arrays: keys are kept in an array
+ * separate from the parallel array of item pointers and versions, such that scans
+ * which mostly compare keys (merges, pivot searches) only touch the key array.
+ * block_item is then only the value type used to pass single references.
  */
 
-template <class K, class V>
+template <class K, class V, class Compare = std::less<K>>
 class block
 {
 public:
     struct block_item {
         static block_item EMPTY() { return { K(), nullptr, 0 }; }
 
-        bool taken() const { return m_item->version() != m_version; }
+        /** Items of released blocks read as empty and taken, see release(). */
+        bool taken() const { return m_item == nullptr || m_item->version() != m_version; }
         bool empty() const { return (m_item == nullptr); }
-        bool take(V &val) { return m_item->take(m_version, val); }
-        bool take(K &key, V &val) { return m_item->take(m_version, key, val); }
+        /** Successfully taken items are returned to their allocator. */
+        bool take(V &val) { return recycled(m_item->take(m_version, val)); }
+        bool take(K &key, V &val) { return recycled(m_item->take(m_version, key, val)); }
+
+        bool recycled(const bool taken) const
+        {
+            if (taken) {
+                item_allocator_of<K, V>::recycle(m_item);
+            }
+            return taken;
+        }
 
         K m_key;
         item<K, V> *m_item;
@@ -61,30 +83,39 @@ public:
 
     class spying_iterator
     {
-        friend class block<K, V>;
+        friend class block<K, V, Compare>;
     public:
         peek_t next();
 
     private:
-        block_item *m_block_items;
+        const block<K, V, Compare> *m_block;
         size_t m_last, m_next;
     };
 
 public:
-    block(const size_t power_of_2);
+    block(const size_t power_of_2,
+          memory_resource *resource = get_default_resource());
     virtual ~block();
 
     void insert(item<K, V> *it,
                 const version_t version);
     void insert_tail(item<K, V> *it,
                      const version_t version);
-    void merge(const block<K, V> *lhs,
-               const block<K, V> *rhs);
-    void merge(const block<K, V> *lhs,
+    /** Appends a reference of another block, which must not be smaller than
+     *  any key within this block. */
+    void insert_tail(const block_item &it);
+    void merge(const block<K, V, Compare> *lhs,
+               const block<K, V, Compare> *rhs);
+    void merge(const block<K, V, Compare> *lhs,
                const size_t lhs_first,
-               const block<K, V> *rhs,
+               const block<K, V, Compare> *rhs,
                const size_t rhs_first);
-    void copy(const block<K, V> *that);
+    void copy(const block<K, V, Compare> *that);
+
+    /** Sorts the items between first and last by key. Used to establish the
+     *  block invariant after a batch of unordered items has been appended
+     *  through insert_tail(). */
+    void sort();
 
     /** Returns null if the block is empty, and a peek_t struct of the minimal item
      *  otherwise. Removes observed unowned items from the current block. */
@@ -95,8 +126,19 @@ public:
      *  If none are found, returns false. */
     bool peek_tail(K &key);
 
-    /** Returns a pointer to the n-th item within this block (i.e. &items[n]). */
-    const block_item *peek_nth(const size_t n) const;
+    /** Returns a copy of the n-th item reference within this block. */
+    block_item peek_nth(const size_t n) const;
+
+    /** Returns the key of the n-th item reference. Like the key of peek_nth(),
+     *  it is only meaningful while the item has not been taken. */
+#ifdef ENABLE_SOA_BLOCKS
+    const K &key(const size_t n) const { return m_keys[n]; }
+#else
+    const K &key(const size_t n) const { return m_block_items[n].m_key; }
+#endif
+
+    /** Equivalent to peek_nth(n).taken(), without reading the key. */
+    bool taken(const size_t n) const;
 
     spying_iterator iterator();
 
@@ -106,21 +148,83 @@ public:
     size_t power_of_2() const;
     size_t capacity() const;
 
+    /** Returns the smallest power of 2 such that a block of that size can hold
+     *  n items. */
+    static size_t power_of_2_for(const size_t n);
+
     bool used() const;
     void set_unused();
     void set_used();
 
     void clear();
 
+    /**
+     * Returns the memory of the item array of an unused block to the OS and
+     * returns the number of released bytes. The array remains mapped and
+     * reads as empty items until the block is used again, so that threads
+     * still reading the block after it has been recycled remain safe.
+     * Only large blocks with trivially copyable keys are released.
+     */
+    size_t release();
+
+    /** True if the item array is released by release(). */
+    bool paged() const { return m_paged; }
+
+    /** The size of the item array in bytes. */
+    size_t bytes() const
+    {
+#ifdef ENABLE_SOA_BLOCKS
+        return keys_bytes() + m_capacity * sizeof(item_ref);
+#else
+        return m_capacity * sizeof(block_item);
+#endif
+    }
+
 public:
     /** Next pointers may be used by all threads. */
-    std::atomic<block<K, V> *> m_next;
+    std::atomic<block<K, V, Compare> *> m_next;
     /** Prev pointers may be used only by the owning thread. */
-    block<K, V> *m_prev;
+    block<K, V, Compare> *m_prev;
 
 private:
+#ifdef ENABLE_SOA_BLOCKS
+    /** The key-less part of a block item. Items and their versions are
+     *  always read together, and are thus kept in a single array. */
+    struct item_ref {
+        item<K, V> *m_item;
+        version_t m_version;
+    };
+#endif
+
     static bool item_owned(const block_item &block_item);
 
+    /** Stores it as the n-th item reference. */
+    void set_nth(const size_t n,
+                 const block_item &it);
+    /** Copies the src_ix-th item reference of src to the n-th slot. */
+    void move_nth(const size_t n,
+                  const block<K, V, Compare> *src,
+                  const size_t src_ix);
+    /** Copies the item references [first, last) of src to [n, n + last - first). */
+    void copy_nth(const size_t n,
+                  const block<K, V, Compare> *src,
+                  const size_t first,
+                  const size_t last);
+
+#ifdef ENABLE_SOA_BLOCKS
+    /** References follow the keys within the item array. */
+    size_t keys_bytes() const
+    {
+        return round_up(m_capacity * sizeof(K), alignof(item_ref));
+    }
+    size_t alignment() const
+    {
+        return m_paged ? page_size() : std::max(alignof(K), alignof(item_ref));
+    }
+#else
+    size_t alignment() const { return m_paged ? page_size() : alignof(block_item); }
+#endif
+
 private:
     /** Points to the lowest known filled index. */
     size_t m_first;
@@ -138,7 +242,23 @@ private:
 
     const int32_t m_owner_tid;
 
+#ifdef ENABLE_SOA_BLOCKS
+    /** The resource the item array is allocated from. The item array holds
+     *  the key array followed by the reference array. */
+    memory_resource *m_resource;
+    K *m_keys;
+    item_ref *m_refs;
+#else
+    /** The resource the item array is allocated from. */
+    memory_resource *m_resource;
     block_item *m_block_items;
+#endif
+
+    /** Item arrays of at least a page are page-aligned and may be released
+     *  while the block is unused. */
+    static constexpr bool RELEASABLE = std::is_trivially_copyable<K>::value;
+    const bool m_paged;
+    bool m_released;
 
     /** Specifies whether the block is currently in use. */
     bool m_used;
@@ -17,14 +17,17 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V>
-typename block<K, V>::peek_t
-block<K, V>::spying_iterator::next()
+template <class K, class V, class Compare>
+typename block<K, V, Compare>::peek_t
+block<K, V, Compare>::spying_iterator::next()
 {
     peek_t p = peek_t::EMPTY();
 
     while (m_next < m_last) {
-        const auto &item = m_block_items[m_next++];
+        const auto item = m_block->peek_nth(m_next++);
+        if (item.m_item == nullptr) {
+            continue;
+        }
 
         p.m_version = item.m_version;
         p.m_item    = item.m_item;
@@ -40,8 +43,9 @@ block<K, V>::spying_iterator::next()
     return p;
 }
 
-template <class K, class V>
-block<K, V>::block(const size_t power_of_2) :
+template <class K, class V, class Compare>
+block<K, V, Compare>::block(const size_t power_of_2,
+                            memory_resource *resource) :
     m_next(nullptr),
     m_prev(nullptr),
     m_first(0),
@@ -49,21 +53,55 @@ block<K, V>::block(const size_t power_of_2) :
     m_power_of_2(power_of_2),
     m_capacity(1 << power_of_2),
     m_owner_tid(tid()),
-    m_block_items(new block_item[m_capacity]),
-    m_used(false)
+    m_resource(resource),
+#ifdef ENABLE_SOA_BLOCKS
+    m_keys(nullptr),
+    m_refs(nullptr),
+#else
+    m_block_items(nullptr),
+#endif
+    m_paged(RELEASABLE && bytes() >= page_size()),
+    m_released(false),
+    m_used(false),
+    m_skipped_prunes(0)
 {
+#ifdef ENABLE_SOA_BLOCKS
+    char *p = static_cast<char *>(m_resource->allocate(bytes(), alignment()));
+    m_keys = reinterpret_cast<K *>(p);
+    m_refs = reinterpret_cast<item_ref *>(p + keys_bytes());
+
+    for (size_t i = 0; i < m_capacity; i++) {
+        new (&m_keys[i]) K;
+        m_refs[i] = { nullptr, 0 };
+    }
+#else
+    m_block_items = static_cast<block_item *>(m_resource->allocate(bytes(), alignment()));
+    for (size_t i = 0; i < m_capacity; i++) {
+        new (&m_block_items[i]) block_item;
+    }
+#endif
 }
 
-template <class K, class V>
-block<K, V>::~block()
+template <class K, class V, class Compare>
+block<K, V, Compare>::~block()
 {
-    delete[] m_block_items;
+#ifdef ENABLE_SOA_BLOCKS
+    for (size_t i = 0; i < m_capacity; i++) {
+        m_keys[i].~K();
+    }
+    m_resource->deallocate(m_keys, bytes(), alignment());
+#else
+    for (size_t i = 0; i < m_capacity; i++) {
+        m_block_items[i].~block_item();
+    }
+    m_resource->deallocate(m_block_items, bytes(), alignment());
+#endif
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::insert(item<K, V> *it,
-                    const version_t version)
+block<K, V, Compare>::insert(item<K, V> *it,
+                             const version_t version)
 {
     assert(m_first == 0);
     assert(m_last == 0);
@@ -71,36 +109,51 @@ block<K, V>::insert(item<K, V> *it,
     insert_tail(it, version);
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::insert_tail(item<K, V> *it,
-                         const version_t version)
+block<K, V, Compare>::insert_tail(item<K, V> *it,
+                                  const version_t version)
 {
     assert(m_used);
     assert(m_last < m_capacity);
 
+#ifdef ENABLE_SOA_BLOCKS
+    m_keys[m_last] = it->key();
+    m_refs[m_last] = { it, version };
+#else
     auto &block_it = m_block_items[m_last];
     block_it.m_item    = it;
     block_it.m_version = version;
     block_it.m_key     = it->key();
+#endif
 
     m_last++;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
+void
+block<K, V, Compare>::insert_tail(const block_item &it)
+{
+    assert(m_used);
+    assert(m_last < m_capacity);
+
+    set_nth(m_last++, it);
+}
+
+template <class K, class V, class Compare>
 void
-block<K, V>::merge(const block<K, V> *lhs,
-                   const block<K, V> *rhs)
+block<K, V, Compare>::merge(const block<K, V, Compare> *lhs,
+                            const block<K, V, Compare> *rhs)
 {
     merge(lhs, lhs->m_first, rhs, rhs->m_first);
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::merge(const block<K, V> *lhs,
-                   const size_t lhs_first,
-                   const block<K, V> *rhs,
-                   const size_t rhs_first)
+block<K, V, Compare>::merge(const block<K, V, Compare> *lhs,
+                            const size_t lhs_first,
+                            const block<K, V, Compare> *rhs,
+                            const size_t rhs_first)
 {
     /* The following assertions are no longer valid since we now sometimes merge blocks
      * of different capacities.
@@ -122,35 +175,36 @@ block<K, V>::merge(const block<K, V> *lhs,
         return;
     }
 
-    auto l = lhs->m_block_items + lhs_first;
-    auto r = rhs->m_block_items + rhs_first;
-    const auto lend = lhs->m_block_items + lhs_last;
-    const auto rend = rhs->m_block_items + rhs_last;
-
-    auto dst = m_block_items;
-    while (l < lend && r < rend) {
-        *dst++ = (l->m_key < r->m_key) ? *l++ : *r++;
+    size_t l = lhs_first;
+    size_t r = rhs_first;
+    size_t dst = 0;
+    while (l < lhs_last && r < rhs_last) {
+        if (Compare()(lhs->key(l), rhs->key(r))) {
+            move_nth(dst++, lhs, l++);
+        } else {
+            move_nth(dst++, rhs, r++);
+        }
     }
 
-    while (l < lend) *dst++ = *l++;
-    while (r < rend) *dst++ = *r++;
+    copy_nth(dst, lhs, l, lhs_last);
+    dst += lhs_last - l;
+    copy_nth(dst, rhs, r, rhs_last);
 
     /* Prune. */
 
     const size_t skipped_prunes = std::max(lhs->m_skipped_prunes, rhs->m_skipped_prunes);
     if (skipped_prunes > MAX_SKIPPED_PRUNES) {
-        const auto end = dst;
-        dst = m_block_items;
-        for (auto src = dst; src < end; src++) {
-            if (src->taken()) {
+        dst = 0;
+        for (size_t src = 0; src < size; src++) {
+            if (taken(src)) {
                 continue;
             } else if (src != dst) {
-                *dst = *src;
+                move_nth(dst, this, src);
             }
             dst++;
         }
 
-        m_last = dst - m_block_items;
+        m_last = dst;
         m_skipped_prunes = 0;
     } else {
         m_last = size;
@@ -160,61 +214,100 @@ block<K, V>::merge(const block<K, V> *lhs,
     assert(m_last <= m_capacity);
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::copy(const block<K, V> *that)
+block<K, V, Compare>::copy(const block<K, V, Compare> *that)
 {
     assert(m_used);
     assert(m_first == 0);
     assert(m_last == 0);
 
     size_t last = 0;
-    auto dst = m_block_items;
-    auto src = that->m_block_items + that->m_first;
-    const auto end = that->m_block_items + that->m_last;
-    for (; src < end; src++) {
+    const size_t end = that->m_last;
+    for (size_t src = that->m_first; src < end; src++) {
         if (last >= m_capacity) {
             /* Can happen when a block is reused during the shared lsm's
              * insert(). In that case simply abort, the version compare exchange
              * will fail once this thread tries to publish it's array. */
             return;
         }
-        if (src->taken()) {
+        if (that->taken(src)) {
             continue;
         }
 
-        *dst++ = *src;
-        last++;
+        move_nth(last++, that, src);
     }
 
     m_last = last;
 }
 
-template <class K, class V>
-typename block<K, V>::peek_t
-block<K, V>::peek()
+template <class K, class V, class Compare>
+void
+block<K, V, Compare>::sort()
+{
+#ifdef ENABLE_SOA_BLOCKS
+    /* The arrays cannot be sorted in place jointly, sort a temporary
+     * array of item references instead. */
+
+    std::vector<block_item> items;
+    items.reserve(m_last - m_first);
+    for (size_t i = m_first; i < m_last; i++) {
+        items.push_back(peek_nth(i));
+    }
+
+    std::sort(items.begin(), items.end(),
+              [](const block_item &lhs, const block_item &rhs) {
+                  return Compare()(lhs.m_key, rhs.m_key);
+              });
+
+    for (size_t i = m_first; i < m_last; i++) {
+        set_nth(i, items[i - m_first]);
+    }
+#else
+    std::sort(m_block_items + m_first, m_block_items + m_last,
+              [](const block_item &lhs, const block_item &rhs) {
+                  return Compare()(lhs.m_key, rhs.m_key);
+              });
+#endif
+}
+
+template <class K, class V, class Compare>
+typename block<K, V, Compare>::peek_t
+block<K, V, Compare>::peek()
 {
     size_t ix;
     return peek(ix, m_first);
 }
 
-template <class K, class V>
-typename block<K, V>::peek_t
-block<K, V>::peek(size_t &ix, const size_t first)
+template <class K, class V, class Compare>
+typename block<K, V, Compare>::peek_t
+block<K, V, Compare>::peek(size_t &ix, const size_t first)
 {
     const bool called_by_owner = (tid() == m_owner_tid);
 
     ix = first;
 
     peek_t p;
-    for (auto it = m_block_items + ix; it < m_block_items + m_last; it++, ix++) {
-        p.m_version = it->m_version;
+    for (; ix < m_last; ix++) {
+#ifdef ENABLE_SOA_BLOCKS
+        const item_ref ref = m_refs[ix];
+        p.m_version = ref.m_version;
+
+        if (ref.m_item != nullptr && ref.m_item->version() == ref.m_version) {
+            p.m_item    = ref.m_item;
+            p.m_key     = m_keys[ix];
+            return p;
+        }
+#else
+        const block_item &it = m_block_items[ix];
+        p.m_version = it.m_version;
 
-        if (!it->taken()) {
-            p.m_item    = it->m_item;
-            p.m_key     = it->m_key;
+        if (!it.taken()) {
+            p.m_item    = it.m_item;
+            p.m_key     = it.m_key;
             return p;
         }
+#endif
 
         /* Move initial sequence of unowned item references out
          * of active scope. Only the owner thread may modify m_first
@@ -232,22 +325,82 @@ block<K, V>::peek(size_t &ix, const size_t first)
     return p;
 }
 
-template <class K, class V>
-const typename block<K, V>::block_item *
-block<K, V>::peek_nth(const size_t n) const
+template <class K, class V, class Compare>
+typename block<K, V, Compare>::block_item
+block<K, V, Compare>::peek_nth(const size_t n) const
+{
+    assert(n < m_capacity);
+#ifdef ENABLE_SOA_BLOCKS
+    return { m_keys[n], m_refs[n].m_item, m_refs[n].m_version };
+#else
+    return m_block_items[n];
+#endif
+}
+
+template <class K, class V, class Compare>
+bool
+block<K, V, Compare>::taken(const size_t n) const
+{
+    assert(n < m_capacity);
+#ifdef ENABLE_SOA_BLOCKS
+    const item_ref ref = m_refs[n];
+    return (ref.m_item == nullptr || ref.m_item->version() != ref.m_version);
+#else
+    return m_block_items[n].taken();
+#endif
+}
+
+template <class K, class V, class Compare>
+void
+block<K, V, Compare>::set_nth(const size_t n,
+                              const block_item &it)
 {
     assert(n < m_capacity);
-    return &m_block_items[n];
+#ifdef ENABLE_SOA_BLOCKS
+    m_keys[n] = it.m_key;
+    m_refs[n] = { it.m_item, it.m_version };
+#else
+    m_block_items[n] = it;
+#endif
+}
+
+template <class K, class V, class Compare>
+void
+block<K, V, Compare>::move_nth(const size_t n,
+                               const block<K, V, Compare> *src,
+                               const size_t src_ix)
+{
+#ifdef ENABLE_SOA_BLOCKS
+    m_keys[n] = src->m_keys[src_ix];
+    m_refs[n] = src->m_refs[src_ix];
+#else
+    m_block_items[n] = src->m_block_items[src_ix];
+#endif
+}
+
+template <class K, class V, class Compare>
+void
+block<K, V, Compare>::copy_nth(const size_t n,
+                               const block<K, V, Compare> *src,
+                               const size_t first,
+                               const size_t last)
+{
+    assert(n + last - first <= m_capacity);
+#ifdef ENABLE_SOA_BLOCKS
+    std::copy(src->m_keys + first, src->m_keys + last, m_keys + n);
+    std::copy(src->m_refs + first, src->m_refs + last, m_refs + n);
+#else
+    std::copy(src->m_block_items + first, src->m_block_items + last, m_block_items + n);
+#endif
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 bool
-block<K, V>::peek_tail(K &key)
+block<K, V, Compare>::peek_tail(K &key)
 {
     for (int i = (int)m_last - 1; i >= (int)m_first; i--) {
-        auto it = &m_block_items[i];
-        key = it->m_key;
-        if (!it->taken()) {
+        key = this->key(i);
+        if (!taken(i)) {
             return true;
         }
         /* Last item is not owned by us anymore, clean it up. */
@@ -256,64 +409,75 @@ block<K, V>::peek_tail(K &key)
     return false;
 }
 
-template <class K, class V>
-typename block<K, V>::spying_iterator
-block<K, V>::iterator()
+template <class K, class V, class Compare>
+typename block<K, V, Compare>::spying_iterator
+block<K, V, Compare>::iterator()
 {
-    typename block<K, V>::spying_iterator it;
+    typename block<K, V, Compare>::spying_iterator it;
 
-    it.m_block_items = m_block_items;
+    it.m_block = this;
     it.m_next = m_first;
     it.m_last = m_last;
 
     return it;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 size_t
-block<K, V>::first() const
+block<K, V, Compare>::first() const
 {
     return m_first;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 size_t
-block<K, V>::last() const
+block<K, V, Compare>::last() const
 {
     return m_last;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 size_t
-block<K, V>::size() const
+block<K, V, Compare>::size() const
 {
     return m_last - m_first;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 size_t
-block<K, V>::power_of_2() const
+block<K, V, Compare>::power_of_2() const
 {
     return m_power_of_2;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 size_t
-block<K, V>::capacity() const
+block<K, V, Compare>::capacity() const
 {
     return m_capacity;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
+size_t
+block<K, V, Compare>::power_of_2_for(const size_t n)
+{
+    size_t power_of_2 = 0;
+    while (((size_t)1 << power_of_2) < n) {
+        power_of_2++;
+    }
+    return power_of_2;
+}
+
+template <class K, class V, class Compare>
 bool
-block<K, V>::used() const
+block<K, V, Compare>::used() const
 {
     return m_used;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::set_unused()
+block<K, V, Compare>::set_unused()
 {
     assert(m_used);
     m_used  = false;
@@ -321,28 +485,47 @@ block<K, V>::set_unused()
     clear();
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::clear()
+block<K, V, Compare>::clear()
 {
     m_first = 0;
     m_last  = 0;
 
     m_next.store(nullptr, std::memory_order_relaxed);
     m_prev = nullptr;
+
+    m_released = false;
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 void
-block<K, V>::set_used()
+block<K, V, Compare>::set_used()
 {
     assert(!m_used);
     m_used = true;
+    m_released = false;
+}
+
+template <class K, class V, class Compare>
+size_t
+block<K, V, Compare>::release()
+{
+    if (!m_paged || m_released) {
+        return 0;
+    }
+
+    m_released = true;
+#ifdef ENABLE_SOA_BLOCKS
+    return release_pages(m_keys, bytes());
+#else
+    return release_pages(m_block_items, bytes());
+#endif
 }
 
-template <class K, class V>
+template <class K, class V, class Compare>
 bool
-block<K, V>::item_owned(const block_item &block_item)
+block<K, V, Compare>::item_owned(const block_item &block_item)
 {
     return (block_item.m_item->version() == block_item.m_version);
 }
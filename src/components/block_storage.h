@@ -31,31 +31,37 @@ namespace kpq
  * Maintains N-tuples of memory blocks of size 2^i.
  */
 
-template <class K, class V, int N>
+template <class K, class V, int N, class Compare = std::less<K>>
 class block_storage
 {
-private:
+public:
     static constexpr size_t MAX_BLOCKS = 32;  // TODO: Global setting.
 
+private:
     struct block_tuple {
-        block<K, V> *xs[N];
+        block<K, V, Compare> *xs[N];
     };
 
 public:
-    block_storage() : m_blocks { { nullptr } }, m_size(0) { }
+    block_storage(memory_resource *resource = get_default_resource()) :
+        m_resource(resource), m_blocks { { nullptr } }, m_size(0) { }
     virtual ~block_storage();
 
     /**
      * Returns an unused block of size 2^i. If such a block does not exist,
      * a new N-tuple of size 2^i is allocated.
      */
-    block<K, V> *get_block(const size_t i);
+    block<K, V, Compare> *get_block(const size_t i);
+
+    block<K, V, Compare> *get_largest_block();
 
-    block<K, V> *get_largest_block();
+    /** Releases the memory of all unused blocks, see block::release(). */
+    size_t trim();
 
     void print() const;
 
 private:
+    memory_resource *m_resource;
     block_tuple m_blocks[MAX_BLOCKS];
     size_t m_size;
 };
@@ -17,8 +17,8 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V, int N>
-block_storage<K, V, N>::~block_storage()
+template <class K, class V, int N, class Compare>
+block_storage<K, V, N, Compare>::~block_storage()
 {
     for (size_t i = 0; i < m_size; i++) {
         for (int j = 0; j < N; j++) {
@@ -27,18 +27,18 @@ block_storage<K, V, N>::~block_storage()
     }
 }
 
-template <class K, class V, int N>
-block<K, V> *
-block_storage<K, V, N>::get_block(const size_t i)
+template <class K, class V, int N, class Compare>
+block<K, V, Compare> *
+block_storage<K, V, N, Compare>::get_block(const size_t i)
 {
     for (; m_size <= i; m_size++) {
         /* Alloc new blocks. */
         for (int j = 0; j < N; j++) {
-            m_blocks[m_size].xs[j] = new block<K, V>(m_size);
+            m_blocks[m_size].xs[j] = new block<K, V, Compare>(m_size, m_resource);
         }
     }
 
-    block<K, V> *block = m_blocks[i].xs[N - 1];
+    block<K, V, Compare> *block = m_blocks[i].xs[N - 1];
     for (int j = 0; j < N - 1; j++) {
         if (!m_blocks[i].xs[j]->used()) {
             block = m_blocks[i].xs[j];
@@ -50,16 +50,31 @@ block_storage<K, V, N>::get_block(const size_t i)
     return block;
 }
 
-template <class K, class V, int N>
-block<K, V> *
-block_storage<K, V, N>::get_largest_block()
+template <class K, class V, int N, class Compare>
+block<K, V, Compare> *
+block_storage<K, V, N, Compare>::get_largest_block()
 {
     return get_block((m_size == 0) ? 0 : m_size - 1);
 }
 
-template <class K, class V, int N>
+template <class K, class V, int N, class Compare>
+size_t
+block_storage<K, V, N, Compare>::trim()
+{
+    size_t released = 0;
+    for (size_t i = 0; i < m_size; i++) {
+        for (int j = 0; j < N; j++) {
+            if (!m_blocks[i].xs[j]->used()) {
+                released += m_blocks[i].xs[j]->release();
+            }
+        }
+    }
+    return released;
+}
+
+template <class K, class V, int N, class Compare>
 void
-block_storage<K, V, N>::print() const
+block_storage<K, V, N, Compare>::print() const
 {
     for (size_t i = 0; i < m_size; i++) {
         printf("%zu: {%d", i, m_blocks[i].xs[0]->used());
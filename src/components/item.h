@@ -23,6 +23,12 @@
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "util/mm.h"
 
 namespace kpq
 {
@@ -34,16 +40,22 @@ class item
 {
 public:
     item();
+    ~item();
 
+    /** Constructs the value in place from args. */
+    template <class... Args>
     void initialize(const K &key,
-                    const V &val);
+                    Args &&... args);
     bool take(const version_t version,
               V &val);
+    /** On success, moves the value into val. Failed takes do not touch the
+     *  value (with the exception of small trivially copyable values, see
+     *  COPY_BEFORE_TAKE). */
     bool take(const version_t version,
               K &key, V &val);
 
     K key() const;
-    V val() const;
+    const V &val() const;
 
     version_t version() const;
     bool used() const;
@@ -55,13 +67,223 @@ public:
         {
             return !item.used();
         }
+
+        /** Reusable items hold no live state besides their version and
+         *  key, and may thus be released by item_allocator::trim(). */
+        static constexpr bool releasable = std::is_trivially_copyable<K>::value;
+
+#ifdef ENABLE_ITEM_RECYCLING
+        /** Taken items are returned to their allocator, see
+         *  item_allocator::recycle(). */
+        static constexpr bool recyclable = true;
+#endif
+
+        static version_t version(const item<K, V> &item)
+        {
+            return item.version();
+        }
+
+        /** Resets the version of a released item, which must be reusable
+         *  in all version schemes. */
+        static void reset(item<K, V> &item,
+                          const version_t version)
+        {
+            assert((version & 0x3) == 0);
+            item.m_version.store(version, std::memory_order_relaxed);
+        }
+    };
+
+private:
+    bool take(const version_t version,
+              K &key, V &val,
+              std::true_type);
+    bool take(const version_t version,
+              K &key, V &val,
+              std::false_type);
+
+    V *value_ptr() { return reinterpret_cast<V *>(&m_val); }
+    const V *value_ptr() const { return reinterpret_cast<const V *>(&m_val); }
+
+private:
+    /** Small trivially copyable values are speculatively copied before
+     *  the version is claimed, which keeps take() a single compare-and-swap.
+     *  All other values are only moved out once the take has succeeded. */
+    static constexpr bool COPY_BEFORE_TAKE =
+        std::is_trivially_copyable<V>::value && std::is_copy_assignable<V>::value
+        && sizeof(V) <= 2 * sizeof(uint64_t);
+
+    /** Versions cycle through 4n (reusable), 4n + 1 (in use) and 4n + 2
+     *  (taken, the value is being moved out and the item may not be reused
+     *  yet). Values copied before the take skip the last state. */
+    std::atomic<version_t> m_version;
+    K m_key;
+    typename std::aligned_storage<sizeof(V), alignof(V)>::type m_val;
+};
+
+/**
+ * Passing key_only as the value class V stores keys without values,
+ * e.g. for timestamps or integer priorities. Items then consist only of
+ * their version and key, and taking an item reads nothing but the key.
+ * The value arguments of the public interface become empty tags.
+ */
+struct key_only { };
+
+template <class K>
+class item<K, key_only>
+{
+public:
+    item();
+
+    void initialize(const K &key,
+                    const key_only &);
+    bool take(const version_t version,
+              key_only &);
+    bool take(const version_t version,
+              K &key, key_only &);
+
+    K key() const;
+    key_only val() const { return key_only(); }
+
+    version_t version() const;
+    bool used() const;
+
+    class reuse
+    {
+    public:
+        bool operator()(const item<K, key_only> &item) const
+        {
+            return !item.used();
+        }
+
+        /** See item<K, V>::reuse. */
+        static constexpr bool releasable = std::is_trivially_copyable<K>::value;
+#ifdef ENABLE_ITEM_RECYCLING
+        static constexpr bool recyclable = true;
+#endif
+
+        static version_t version(const item<K, key_only> &item)
+        {
+            return item.version();
+        }
+
+        static void reset(item<K, key_only> &item,
+                          const version_t version)
+        {
+            assert((version & 0x3) == 0);
+            item.m_version.store(version, std::memory_order_relaxed);
+        }
+    };
+
+private:
+    /** Even versions are reusable, odd versions are in use. */
+    std::atomic<version_t> m_version;
+    K m_key;
+};
+
+/** The value stored by insert(key): the key itself, or nothing for key_only
+ *  queues. */
+template <class K, class V>
+struct value_of_key {
+    static V get(const K &key) { return key; }
+};
+
+template <class K>
+struct value_of_key<K, key_only> {
+    static key_only get(const K &) { return key_only(); }
+};
+
+/**
+ * Passing intrusive<T> as the value class V selects the intrusive mode:
+ * T embeds the item itself by deriving from item_hook<K, T>, and objects
+ * are inserted and removed by pointer. Blocks then reference user memory
+ * directly, and no items are allocated by the queue. Since stale block
+ * references may read an object's version at any time, objects must remain
+ * valid (e.g. within an arena) for the lifetime of the queue. An object may
+ * be reinserted once it has been removed.
+ */
+template <class T>
+struct intrusive {
+    T *m_object;
+};
+
+template <class K, class T>
+class item<K, intrusive<T>>
+{
+public:
+    item();
+
+    /** Prepares the object for insertion with the given key. */
+    void initialize(const K &key);
+    bool take(const version_t version,
+              intrusive<T> &val);
+    bool take(const version_t version,
+              K &key, intrusive<T> &val);
+
+    K key() const;
+
+    version_t version() const;
+    bool used() const;
+
+    class reuse
+    {
+    public:
+        bool operator()(const item<K, intrusive<T>> &item) const
+        {
+            return !item.used();
+        }
     };
 
 private:
     /** Even versions are reusable, odd versions are in use. */
     std::atomic<version_t> m_version;
     K m_key;
-    V m_val;
+};
+
+template <class K, class T>
+using item_hook = item<K, intrusive<T>>;
+
+/** Provides the object pointer type of intrusive queues. Undefined for all
+ *  other value classes, which allows enabling the intrusive interface only
+ *  where it applies. */
+template <class V>
+struct intrusive_object { };
+
+template <class T>
+struct intrusive_object<intrusive<T>> {
+    typedef T *pointer;
+};
+
+/**
+ * The allocator of all items referenced by lsm blocks and item handles.
+ * Whoever takes such an item returns it through item_allocator_of::recycle().
+ * Intrusive items are owned by the user and never recycled.
+ */
+template <class K, class V>
+using item_allocator_of = item_allocator<item<K, V>, typename item<K, V>::reuse>;
+
+/**
+ * Refers to a single insertion of an item. Since taking an item increments
+ * its version, a handle remains valid exactly until the item is taken,
+ * regardless of the block it is currently referenced from.
+ */
+template <class K, class V>
+struct item_handle {
+    static item_handle EMPTY() { return { nullptr, 0 }; }
+
+    bool empty() const { return (m_item == nullptr); }
+    bool taken() const { return m_item->version() != m_version; }
+    bool take(K &key, V &val) { return recycled(m_item->take(m_version, key, val)); }
+
+    bool recycled(const bool taken) const
+    {
+        if (taken) {
+            item_allocator_of<K, V>::recycle(m_item);
+        }
+        return taken;
+    }
+
+    item<K, V> *m_item;
+    version_t m_version;
 };
 
 #include "item_inl.h"
@@ -24,14 +24,24 @@ item<K, V>::item() :
 }
 
 template <class K, class V>
+item<K, V>::~item()
+{
+    if (!std::is_trivially_destructible<V>::value && (version() & 0x3) == 1) {
+        value_ptr()->~V();
+    }
+}
+
+template <class K, class V>
+template <class... Args>
 void
-item<K, V>::initialize(const K &key, const V &val)
+item<K, V>::initialize(const K &key,
+                       Args &&... args)
 {
     assert(!used());
 
     m_version.fetch_add(1, std::memory_order_relaxed); /* TODO: Really relaxed? */
     m_key = key;
-    m_val = val;
+    new (value_ptr()) V(std::forward<Args>(args)...);
 
     assert(used());
 }
@@ -40,16 +50,46 @@ template <class K, class V>
 bool
 item<K, V>::take(const version_t version,
                  K &key, V &val)
+{
+    return take(version, key, val, std::integral_constant<bool, COPY_BEFORE_TAKE>());
+}
+
+template <class K, class V>
+bool
+item<K, V>::take(const version_t version,
+                 K &key, V &val,
+                 std::true_type)
 {
     key = m_key;
-    val = m_val;
+    val = *value_ptr();
 
     version_t expected = version;
     return m_version.compare_exchange_strong(expected,
-                                             expected + 1,
+                                             expected + 3,
                                              std::memory_order_relaxed);
 }
 
+template <class K, class V>
+bool
+item<K, V>::take(const version_t version,
+                 K &key, V &val,
+                 std::false_type)
+{
+    version_t expected = version;
+    if (!m_version.compare_exchange_strong(expected,
+                                           expected + 1,
+                                           std::memory_order_acquire)) {
+        return false;
+    }
+
+    key = m_key;
+    val = std::move(*value_ptr());
+    value_ptr()->~V();
+
+    m_version.store(version + 3, std::memory_order_release);
+    return true;
+}
+
 template <class K, class V>
 bool
 item<K, V>::take(const version_t version,
@@ -67,10 +107,10 @@ item<K, V>::key() const
 }
 
 template <class K, class V>
-V
+const V &
 item<K, V>::val() const
 {
-    return m_val;
+    return *value_ptr();
 }
 
 template <class K, class V>
@@ -83,6 +123,133 @@ item<K, V>::version() const
 template <class K, class V>
 bool
 item<K, V>::used() const
+{
+    return ((version() & 0x3) != 0);
+}
+
+template <class K>
+item<K, key_only>::item() :
+    m_version(0)
+{
+}
+
+template <class K>
+void
+item<K, key_only>::initialize(const K &key,
+                              const key_only &)
+{
+    assert(!used());
+
+    m_version.fetch_add(1, std::memory_order_relaxed);
+    m_key = key;
+
+    assert(used());
+}
+
+template <class K>
+bool
+item<K, key_only>::take(const version_t version,
+                        K &key, key_only &)
+{
+    key = m_key;
+
+    version_t expected = version;
+    return m_version.compare_exchange_strong(expected,
+                                             expected + 1,
+                                             std::memory_order_relaxed);
+}
+
+template <class K>
+bool
+item<K, key_only>::take(const version_t version,
+                        key_only &)
+{
+    /* Nothing is read, only the version must be claimed. */
+    version_t expected = version;
+    return m_version.compare_exchange_strong(expected,
+                                             expected + 1,
+                                             std::memory_order_relaxed);
+}
+
+template <class K>
+K
+item<K, key_only>::key() const
+{
+    return m_key;
+}
+
+template <class K>
+version_t
+item<K, key_only>::version() const
+{
+    return m_version.load(std::memory_order_relaxed);
+}
+
+template <class K>
+bool
+item<K, key_only>::used() const
+{
+    return ((version() & 0x1) == 1);
+}
+
+template <class K, class T>
+item<K, intrusive<T>>::item() :
+    m_version(0)
+{
+}
+
+template <class K, class T>
+void
+item<K, intrusive<T>>::initialize(const K &key)
+{
+    assert(!used());
+
+    m_version.fetch_add(1, std::memory_order_relaxed);
+    m_key = key;
+
+    assert(used());
+}
+
+template <class K, class T>
+bool
+item<K, intrusive<T>>::take(const version_t version,
+                            K &key, intrusive<T> &val)
+{
+    key = m_key;
+    val.m_object = static_cast<T *>(this);
+
+    version_t expected = version;
+    return m_version.compare_exchange_strong(expected,
+                                             expected + 1,
+                                             std::memory_order_relaxed);
+}
+
+template <class K, class T>
+bool
+item<K, intrusive<T>>::take(const version_t version,
+                            intrusive<T> &val)
+{
+    K key;
+    return take(version, key, val);
+}
+
+template <class K, class T>
+K
+item<K, intrusive<T>>::key() const
+{
+    return m_key;
+}
+
+template <class K, class T>
+version_t
+item<K, intrusive<T>>::version() const
+{
+    return m_version.load(std::memory_order_relaxed);
+}
+
+template <class K, class T>
+bool
+item<K, intrusive<T>>::used() const
 {
     return ((version() & 0x1) == 1);
 }
@@ -0,0 +1,103 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MULTIWAY_MERGE_H
+#define __MULTIWAY_MERGE_H
+
+#include <cassert>
+
+#include "block.h"
+
+namespace kpq
+{
+
+/**
+ * Iterates over several sorted ranges of block items in ascending key order.
+ * This allows operations which are interested in more than a single minimal
+ * item (e.g. batched deletions) to process candidates of all blocks within
+ * a single pass.
+ *
+ * Ranges may be marked as partial, meaning that they are a prefix of a larger
+ * sequence of which we know nothing beyond the range itself (e.g. the items
+ * within the pivot range of the shared lsm). Once all partial ranges are
+ * exhausted, we can no longer guarantee that the remaining items of other
+ * ranges are smaller than items outside of any range, and iteration stops.
+ */
+
+template <class K, class V, int MaxRanges, class Compare = std::less<K>>
+class multiway_merge
+{
+public:
+    typedef typename block<K, V, Compare>::block_item block_item;
+
+public:
+    multiway_merge();
+
+    /** Adds the range [first, last) of block b and returns its index. */
+    size_t add(const block<K, V, Compare> *b,
+               const size_t first,
+               const size_t last,
+               const bool partial);
+
+    /** Stores a copy of the next item in ascending key order in it, or returns
+     *  false once iteration has completed. Note that returned items may
+     *  already have been taken. */
+    bool next(block_item &it);
+
+    /** Attempts to take the next (up to) n items and stores them in
+     *  keys and vals. Returns the number of items taken. */
+    size_t take(K *keys,
+                V *vals,
+                const size_t n);
+
+    /** Stores the keys of the next (up to) n items which have not been taken
+     *  yet in keys, without taking them. Returns the number of stored keys. */
+    size_t peek(K *keys,
+                const size_t n);
+
+    /** Returns the number of items returned so far from the given range. */
+    size_t consumed(const size_t range_ix) const;
+
+    /** Returns the number of ranges. */
+    size_t size() const { return m_size; }
+    /** Returns the total number of items within all ranges. */
+    size_t items() const { return m_items; }
+
+private:
+    struct range {
+        const block<K, V, Compare> *m_block;
+        size_t m_begin, m_next, m_end;
+        bool m_partial;
+    };
+
+    range m_ranges[MaxRanges];
+    size_t m_size;
+    size_t m_items;
+
+    /** The number of (initially non-empty) partial ranges which are not yet
+     *  exhausted. */
+    size_t m_partial_ranges;
+    bool m_has_partial_ranges;
+};
+
+#include "multiway_merge_inl.h"
+
+}
+
+#endif /* __MULTIWAY_MERGE_H */
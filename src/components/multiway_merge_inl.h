@@ -0,0 +1,127 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+template <class K, class V, int MaxRanges, class Compare>
+multiway_merge<K, V, MaxRanges, Compare>::multiway_merge() :
+    m_size(0),
+    m_items(0),
+    m_partial_ranges(0),
+    m_has_partial_ranges(false)
+{
+}
+
+template <class K, class V, int MaxRanges, class Compare>
+size_t
+multiway_merge<K, V, MaxRanges, Compare>::add(const block<K, V, Compare> *b,
+                                              const size_t first,
+                                              const size_t last,
+                                              const bool partial)
+{
+    assert(m_size < MaxRanges);
+
+    auto &r = m_ranges[m_size];
+    r.m_block   = b;
+    r.m_begin   = first;
+    r.m_next    = r.m_begin;
+    r.m_end     = std::max(first, last);
+    r.m_partial = partial;
+
+    if (partial && r.m_next < r.m_end) {
+        m_has_partial_ranges = true;
+        m_partial_ranges++;
+    }
+
+    m_items += r.m_end - r.m_begin;
+
+    return m_size++;
+}
+
+template <class K, class V, int MaxRanges, class Compare>
+bool
+multiway_merge<K, V, MaxRanges, Compare>::next(block_item &it)
+{
+    if (m_has_partial_ranges && m_partial_ranges == 0) {
+        return false;
+    }
+
+    range *best = nullptr;
+    for (size_t i = 0; i < m_size; i++) {
+        auto &r = m_ranges[i];
+        if (r.m_next < r.m_end && (best == nullptr
+                || Compare()(r.m_block->key(r.m_next), best->m_block->key(best->m_next)))) {
+            best = &r;
+        }
+    }
+
+    if (best == nullptr) {
+        return false;
+    }
+
+    /* Copy the block item since its block may be reused concurrently. */
+    it = best->m_block->peek_nth(best->m_next++);
+    if (best->m_partial && best->m_next == best->m_end) {
+        m_partial_ranges--;
+    }
+
+    return true;
+}
+
+template <class K, class V, int MaxRanges, class Compare>
+size_t
+multiway_merge<K, V, MaxRanges, Compare>::take(K *keys,
+                                               V *vals,
+                                               const size_t n)
+{
+    size_t taken = 0;
+    block_item candidate;
+    while (taken < n && next(candidate)) {
+        if (!candidate.empty() && !candidate.taken()
+                && candidate.take(keys[taken], vals[taken])) {
+            taken++;
+        }
+    }
+
+    return taken;
+}
+
+template <class K, class V, int MaxRanges, class Compare>
+size_t
+multiway_merge<K, V, MaxRanges, Compare>::peek(K *keys,
+                                               const size_t n)
+{
+    size_t peeked = 0;
+    block_item candidate;
+    while (peeked < n && next(candidate)) {
+        /* Block items carry a copy of the key, it is valid for as long as
+         * the item has not been taken. */
+        if (!candidate.empty() && !candidate.taken()) {
+            keys[peeked++] = candidate.m_key;
+        }
+    }
+
+    return peeked;
+}
+
+template <class K, class V, int MaxRanges, class Compare>
+size_t
+multiway_merge<K, V, MaxRanges, Compare>::consumed(const size_t range_ix) const
+{
+    assert(range_ix < m_size);
+    return m_ranges[range_ix].m_next - m_ranges[range_ix].m_begin;
+}
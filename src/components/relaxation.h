@@ -0,0 +1,190 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RELAXATION_H
+#define __RELAXATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+namespace kpq
+{
+
+/**
+ * Passed as the Rlx template argument to select a relaxation bound which is
+ * determined at runtime (and which may change while the queue is in use).
+ * Relaxation bounds must be positive.
+ */
+constexpr int DYNAMIC_RELAXATION = -1;
+
+/**
+ * Per-thread contention statistics which drive adaptive relaxation, in the
+ * spirit of the contention avoiding CA-PQ (see lib/capq). Contended operations
+ * (e.g. retried inserts into the shared lsm) weigh far more than uncontended
+ * ones, such that a few conflicts suffice to raise the relaxation while a long
+ * quiet phase is required to lower it again.
+ */
+class contention_stats
+{
+public:
+    static constexpr int HIGH_CONTENTION_LIMIT = 1000;
+    static constexpr int LOW_CONTENTION_LIMIT = -1000;
+    static constexpr int HIGH_CONTENTION_INCREASE = 250;
+    static constexpr int LOW_CONTENTION_DECREASE = 1;
+
+    contention_stats() : m_score(0) { }
+
+    void contended() { m_score += HIGH_CONTENTION_INCREASE; }
+    void uncontended() { m_score -= LOW_CONTENTION_DECREASE; }
+
+    bool high() const { return m_score > HIGH_CONTENTION_LIMIT; }
+    bool low() const { return m_score < LOW_CONTENTION_LIMIT; }
+    void reset() { m_score = 0; }
+
+private:
+    int m_score;
+};
+
+/**
+ * Provides access to the relaxation bound. For fixed relaxations, the bound
+ * is the compile-time constant Rlx and this class is empty.
+ */
+template <int Rlx>
+class relaxation
+{
+    static_assert(Rlx > 0, "Relaxation must be positive");
+public:
+    relaxation() { }
+    relaxation(const int value)
+    {
+        assert(value == Rlx), (void)value;
+    }
+
+    static constexpr int get() { return Rlx; }
+    void set(const int value)
+    {
+        assert(value == Rlx), (void)value;
+    }
+
+    static constexpr bool adaptive() { return false; }
+    void set_range(const int min,
+                   const int max)
+    {
+        assert(min == Rlx && max == Rlx), (void)min, (void)max;
+    }
+    void adapt(contention_stats &) { }
+};
+
+/**
+ * A relaxation bound which may be adjusted at runtime. Changes are not
+ * synchronized with concurrent operations, which simply pick up the new
+ * bound the next time they read it.
+ *
+ * If the permitted range [min, max] is non-trivial, the bound is adaptive:
+ * adapt() doubles it when the calling thread has observed high contention,
+ * and halves it when the thread has been uncontended for a while.
+ */
+template <>
+class relaxation<DYNAMIC_RELAXATION>
+{
+public:
+    static constexpr int DEFAULT_VALUE = 256;
+
+    relaxation() :
+        m_value(DEFAULT_VALUE),
+        m_min(DEFAULT_VALUE),
+        m_max(DEFAULT_VALUE)
+    {
+    }
+
+    relaxation(const int value) :
+        m_value(value),
+        m_min(value),
+        m_max(value)
+    {
+        assert(value > 0);
+    }
+
+    /** Copies only the current bound, copies are never adaptive. */
+    relaxation(const relaxation &that) :
+        m_value(that.get()),
+        m_min(that.get()),
+        m_max(that.get())
+    {
+    }
+
+    relaxation &operator=(const relaxation &that)
+    {
+        set(that.get());
+        return *this;
+    }
+
+    int get() const { return m_value.load(std::memory_order_relaxed); }
+    void set(const int value)
+    {
+        assert(value > 0);
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    bool adaptive() const
+    {
+        return m_min.load(std::memory_order_relaxed) < m_max.load(std::memory_order_relaxed);
+    }
+
+    /** Restricts the bound to [min, max]. The bound is fixed if min == max. */
+    void set_range(const int min,
+                   const int max)
+    {
+        assert(min > 0 && min <= max);
+        m_min.store(min, std::memory_order_relaxed);
+        m_max.store(max, std::memory_order_relaxed);
+        set(std::min(std::max(get(), min), max));
+    }
+
+    /** Adjusts an adaptive bound according to the given statistics, which
+     *  are reset once they trigger an adjustment. */
+    void adapt(contention_stats &stats)
+    {
+        if (stats.high()) {
+            stats.reset();
+            const int value = get();
+            const int max = m_max.load(std::memory_order_relaxed);
+            if (value < max) {
+                set(std::min(value * 2, max));
+            }
+        } else if (stats.low()) {
+            stats.reset();
+            const int value = get();
+            const int min = m_min.load(std::memory_order_relaxed);
+            if (value > min) {
+                set(std::max(value / 2, min));
+            }
+        }
+    }
+
+private:
+    std::atomic<int> m_value;
+    std::atomic<int> m_min;
+    std::atomic<int> m_max;
+};
+
+}
+
+#endif /* __RELAXATION_H */
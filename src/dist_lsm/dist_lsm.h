@@ -26,12 +26,15 @@
 namespace kpq
 {
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare = std::less<K>>
 class dist_lsm
 {
-    friend int dist_lsm_local<K, V, Rlx>::spy(dist_lsm<K, V, Rlx> *parent);
+    friend class dist_lsm_local<K, V, Rlx, Compare>;
 
 public:
+    /** All per-thread blocks and items are allocated from resource. */
+    explicit dist_lsm(memory_resource *resource = get_default_resource()) :
+        m_local(resource), m_participants(resource), m_spy_policy(SPY_UNIFORM), m_spy_steal(0) { }
 
     /**
      * Inserts a new item into the local LSM.
@@ -39,6 +42,15 @@ public:
     void insert(const K &key);
     void insert(const K &key,
                 const V &val);
+    void insert(const K &key,
+                V &&val);
+
+    /** Constructs the value in place from args. Together with the move-only
+     *  insert() above, this allows storing large or move-only values without
+     *  any copies. */
+    template <class... Args>
+    void emplace(const K &key,
+                 Args &&... args);
 
     /**
      * A special version of insert for use by the k-lsm. Acts like a standard
@@ -47,7 +59,33 @@ public:
      */
     void insert(const K &key,
                 const V &val,
-                shared_lsm<K, V, Rlx> *slsm);
+                shared_lsm<K, V, Rlx, Compare> *slsm);
+    /** As above, additionally setting handle to refer to the new item. */
+    void insert(const K &key,
+                const V &val,
+                shared_lsm<K, V, Rlx, Compare> *slsm,
+                item_handle<K, V> &handle);
+    /** Inserts an item initialized by the caller (see intrusive<T>). */
+    void insert(item<K, V> *it,
+                shared_lsm<K, V, Rlx, Compare> *slsm);
+    /** The k-lsm's variant of emplace(). handle may be null. */
+    template <class... Args>
+    void emplace_into(shared_lsm<K, V, Rlx, Compare> *slsm,
+                      item_handle<K, V> *handle,
+                      const K &key,
+                      Args &&... args);
+
+    /**
+     * Inserts all (key, value) pairs in [first, last). The batch is sorted
+     * locally and merged into the local LSM in a single step.
+     */
+    template <class ForwardIterator>
+    void insert_bulk(ForwardIterator first,
+                     ForwardIterator last);
+    template <class ForwardIterator>
+    void insert_bulk(ForwardIterator first,
+                     ForwardIterator last,
+                     shared_lsm<K, V, Rlx, Compare> *slsm);
 
     /**
      * Attempts to remove the locally (i.e. on the current thread) minimal item.
@@ -57,17 +95,94 @@ public:
      */
     bool delete_min(V &val);
     bool delete_min(K &key, V &val);
-    void find_min(typename block<K, V>::peek_t &best);
+    void find_min(typename block<K, V, Compare>::peek_t &best);
+
+    /**
+     * Stores the locally minimal key in key without removing its item, and
+     * returns false if the local LSM is empty. Unlike delete_min(), this does
+     * not spy on other threads.
+     */
+    bool peek_min(K &key);
+
+    /** Stores up to n locally minimal keys in ascending order in keys and
+     *  returns their number. Items are not removed. */
+    size_t top_k(K *keys,
+                 const size_t n);
+
+    /**
+     * Removes up to n locally minimal items within a single pass over the
+     * local LSM and returns the number of removed items.
+     */
+    size_t delete_min_batch(K *keys,
+                            V *vals,
+                            const size_t n);
+
+    /** Used by the k-lsm's delete_min_batch(). See dist_lsm_local. */
+    template <class Merge>
+    void add_candidates(Merge &merge);
 
     int spy();
 
+    /**
+     * Called by a thread which stops using this lsm (e.g. before it exits).
+     * Remaining local items are moved into slsm if given. Unless items remain
+     * locally (without slsm), the thread then no longer participates, i.e. is
+     * no longer considered as a victim by spy(). Threads participate from
+     * their first insert on, and inserting again implicitly re-registers the
+     * thread.
+     */
+    void deregister_thread();
+    void deregister_thread(shared_lsm<K, V, Rlx, Compare> *slsm);
+
+    /** Returns the number of participating threads. */
+    size_t num_participants() const { return m_participants.size(); }
+
+    /**
+     * Returns the memory of the calling thread's reusable items and unused
+     * blocks to the OS, e.g. after a load peak, and returns the number of
+     * released bytes. Released memory remains mapped and is reused once
+     * the thread requires it again.
+     */
+    size_t trim();
+    /** See dist_lsm_local::trim_due(). */
+    bool trim_due(const size_t interval);
+
+    /** Sets the policy by which spy() selects its victims, see spy_policy.
+     *  May be changed at any time. */
+    void set_spy_policy(const kpq::spy_policy policy) { m_spy_policy.store(policy, std::memory_order_relaxed); }
+    kpq::spy_policy spy_policy() const { return m_spy_policy.load(std::memory_order_relaxed); }
+
+    /** Lets spy() steal only the (up to) n smallest items of its victim,
+     *  but at most half of them, instead of copying the victim's largest
+     *  block in full. Bounds the cost of each spy and leaves the remaining
+     *  items to the victim. 0 (the default) copies the largest block.
+     *
+     *  As with copies, stolen items are shared rather than moved: the
+     *  victim keeps referencing them, since its blocks are only modified by
+     *  their owner, and moving items would invalidate their handles (and is
+     *  impossible for intrusive items). Whichever thread takes an item first
+     *  gets it. Failed takes are counted by dlsm_take_failures, and those
+     *  of spies additionally by spied_take_failures. */
+    void set_spy_steal(const size_t n) { m_spy_steal.store(n, std::memory_order_relaxed); }
+    size_t spy_steal() const { return m_spy_steal.load(std::memory_order_relaxed); }
+
     void print();
 
     void init_thread(const size_t) const { }
     constexpr static bool supports_concurrency() { return true; }
 
 private:
-    thread_local_ptr<dist_lsm_local<K, V, Rlx>> m_local;
+    /** Returns the current thread's local lsm, registering the thread as a
+     *  participant if necessary. */
+    dist_lsm_local<K, V, Rlx, Compare> *inserting_local();
+
+private:
+    thread_local_ptr<dist_lsm_local<K, V, Rlx, Compare>> m_local;
+    /** The threads which have inserted into this lsm and not deregistered
+     *  since, from which spy() draws its victims. */
+    tid_set m_participants;
+    std::atomic<kpq::spy_policy> m_spy_policy;
+    std::atomic<size_t> m_spy_steal;
 };
 
 #include "dist_lsm_inl.h"
@@ -17,61 +17,218 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm<K, V, Rlx>::insert(const K &key)
+dist_lsm<K, V, Rlx, Compare>::insert(const K &key)
 {
-    insert(key, key);
+    insert(key, value_of_key<K, V>::get(key));
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm<K, V, Rlx>::insert(const K &key,
-                            const V &val)
+dist_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                     const V &val)
 {
-    m_local.get()->insert(key, val, nullptr);
+    inserting_local()->insert(key, val, nullptr, nullptr);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm<K, V, Rlx>::insert(const K &key,
-                            const V &val,
-                            shared_lsm<K, V, Rlx> *slsm)
+dist_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                     V &&val)
 {
-    m_local.get()->insert(key, val, slsm);
+    inserting_local()->emplace(key, nullptr, nullptr, std::move(val));
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+template <class... Args>
+void
+dist_lsm<K, V, Rlx, Compare>::emplace(const K &key,
+                                      Args &&... args)
+{
+    inserting_local()->emplace(key, nullptr, nullptr, std::forward<Args>(args)...);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                     const V &val,
+                                     shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    inserting_local()->insert(key, val, slsm, nullptr);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                     const V &val,
+                                     shared_lsm<K, V, Rlx, Compare> *slsm,
+                                     item_handle<K, V> &handle)
+{
+    inserting_local()->insert(key, val, slsm, &handle);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm<K, V, Rlx, Compare>::insert(item<K, V> *it,
+                                     shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    inserting_local()->insert(it, slsm);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class... Args>
+void
+dist_lsm<K, V, Rlx, Compare>::emplace_into(shared_lsm<K, V, Rlx, Compare> *slsm,
+                                           item_handle<K, V> *handle,
+                                           const K &key,
+                                           Args &&... args)
+{
+    inserting_local()->emplace(key, slsm, handle, std::forward<Args>(args)...);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class ForwardIterator>
+void
+dist_lsm<K, V, Rlx, Compare>::insert_bulk(ForwardIterator first,
+                                          ForwardIterator last)
+{
+    inserting_local()->insert_bulk(first, last, nullptr);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class ForwardIterator>
+void
+dist_lsm<K, V, Rlx, Compare>::insert_bulk(ForwardIterator first,
+                                          ForwardIterator last,
+                                          shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    inserting_local()->insert_bulk(first, last, slsm);
+}
+
+template <class K, class V, int Rlx, class Compare>
 bool
-dist_lsm<K, V, Rlx>::delete_min(V &val)
+dist_lsm<K, V, Rlx, Compare>::delete_min(V &val)
 {
     return m_local.get()->delete_min(this, val);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-dist_lsm<K, V, Rlx>::delete_min(K &key, V &val)
+dist_lsm<K, V, Rlx, Compare>::delete_min(K &key, V &val)
 {
     return m_local.get()->delete_min(this, key, val);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm<K, V, Rlx>::find_min(typename block<K, V>::peek_t &best)
+dist_lsm<K, V, Rlx, Compare>::find_min(typename block<K, V, Compare>::peek_t &best)
 {
     m_local.get()->peek(best);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+bool
+dist_lsm<K, V, Rlx, Compare>::peek_min(K &key)
+{
+    typename block<K, V, Compare>::peek_t best = block<K, V, Compare>::peek_t::EMPTY();
+    find_min(best);
+
+    if (best.empty()) {
+        return false;
+    }
+
+    key = best.m_key;
+    return true;
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm<K, V, Rlx, Compare>::top_k(K *keys,
+                                    const size_t n)
+{
+    multiway_merge<K, V, dist_lsm_local<K, V, Rlx, Compare>::MAX_CANDIDATE_RANGES, Compare> merge;
+    add_candidates(merge);
+    return merge.peek(keys, n);
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm<K, V, Rlx, Compare>::delete_min_batch(K *keys,
+                                               V *vals,
+                                               const size_t n)
+{
+    const size_t taken = m_local.get()->delete_min_batch(this, keys, vals, n);
+    COUNT_ADD(batch_deletes, taken);
+    return taken;
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
+void
+dist_lsm<K, V, Rlx, Compare>::add_candidates(Merge &merge)
+{
+    m_local.get()->add_candidates(merge);
+}
+
+template <class K, class V, int Rlx, class Compare>
 int
-dist_lsm<K, V, Rlx>::spy()
+dist_lsm<K, V, Rlx, Compare>::spy()
 {
     return m_local.get()->spy(this);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm<K, V, Rlx, Compare>::deregister_thread()
+{
+    deregister_thread(nullptr);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm<K, V, Rlx, Compare>::deregister_thread(shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    auto local = m_local.get();
+    local->deregister(slsm);
+
+    /* Items left behind remain reachable through spying. */
+
+    if (local->participating() && local->empty()) {
+        local->set_participating(false);
+        m_participants.erase(m_local.current_thread());
+    }
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm<K, V, Rlx, Compare>::trim()
+{
+    return m_local.get()->trim();
+}
+
+template <class K, class V, int Rlx, class Compare>
+bool
+dist_lsm<K, V, Rlx, Compare>::trim_due(const size_t interval)
+{
+    return m_local.get()->trim_due(interval);
+}
+
+template <class K, class V, int Rlx, class Compare>
+dist_lsm_local<K, V, Rlx, Compare> *
+dist_lsm<K, V, Rlx, Compare>::inserting_local()
+{
+    auto local = m_local.get();
+    if (!local->participating()) {
+        local->set_participating(true);
+        m_participants.insert(m_local.current_thread());
+    }
+    return local;
+}
+
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm<K, V, Rlx>::print()
+dist_lsm<K, V, Rlx, Compare>::print()
 {
     for (size_t i = 0; i < m_local.num_threads(); i++) {
         m_local.get(i)->print();
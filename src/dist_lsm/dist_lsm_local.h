@@ -21,80 +21,205 @@
 #define __DIST_LSM_LOCAL_H
 
 #include <atomic>
+#include <iterator>
+#include <limits>
 
 #include "components/block_storage.h"
 #include "components/item.h"
+#include "components/multiway_merge.h"
 #include "util/counters.h"
 #include "util/mm.h"
 #include "util/thread_local_ptr.h"
+#include "util/tid_set.h"
+#include "util/topology.h"
 #include "util/xorshf96.h"
 
 namespace kpq
 {
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 class dist_lsm;
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 class shared_lsm;
 
-template <class K, class V, int Rlx>
+/** Selects the victims of dist_lsm_local::spy(). */
+enum spy_policy {
+    /** Any participant, chosen uniformly at random. */
+    SPY_UNIFORM,
+    /** The last successful victim while it has items, and otherwise the
+     *  closest of several participants drawn at random: hardware threads of
+     *  the same core first, then those of the same socket, then remote ones.
+     *  Falls back to uniform selection after repeated failures. */
+    SPY_TOPOLOGY,
+};
+
+template <class K, class V, int Rlx, class Compare = std::less<K>>
 class dist_lsm_local
 {
 public:
-    dist_lsm_local();
+    /** Blocks and items are allocated from resource. */
+    explicit dist_lsm_local(memory_resource *resource = get_default_resource());
     virtual ~dist_lsm_local();
 
+    /** If handle is non-null, it is set to refer to the new item. */
     void insert(const K &key,
                 const V &val,
-                shared_lsm<K, V, Rlx> *slsm);
-    bool delete_min(dist_lsm<K, V, Rlx> *parent,
+                shared_lsm<K, V, Rlx, Compare> *slsm,
+                item_handle<K, V> *handle);
+    /** Inserts an item initialized by the caller, i.e. an intrusive item. */
+    void insert(item<K, V> *it,
+                shared_lsm<K, V, Rlx, Compare> *slsm);
+    /** As insert(), but constructs the value in place from args. */
+    template <class... Args>
+    void emplace(const K &key,
+                 shared_lsm<K, V, Rlx, Compare> *slsm,
+                 item_handle<K, V> *handle,
+                 Args &&... args);
+    /** Inserts all (key, value) pairs in [first, last) at once. The batch is
+     *  sorted into a single block which is then merged into the local lsm
+     *  (or passed on to slsm if it exceeds the relaxation bound), amortizing
+     *  the merge cascade of individual insertions over the whole batch. */
+    template <class ForwardIterator>
+    void insert_bulk(ForwardIterator first,
+                     ForwardIterator last,
+                     shared_lsm<K, V, Rlx, Compare> *slsm);
+    bool delete_min(dist_lsm<K, V, Rlx, Compare> *parent,
                     V &val);
-    bool delete_min(dist_lsm<K, V, Rlx> *parent,
+    bool delete_min(dist_lsm<K, V, Rlx, Compare> *parent,
                     K &key, V &val);
     /** Iterates through local items and returns the best one found.
      *  In the process of finding the minimal item, unowned items
      *  in each block are removed and block merges are performed if possible.
      *  Used internally by delete_min() and by the k-lsm's delete_min()
      *  operation. */
-    void peek(typename block<K, V>::peek_t &best);
+    void peek(typename block<K, V, Compare>::peek_t &best);
+
+    /** Removes up to n locally minimal items in ascending key order and
+     *  returns the number of removed items. Like delete_min(), spies once if
+     *  the local lsm is empty. */
+    size_t delete_min_batch(dist_lsm<K, V, Rlx, Compare> *parent,
+                            K *keys,
+                            V *vals,
+                            const size_t n);
+
+    /** Cleans up local blocks (as in peek()) and adds each of them to merge. */
+    template <class Merge>
+    void add_candidates(Merge &merge);
 
     /** Performs a peek without mutating blocks May be called from other threads. */
-    void safe_peek(typename block<K, V>::peek_t &best);
+    void safe_peek(typename block<K, V, Compare>::peek_t &best);
 
     /** Attempts to copy items from a random other thread's local clsm,
      *  and returns the number of items copied. */
-    int spy(class dist_lsm<K, V, Rlx> *parent);
-    int spy(dist_lsm_local<K, V, Rlx> *victim);
+    int spy(class dist_lsm<K, V, Rlx, Compare> *parent);
+    /** Copies the victim's largest block if max_stolen is 0, and otherwise
+     *  its (up to) max_stolen smallest items, see dist_lsm::set_spy_steal(). */
+    int spy(dist_lsm_local<K, V, Rlx, Compare> *victim,
+            const size_t max_stolen = 0);
 
     bool empty() const { return m_head.load(std::memory_order_relaxed) == nullptr; }
 
+    /** Whether the owner is registered as a participant of the parent, see
+     *  dist_lsm::deregister_thread(). Only accessed by the owner. */
+    bool participating() const { return m_participating; }
+    void set_participating(const bool participating) { m_participating = participating; }
+
+    /** Moves all remaining local items into slsm. Without a shared lsm,
+     *  items cannot be moved and nothing is done. */
+    void deregister(shared_lsm<K, V, Rlx, Compare> *slsm);
+
+    /** Releases the memory of reusable items and unused blocks to the OS and
+     *  returns the number of released bytes. */
+    size_t trim();
+
+    /** Counts delete_min() calls which found the queue empty, and returns
+     *  true (once) for every interval such calls. */
+    bool trim_due(const size_t interval);
+
+    /** One range per block size plus the spied block. */
+    static constexpr int MAX_CANDIDATE_RANGES = block_storage<K, V, 4, Compare>::MAX_BLOCKS + 1;
+
     void print() const;
 
 private:
     /** The internal insertion, used both in the public insert() and in spy(). */
     void insert(item<K, V> *it,
                 const version_t version,
-                shared_lsm<K, V, Rlx> *slsm);
+                shared_lsm<K, V, Rlx, Compare> *slsm);
 
     /**
      * Inserts new_block into the linked list of blocks, merging with
-     * same size blocks until no two blocks in the list have the same size.
+     * blocks of the same or smaller size until no two blocks in the list
+     * have the same size.
      */
-    void merge_insert(block<K, V> *const new_block,
-                      shared_lsm<K, V, Rlx> *slsm);
+    void merge_insert(block<K, V, Compare> *const new_block,
+                      shared_lsm<K, V, Rlx, Compare> *slsm);
+
+    /** Return the thread id of the next victim of spy() according to the
+     *  respective policy, or NO_VICTIM if no other participant with items
+     *  has been drawn. */
+    size_t uniform_victim(dist_lsm<K, V, Rlx, Compare> *parent,
+                          const size_t current_thread);
+    size_t topology_victim(dist_lsm<K, V, Rlx, Compare> *parent,
+                           const size_t num_threads,
+                           const size_t current_thread,
+                           const int cpu);
+
+    /** Copies the (up to) max_stolen smallest items of the victim's blocks,
+     *  starting at head, into a new block. Returns null if there are none. */
+    block<K, V, Compare> *steal(dist_lsm_local<K, V, Rlx, Compare> *victim,
+                                block<K, V, Compare> *head,
+                                const size_t max_stolen);
 
 private:
-    std::atomic<block<K, V> *> m_head; /**< The largest  block. */
-    block<K, V>               *m_tail; /**< The smallest block. */
-    block<K, V>               *m_spied;
+    static constexpr size_t NO_VICTIM = static_cast<size_t>(-1);
+
+    /** Consecutive failed spies after which SPY_TOPOLOGY selects a single
+     *  victim uniformly. */
+    static constexpr size_t MAX_FAILED_SPIES = 4;
+
+    /** The number of participants drawn per victim selection. */
+    static constexpr size_t MAX_VICTIM_DRAWS = 8;
+
+    /** Stealing skips at most this many taken items per stolen item. */
+    static constexpr size_t MAX_SKIPPED_PER_STOLEN = 4;
+
+    /** Read by spying threads. The padding keeps them off the cache line of
+     *  the fields below, which the owner writes on every operation. */
+    std::atomic<block<K, V, Compare> *> m_head; /**< The largest  block. */
+    /** The CPU the owner last ran on when inserting or spying. */
+    std::atomic<int> m_cpu;
+    char m_padding[CACHE_LINE_SIZE];
+
+    block<K, V, Compare>               *m_tail; /**< The smallest block. */
+    block<K, V, Compare>               *m_spied;
+
+    bool m_participating;
+
+    size_t m_empty_deletes;
+
+    size_t m_last_victim;
+    size_t m_failed_spies;
+
+    /** Where the previous steal() stopped within each of its ranges. */
+    struct steal_hint {
+        const block<K, V, Compare> *m_block;
+        size_t m_ix;
+        const item<K, V> *m_item;
+        version_t m_version;
+    };
+
+    const dist_lsm_local<K, V, Rlx, Compare> *m_steal_victim;
+    steal_hint m_steal_hints[MAX_CANDIDATE_RANGES];
+    size_t m_steal_hints_size;
 
-    block_storage<K, V, 4> m_block_storage;
-    item_allocator<item<K, V>, typename item<K, V>::reuse> m_item_allocator;
+    block_storage<K, V, 4, Compare> m_block_storage;
+    item_allocator_of<K, V> m_item_allocator;
 
     /** Caches the previously peeked item in case we can short-circuit and simply
      *  return it. */
-    typename block<K, V>::peek_t m_cached_best;
+    typename block<K, V, Compare>::peek_t m_cached_best;
 
     xorshf96 m_gen;
 };
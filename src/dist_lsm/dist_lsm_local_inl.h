@@ -17,45 +17,79 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V, int Rlx>
-dist_lsm_local<K, V, Rlx>::dist_lsm_local() :
+template <class K, class V, int Rlx, class Compare>
+dist_lsm_local<K, V, Rlx, Compare>::dist_lsm_local(memory_resource *resource) :
     m_head(nullptr),
+    m_cpu(-1),
     m_tail(nullptr),
     m_spied(nullptr),
-    m_cached_best(block<K, V>::peek_t::EMPTY())
+    m_participating(false),
+    m_empty_deletes(0),
+    m_last_victim(NO_VICTIM),
+    m_failed_spies(0),
+    m_steal_victim(nullptr),
+    m_steal_hints_size(0),
+    m_block_storage(resource),
+    m_item_allocator(resource),
+    m_cached_best(block<K, V, Compare>::peek_t::EMPTY())
 {
 }
 
-template <class K, class V, int Rlx>
-dist_lsm_local<K, V, Rlx>::~dist_lsm_local()
+template <class K, class V, int Rlx, class Compare>
+dist_lsm_local<K, V, Rlx, Compare>::~dist_lsm_local()
 {
     /* Blocks and items are managed by, respectively,
      * block_storage and item_allocator. */
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm_local<K, V, Rlx>::insert(const K &key,
-                                  const V &val,
-                                  shared_lsm<K, V, Rlx> *slsm)
+dist_lsm_local<K, V, Rlx, Compare>::insert(const K &key,
+                                           const V &val,
+                                           shared_lsm<K, V, Rlx, Compare> *slsm,
+                                           item_handle<K, V> *handle)
+{
+    emplace(key, slsm, handle, val);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm_local<K, V, Rlx, Compare>::insert(item<K, V> *it,
+                                           shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    insert(it, it->version(), slsm);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class... Args>
+void
+dist_lsm_local<K, V, Rlx, Compare>::emplace(const K &key,
+                                            shared_lsm<K, V, Rlx, Compare> *slsm,
+                                            item_handle<K, V> *handle,
+                                            Args &&... args)
 {
     item<K, V> *it = m_item_allocator.acquire();
-    it->initialize(key, val);
+    it->initialize(key, std::forward<Args>(args)...);
+
+    if (handle != nullptr) {
+        handle->m_item    = it;
+        handle->m_version = it->version();
+    }
 
     insert(it, it->version(), slsm);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm_local<K, V, Rlx>::insert(item<K, V> *it,
-                                  const version_t version,
-                                  shared_lsm<K, V, Rlx> *slsm)
+dist_lsm_local<K, V, Rlx, Compare>::insert(item<K, V> *it,
+                                           const version_t version,
+                                           shared_lsm<K, V, Rlx, Compare> *slsm)
 {
     const K it_key = it->key();
 
     /* Update the cached best item if necessary. */
 
-    if (m_cached_best.empty() || it_key < m_cached_best.m_key) {
+    if (m_cached_best.empty() || Compare()(it_key, m_cached_best.m_key)) {
         m_cached_best.m_key     = it_key;
         m_cached_best.m_item    = it;
         m_cached_best.m_version = version;
@@ -66,31 +100,90 @@ dist_lsm_local<K, V, Rlx>::insert(item<K, V> *it,
     /* Simply allocate the smallest block. Attempting to alloc larger
      * blocks / append to an existing block's tail don't actually help. */
 
-    block<K, V> *new_block = m_block_storage.get_block(0);
+    block<K, V, Compare> *new_block = m_block_storage.get_block(0);
     new_block->insert(it, version);
 
     merge_insert(new_block, slsm);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+template <class ForwardIterator>
 void
-dist_lsm_local<K, V, Rlx>::merge_insert(block<K, V> *const new_block,
-                                        shared_lsm<K, V, Rlx> *slsm)
+dist_lsm_local<K, V, Rlx, Compare>::insert_bulk(ForwardIterator first,
+                                                ForwardIterator last,
+                                                shared_lsm<K, V, Rlx, Compare> *slsm)
 {
-    block<K, V> *insert_block = new_block;
-    block<K, V> *other_block  = m_tail;
-    block<K, V> *delete_block = nullptr;
+    const size_t n = std::distance(first, last);
+    if (n == 0) {
+        return;
+    }
+
+    block<K, V, Compare> *new_block = m_block_storage.get_block(block<K, V, Compare>::power_of_2_for(n));
+    for (auto it = first; it != last; ++it) {
+        item<K, V> *i = m_item_allocator.acquire();
+        i->initialize(it->first, it->second);
+        new_block->insert_tail(i, i->version());
+    }
+    new_block->sort();
+
+    /* Update the cached best item if necessary. */
+
+    const auto block_best = new_block->peek_nth(0);
+    if (m_cached_best.empty() || Compare()(block_best.m_key, m_cached_best.m_key)) {
+        m_cached_best = block_best;
+    } else if (m_cached_best.taken()) {
+        m_cached_best.m_item = nullptr;
+    }
+
+    if (slsm != nullptr && n >= (size_t)(slsm->relaxation() + 1) / 2) {
+        /* The batch alone exceeds the relaxation bound, skip the local lsm
+         * entirely. */
+        slsm->insert(new_block);
+        new_block->set_unused();
+        return;
+    }
+
+    merge_insert(new_block, slsm);
+}
 
-    /* Merge as long as the prev block is of the same size as the new block. */
-    while (other_block != nullptr && insert_block->capacity() == other_block->capacity()) {
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm_local<K, V, Rlx, Compare>::merge_insert(block<K, V, Compare> *const new_block,
+                                                 shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    block<K, V, Compare> *insert_block = new_block;
+    block<K, V, Compare> *other_block  = m_tail;
+    block<K, V, Compare> *delete_block = nullptr;
+
+    const size_t max_size = (slsm == nullptr)
+            ? std::numeric_limits<size_t>::max()
+            : (size_t)(slsm->relaxation() + 1) / 2;
+    bool is_shared_block = false;
+
+    /* Merge as long as the prev block is not larger than the new block. Usually
+     * both are of the same size, but blocks created by insert_bulk() may
+     * be larger than the current tail. */
+    while (other_block != nullptr && insert_block->capacity() >= other_block->capacity()) {
         /* Only merge into a larger block if both candidate blocks have enough elements to
          * justify the larger size. This change is necessary to avoid huge blocks containing
          * only a few elements (which actually happens with the 'alloc largest block on insert'
          * optimization. */
+        const size_t merged_size = insert_block->size() + other_block->size();
         const size_t merged_pow2 =
-            (insert_block->size() + other_block->size() <= insert_block->capacity()) ?
+            (merged_size <= insert_block->capacity()) ?
             insert_block->power_of_2() : insert_block->power_of_2() + 1;
-        auto merged_block = m_block_storage.get_block(merged_pow2);
+
+        /* If this is the final merge and its result exceeds the relaxation
+         * bound, merge directly into a block of the shared lsm. It is never
+         * linked into our list and thus never seen by spies. */
+        const auto next_block = other_block->m_prev;
+        const bool is_final_merge = (next_block == nullptr
+                                     || ((size_t)1 << merged_pow2) < next_block->capacity());
+        is_shared_block = (is_final_merge && merged_size >= max_size);
+
+        auto merged_block = is_shared_block
+                ? slsm->get_block(merged_pow2)
+                : m_block_storage.get_block(merged_pow2);
         merged_block->merge(insert_block, other_block);
 
         insert_block->set_unused();
@@ -99,17 +192,18 @@ dist_lsm_local<K, V, Rlx>::merge_insert(block<K, V> *const new_block,
         other_block  = other_block->m_prev;
     }
 
-    if (slsm != nullptr && insert_block->size() >= (Rlx + 1) / 2) {
+    if (is_shared_block || insert_block->size() >= max_size) {
         /* The merged block exceeds relaxation bounds and we have a shared lsm
          * pointer, insert the new block into the shared lsm instead.
-         * The shared lsm creates a copy of the passed block, and thus we can set
-         * the passed block unused once insertion has completed.
-         *
-         * TODO: Optimize this by allocating the block from the shared lsm
-         * if we are about to merge into a block exceeding the relaxation bound.
+         * Shared lsm blocks (even those which shrank below the bound through
+         * pruning) are handed over as is. Otherwise (if no merge took place),
+         * the shared lsm creates a copy of the passed block, and thus we can
+         * set the passed block unused once insertion has completed.
          */
         slsm->insert(insert_block);
-        insert_block->set_unused();
+        if (!is_shared_block) {
+            insert_block->set_unused();
+        }
 
         if (other_block != nullptr) {
             other_block->m_next.store(nullptr, std::memory_order_relaxed);
@@ -123,6 +217,9 @@ dist_lsm_local<K, V, Rlx>::merge_insert(block<K, V> *const new_block,
         if (other_block != nullptr) {
             other_block->m_next.store(insert_block, std::memory_order_relaxed);
         } else {
+            if (m_head.load(std::memory_order_relaxed) == nullptr) {
+                m_cpu.store(cpu_topology::current_cpu(), std::memory_order_relaxed);
+            }
             m_head.store(insert_block, std::memory_order_relaxed);
         }
         m_tail = insert_block;
@@ -136,12 +233,12 @@ dist_lsm_local<K, V, Rlx>::merge_insert(block<K, V> *const new_block,
     }
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-dist_lsm_local<K, V, Rlx>::delete_min(dist_lsm<K, V, Rlx> *parent,
-                                      K &key, V &val)
+dist_lsm_local<K, V, Rlx, Compare>::delete_min(dist_lsm<K, V, Rlx, Compare> *parent,
+                                               K &key, V &val)
 {
-    typename block<K, V>::peek_t best = block<K, V>::peek_t::EMPTY();
+    typename block<K, V, Compare>::peek_t best = block<K, V, Compare>::peek_t::EMPTY();
     peek(best);
 
     if (best.m_item == nullptr && spy(parent) > 0) {
@@ -152,21 +249,69 @@ dist_lsm_local<K, V, Rlx>::delete_min(dist_lsm<K, V, Rlx> *parent,
         return false; /* We did our best, give up. */
     }
 
-    return best.m_item->take(best.m_version, key, val);
+    if (!best.take(key, val)) {
+        COUNT_INC(dlsm_take_failures);
+        if (empty()) {
+            /* Spied items are only peeked once the local lsm is empty. */
+            COUNT_INC(spied_take_failures);
+        }
+        return false;
+    }
+
+    return true;
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-dist_lsm_local<K, V, Rlx>::delete_min(dist_lsm<K, V, Rlx> *parent,
-                                      V &val)
+dist_lsm_local<K, V, Rlx, Compare>::delete_min(dist_lsm<K, V, Rlx, Compare> *parent,
+                                               V &val)
 {
     K key;
     return delete_min(parent, key, val);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm_local<K, V, Rlx, Compare>::delete_min_batch(dist_lsm<K, V, Rlx, Compare> *parent,
+                                                     K *keys,
+                                                     V *vals,
+                                                     const size_t n)
+{
+    multiway_merge<K, V, MAX_CANDIDATE_RANGES, Compare> merge;
+    add_candidates(merge);
+
+    if (merge.items() == 0 && spy(parent) > 0) {
+        /* Retry once after a successful spy(). */
+        merge = multiway_merge<K, V, MAX_CANDIDATE_RANGES, Compare>();
+        add_candidates(merge);
+    }
+
+    return merge.take(keys, vals, n);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
 void
-dist_lsm_local<K, V, Rlx>::peek(typename block<K, V>::peek_t &best)
+dist_lsm_local<K, V, Rlx, Compare>::add_candidates(Merge &merge)
+{
+    /* Let peek() take care of removing taken items and shrinking blocks. */
+    typename block<K, V, Compare>::peek_t best = block<K, V, Compare>::peek_t::EMPTY();
+    peek(best);
+
+    for (auto i = m_head.load(std::memory_order_relaxed);
+            i != nullptr;
+            i = i->m_next.load(std::memory_order_relaxed)) {
+        merge.add(i, i->first(), i->last(), false);
+    }
+
+    if (m_spied != nullptr) {
+        merge.add(m_spied, m_spied->first(), m_spied->last(), false);
+    }
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm_local<K, V, Rlx, Compare>::peek(typename block<K, V, Compare>::peek_t &best)
 {
     /* Short-circuit. */
     if (!m_cached_best.empty() && !m_cached_best.taken()) {
@@ -203,7 +348,7 @@ dist_lsm_local<K, V, Rlx>::peek(typename block<K, V>::peek_t &best)
 
             /* Shrink. */
 
-            block<K, V> *new_block = m_block_storage.get_block(i->power_of_2() - 1);
+            block<K, V, Compare> *new_block = m_block_storage.get_block(i->power_of_2() - 1);
             new_block->copy(i);
 
             new_block->m_next.store(i->m_next.load(std::memory_order_relaxed),
@@ -253,7 +398,7 @@ dist_lsm_local<K, V, Rlx>::peek(typename block<K, V>::peek_t &best)
         }
 
         if (best.m_item == nullptr ||
-                (candidate.m_item != nullptr && candidate.m_key < best.m_key)) {
+                (candidate.m_item != nullptr && Compare()(candidate.m_key, best.m_key))) {
             best = candidate;
         }
     }
@@ -265,23 +410,23 @@ dist_lsm_local<K, V, Rlx>::peek(typename block<K, V>::peek_t &best)
     m_cached_best = best;
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm_local<K, V, Rlx>::safe_peek(typename block<K, V>::peek_t &best)
+dist_lsm_local<K, V, Rlx, Compare>::safe_peek(typename block<K, V, Compare>::peek_t &best)
 {
     for (auto i = m_head.load(std::memory_order_relaxed);
             i != nullptr;
             i = i->m_next.load(std::memory_order_relaxed)) {
         auto candidate = i->peek();
-        if (best.empty() || (!candidate.empty() && candidate.m_key < best.m_key)) {
+        if (best.empty() || (!candidate.empty() && Compare()(candidate.m_key, best.m_key))) {
             best = candidate;
         }
     }
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 int
-dist_lsm_local<K, V, Rlx>::spy(dist_lsm<K, V, Rlx> *parent)
+dist_lsm_local<K, V, Rlx, Compare>::spy(dist_lsm<K, V, Rlx, Compare> *parent)
 {
     COUNT_INC(requested_spies);
 
@@ -292,33 +437,121 @@ dist_lsm_local<K, V, Rlx>::spy(dist_lsm<K, V, Rlx> *parent)
         return 0;
     }
 
-    /* All except current thread, therefore n - 2. */
-    size_t victim_id = m_gen() % (num_threads - 1);
-    if (victim_id >= current_thread) {
-        victim_id++;
+    /* Spying only replaces an empty local lsm. */
+    if (m_tail != nullptr || (m_spied != nullptr && !m_spied->peek().empty())) {
+        COUNT_INC(aborted_spies);
+        return 0;
     }
 
-    auto victim = parent->m_local.get(victim_id);
-    return spy(victim);
-}
+    const int cpu = cpu_topology::current_cpu();
+    m_cpu.store(cpu, std::memory_order_relaxed);
 
-template <class K, class V, int Rlx>
-int
-dist_lsm_local<K, V, Rlx>::spy(dist_lsm_local<K, V, Rlx> *victim)
-{
-    if (m_tail != nullptr) {
+    size_t victim_id;
+    if (parent->spy_policy() == SPY_TOPOLOGY && m_failed_spies < MAX_FAILED_SPIES) {
+        victim_id = topology_victim(parent, num_threads, current_thread, cpu);
+    } else {
+        victim_id = uniform_victim(parent, current_thread);
+    }
+
+    if (victim_id == NO_VICTIM) {
         COUNT_INC(aborted_spies);
         return 0;
     }
 
-    if (m_spied != nullptr) {
-        auto it = m_spied->peek();
-        if (!it.empty()) {
-            COUNT_INC(aborted_spies);
-            return 0;
+    auto victim = parent->m_local.try_get(victim_id);
+    const int num_spied = spy(victim, parent->spy_steal());
+
+    if (num_spied > 0) {
+        const auto distance =
+            cpu_topology::instance().distance_between(cpu, victim->m_cpu.load(std::memory_order_relaxed));
+        if (distance == cpu_topology::REMOTE) {
+            COUNT_INC(remote_spies);
+        } else {
+            COUNT_INC(local_spies);
         }
+
+        m_last_victim = victim_id;
+        m_failed_spies = 0;
+    } else {
+        m_last_victim = NO_VICTIM;
+        m_failed_spies = (m_failed_spies < MAX_FAILED_SPIES) ? m_failed_spies + 1 : 0;
     }
 
+    return num_spied;
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm_local<K, V, Rlx, Compare>::uniform_victim(dist_lsm<K, V, Rlx, Compare> *parent,
+                                                   const size_t current_thread)
+{
+    /* Draw participants until one other than us has items. Each draw is
+     * uniform, and so is thus the returned victim among those with items. */
+    for (size_t i = 0; i < MAX_VICTIM_DRAWS; i++) {
+        const int32_t victim_id = parent->m_participants.draw(m_gen);
+        if (victim_id == tid_set::NO_TID) {
+            break;
+        } else if (static_cast<size_t>(victim_id) == current_thread) {
+            continue;
+        }
+
+        auto victim = parent->m_local.try_get(victim_id);
+        if (victim != nullptr && !victim->empty()) {
+            return victim_id;
+        }
+    }
+
+    return NO_VICTIM;
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm_local<K, V, Rlx, Compare>::topology_victim(dist_lsm<K, V, Rlx, Compare> *parent,
+                                                    const size_t num_threads,
+                                                    const size_t current_thread,
+                                                    const int cpu)
+{
+    if (m_last_victim < num_threads && m_last_victim != current_thread) {
+        auto victim = parent->m_local.try_get(m_last_victim);
+        if (victim != nullptr && !victim->empty()) {
+            return m_last_victim;
+        }
+    }
+
+    /* As in uniform_victim(), but pick the closest of the drawn participants
+     * with items. */
+    const auto &topology = cpu_topology::instance();
+
+    size_t best_id = NO_VICTIM;
+    int best_distance = cpu_topology::DISTANCES;
+
+    for (size_t i = 0; i < MAX_VICTIM_DRAWS && best_distance != cpu_topology::SAME_CORE; i++) {
+        const int32_t victim_id = parent->m_participants.draw(m_gen);
+        if (victim_id == tid_set::NO_TID) {
+            break;
+        } else if (static_cast<size_t>(victim_id) == current_thread) {
+            continue;
+        }
+
+        auto victim = parent->m_local.try_get(victim_id);
+        if (victim != nullptr && !victim->empty()) {
+            const int distance =
+                topology.distance_between(cpu, victim->m_cpu.load(std::memory_order_relaxed));
+            if (distance < best_distance) {
+                best_id = victim_id;
+                best_distance = distance;
+            }
+        }
+    }
+
+    return best_id;
+}
+
+template <class K, class V, int Rlx, class Compare>
+int
+dist_lsm_local<K, V, Rlx, Compare>::spy(dist_lsm_local<K, V, Rlx, Compare> *victim,
+                                        const size_t max_stolen)
+{
     int num_spied = 0;
     auto spied_block = victim->m_head.load(std::memory_order_relaxed);
 
@@ -327,12 +560,22 @@ dist_lsm_local<K, V, Rlx>::spy(dist_lsm_local<K, V, Rlx> *victim)
         return num_spied;
     }
 
-    /* Got a block, add it to the local lsm. */
+    block<K, V, Compare> *insert_block;
+    if (max_stolen == 0) {
+        /* Got a block, add it to the local lsm. */
 
-    auto insert_block = m_block_storage.get_block(spied_block->power_of_2());
-    insert_block->copy(spied_block);
+        insert_block = m_block_storage.get_block(spied_block->power_of_2());
+        insert_block->copy(spied_block);
+    } else {
+        insert_block = steal(victim, spied_block, max_stolen);
+        if (insert_block == nullptr) {
+            COUNT_INC(aborted_spies);
+            return num_spied;
+        }
+    }
 
     num_spied = insert_block->size();
+    COUNT_ADD(spied_items, num_spied);
 
     if (m_spied != nullptr) {
         m_spied->set_unused();
@@ -342,9 +585,159 @@ dist_lsm_local<K, V, Rlx>::spy(dist_lsm_local<K, V, Rlx> *victim)
     return num_spied;
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+block<K, V, Compare> *
+dist_lsm_local<K, V, Rlx, Compare>::steal(dist_lsm_local<K, V, Rlx, Compare> *victim,
+                                          block<K, V, Compare> *head,
+                                          const size_t max_stolen)
+{
+    if (victim != m_steal_victim) {
+        m_steal_victim = victim;
+        m_steal_hints_size = 0;
+    }
+
+    /* Merge the smallest items of all blocks. As in copy(), blocks may be
+     * modified and reused concurrently by the victim, which is detected
+     * once items are taken. The number of visited blocks is bounded in case
+     * they are relinked while we iterate.
+     *
+     * Taken items are only pruned by the owner. Each range thus starts
+     * behind the items consumed by the previous steal from the same block,
+     * which have been taken since (we only spy once our own items are gone),
+     * unless the block has been reused in the meantime. */
+
+    multiway_merge<K, V, MAX_CANDIDATE_RANGES, Compare> merge;
+    block<K, V, Compare> *blocks[MAX_CANDIDATE_RANGES];
+    size_t firsts[MAX_CANDIDATE_RANGES];
+    bool hinted = false;
+
+    for (auto i = head;
+            i != nullptr && merge.size() < MAX_CANDIDATE_RANGES;
+            i = i->m_next.load(std::memory_order_relaxed)) {
+        const size_t last = std::min(i->last(), i->capacity());
+        size_t first = i->first();
+
+        for (size_t j = 0; j < m_steal_hints_size; j++) {
+            const auto &hint = m_steal_hints[j];
+            if (hint.m_block != i || hint.m_ix <= first || hint.m_ix > last) {
+                continue;
+            }
+
+            const auto prev = i->peek_nth(hint.m_ix - 1);
+            if (prev.m_item == hint.m_item && prev.m_version == hint.m_version) {
+                first = hint.m_ix;
+                hinted = true;
+            }
+            break;
+        }
+
+        blocks[merge.size()] = i;
+        firsts[merge.size()] = first;
+        merge.add(i, first, last, false);
+    }
+
+    const size_t n = std::min(max_stolen, (merge.items() + 1) / 2);
+    if (n == 0) {
+        m_steal_hints_size = 0;
+        return nullptr;
+    }
+
+    auto insert_block = m_block_storage.get_block(block<K, V, Compare>::power_of_2_for(n));
+
+    /* Skipping is bounded once the first item has been stolen. */
+    size_t skipped = 0;
+    typename block<K, V, Compare>::block_item it;
+    while (insert_block->size() < n
+            && (insert_block->size() == 0 || skipped <= n * MAX_SKIPPED_PER_STOLEN)
+            && merge.next(it)) {
+        if (it.taken()) {
+            skipped++;
+            continue;
+        }
+        insert_block->insert_tail(it);
+    }
+
+    if (insert_block->size() == 0) {
+        insert_block->set_unused();
+        /* Rescan all blocks in full next time, in case a hint was stale. */
+        m_steal_hints_size = 0;
+        return hinted ? steal(victim, head, max_stolen) : nullptr;
+    }
+
+    m_steal_hints_size = 0;
+    for (size_t r = 0; r < merge.size(); r++) {
+        const size_t ix = firsts[r] + merge.consumed(r);
+        if (ix == 0) {
+            continue;
+        }
+
+        const auto prev = blocks[r]->peek_nth(ix - 1);
+        m_steal_hints[m_steal_hints_size++] = { blocks[r], ix, prev.m_item, prev.m_version };
+    }
+
+    return insert_block;
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+dist_lsm_local<K, V, Rlx, Compare>::deregister(shared_lsm<K, V, Rlx, Compare> *slsm)
+{
+    if (slsm == nullptr) {
+        return;
+    }
+
+    /* The shared lsm copies each of our blocks. Spies which
+     * copied a block concurrently only end up with duplicate references to
+     * its items, of which at most one can be taken. */
+
+    auto i = m_head.load(std::memory_order_relaxed);
+    m_head.store(nullptr, std::memory_order_relaxed);
+    m_tail = nullptr;
+
+    while (i != nullptr) {
+        auto next = i->m_next.load(std::memory_order_relaxed);
+        if (!i->peek().empty()) {
+            slsm->insert(i);
+            COUNT_INC(migrated_blocks);
+        }
+        i->set_unused();
+        i = next;
+    }
+
+    /* Items of the spied block are still owned by their victim. */
+
+    if (m_spied != nullptr) {
+        m_spied->set_unused();
+        m_spied = nullptr;
+    }
+
+    m_cached_best = block<K, V, Compare>::peek_t::EMPTY();
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+dist_lsm_local<K, V, Rlx, Compare>::trim()
+{
+    const size_t released = m_item_allocator.trim() + m_block_storage.trim();
+    COUNT_ADD(trimmed_bytes, released);
+    return released;
+}
+
+template <class K, class V, int Rlx, class Compare>
+bool
+dist_lsm_local<K, V, Rlx, Compare>::trim_due(const size_t interval)
+{
+    if (++m_empty_deletes < interval) {
+        return false;
+    }
+
+    m_empty_deletes = 0;
+    return true;
+}
+
+template <class K, class V, int Rlx, class Compare>
 void
-dist_lsm_local<K, V, Rlx>::print() const
+dist_lsm_local<K, V, Rlx, Compare>::print() const
 {
     m_block_storage.print();
 }
@@ -20,6 +20,9 @@
 #ifndef __K_LSM_H
 #define __K_LSM_H
 
+#include <atomic>
+#include <type_traits>
+
 #include "dist_lsm/dist_lsm.h"
 #include "shared_lsm/shared_lsm.h"
 #include "util/counters.h"
@@ -34,28 +37,180 @@ namespace kpq {
  * into the shared lsm component.
  *
  * As always, K, V and Rlx denote, respectively, the key, value classes
- * and the relaxation parameter.
+ * and the relaxation parameter. If Rlx is DYNAMIC_RELAXATION, the relaxation
+ * is instead passed to the constructor and may be adjusted at runtime.
+ * Keys are ordered by the stateless comparator Compare, delete_min() returns
+ * (one of) the smallest keys w.r.t. this order. Keys need not support any
+ * operations beyond Compare, copying and default construction. Passing
+ * key_only as V stores keys without any values.
  */
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare = std::less<K>>
 class k_lsm {
 public:
-    k_lsm();
+    /** All blocks, items and block arrays of both components are allocated
+     *  from resource. */
+    explicit k_lsm(memory_resource *resource = get_default_resource());
+    explicit k_lsm(const int relaxation,
+                   memory_resource *resource = get_default_resource());
     virtual ~k_lsm() { }
 
     void insert(const K &key);
     void insert(const K &key,
                 const V &val);
+    void insert(const K &key,
+                V &&val);
+
+    /**
+     * Constructs the value in place from args. Values are never copied
+     * within the k-lsm, delete_min() moves them out of successfully
+     * taken items. Large and move-only values are thus supported as well.
+     */
+    template <class... Args>
+    void emplace(const K &key,
+                 Args &&... args);
+
+    /**
+     * Intrusive queues (V = intrusive<T>) insert objects deriving from
+     * item_hook<K, T> directly, without allocating an item. The object must
+     * not currently be contained in any queue.
+     */
+    template <class T = V>
+    void insert(const K &key,
+                typename intrusive_object<T>::pointer object);
+
+    /**
+     * Inserts a new item and sets handle to refer to it. The handle may later
+     * be passed to decrease_key() for as long as the item has not been
+     * removed.
+     */
+    void insert(const K &key,
+                const V &val,
+                item_handle<K, V> &handle);
+
+    /**
+     * Takes the item referred to by handle and then reinserts its value
+     * with the given key, updating handle to refer to the new item. This
+     * is not atomic: between the take and the reinsertion, the value is
+     * contained in the queue under neither key, and a concurrent
+     * delete_min() may miss it. Returns false (leaving the queue untouched)
+     * if the item has already been removed, in which case the caller should
+     * insert() instead. Unlike a delete_min() followed by an insert(), no
+     * stale copy of the item remains in the queue. Also works for increases
+     * of the key.
+     */
+    bool decrease_key(item_handle<K, V> &handle,
+                      const K &key);
+
+    /**
+     * Inserts all (key, value) pairs in [first, last), e.g. the edges relaxed
+     * while processing a single node. The batch is sorted locally and merged
+     * into the thread-local component as a single block; batches of at least
+     * (relaxation() + 1) / 2 items are passed directly to the shared component.
+     */
+    template <class ForwardIterator>
+    void insert_bulk(ForwardIterator first,
+                     ForwardIterator last);
 
     bool delete_min(V &val);
     bool delete_min(K &key, V &val);
 
+    /** Removes an object from an intrusive queue. */
+    template <class T = V>
+    bool delete_min(K &key,
+                    typename intrusive_object<T>::pointer &object);
+    template <class T = V>
+    bool delete_min(typename intrusive_object<T>::pointer &object);
+
+    /** Removes an item from a key_only queue and stores its key in key. */
+    template <class T = V>
+    typename std::enable_if<std::is_same<T, key_only>::value, bool>::type
+    delete_min(K &key);
+
+    /**
+     * Stores the key delete_min() would currently remove in key, without
+     * removing its item. Returns false if both the local distributed lsm and
+     * the shared lsm appear to be empty. Apart from the cleanup and cache
+     * updates a peek within delete_min() performs as well, no state is
+     * modified; in particular, other threads are not spied upon.
+     */
+    bool peek_min(K &key);
+
+    /**
+     * Stores up to n of the smallest keys of the local distributed lsm and
+     * the pivot range of the shared lsm in ascending order in keys, and
+     * returns their number. This is a best-effort snapshot for monitoring
+     * purposes: no items are removed, and listed items may be taken
+     * concurrently.
+     */
+    size_t top_k(K *keys,
+                 const size_t n);
+
+    /**
+     * Removes up to n items and stores them in keys and vals, returning the
+     * number of removed items. Candidates are the items of the local
+     * distributed lsm and the pivot range of the shared lsm, which are
+     * processed in ascending key order within a single pass; the peek and
+     * refresh costs of delete_min() are thus amortized over the whole batch.
+     */
+    size_t delete_min_batch(K *keys,
+                            V *vals,
+                            const size_t n);
+
+    int relaxation() const { return m_shared.relaxation(); }
+    void set_relaxation(const int relaxation) { m_shared.set_relaxation(relaxation); }
+
+    /** See shared_lsm::set_adaptive_relaxation(). Since the dist lsm hands its
+     *  blocks to the shared lsm once they reach half the bound, both
+     *  components follow the adapted bound. */
+    void set_adaptive_relaxation(const int min,
+                                 const int max) { m_shared.set_adaptive_relaxation(min, max); }
+
+    /** See dist_lsm::set_spy_policy(). */
+    void set_spy_policy(const spy_policy policy) { m_dist.set_spy_policy(policy); }
+    /** See dist_lsm::set_spy_steal(). */
+    void set_spy_steal(const size_t n) { m_dist.set_spy_steal(n); }
+
     void init_thread(const size_t) const { }
+
+    /**
+     * Should be called by threads which stop using the k-lsm, e.g. worker
+     * threads of a pool before they exit. Their remaining local items are
+     * moved into the shared component (where they are visible to all
+     * threads, instead of only through spying), and other threads no longer
+     * consider it for spying.
+     */
+    void deregister_thread() { m_dist.deregister_thread(&m_shared); }
+
+    /**
+     * Returns memory held by the calling thread beyond its current needs
+     * to the OS, and returns the number of released bytes: items which have
+     * been deleted (unless keys are not trivially copyable, or V is
+     * intrusive), and blocks which are currently unused. Useful after load
+     * peaks, since memory is otherwise retained for reuse indefinitely.
+     * Released memory remains mapped, and concurrent operations are thus
+     * unaffected; it is transparently reused if the load increases again.
+     */
+    size_t trim() { return m_dist.trim() + m_shared.trim(); }
+
+    /**
+     * Lets each thread trim() automatically once it has observed an empty
+     * queue in interval delete_min() calls. An interval of 0 (the default)
+     * disables automatic trimming.
+     */
+    void set_auto_trim(const size_t interval) { m_auto_trim.store(interval, std::memory_order_relaxed); }
+
     constexpr static bool supports_concurrency() { return true; }
 
 private:
-    dist_lsm<K, V, Rlx>   m_dist;
-    shared_lsm<K, V, Rlx> m_shared;
+    static constexpr int MAX_CANDIDATE_RANGES =
+        dist_lsm_local<K, V, Rlx, Compare>::MAX_CANDIDATE_RANGES + block_array<K, V, Rlx, Compare>::MAX_BLOCKS;
+
+private:
+    dist_lsm<K, V, Rlx, Compare>   m_dist;
+    shared_lsm<K, V, Rlx, Compare> m_shared;
+
+    std::atomic<size_t> m_auto_trim;
 };
 
 #include "k_lsm_inl.h"
@@ -17,22 +17,34 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V, int Rlx>
-k_lsm<K, V, Rlx>::k_lsm()
+template <class K, class V, int Rlx, class Compare>
+k_lsm<K, V, Rlx, Compare>::k_lsm(memory_resource *resource) :
+    m_dist(resource),
+    m_shared(resource),
+    m_auto_trim(0)
 {
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+k_lsm<K, V, Rlx, Compare>::k_lsm(const int relaxation,
+                                 memory_resource *resource) :
+    m_dist(resource),
+    m_shared(relaxation, resource),
+    m_auto_trim(0)
+{
+}
+
+template <class K, class V, int Rlx, class Compare>
 void
-k_lsm<K, V, Rlx>::insert(const K &key)
+k_lsm<K, V, Rlx, Compare>::insert(const K &key)
 {
-    insert(key, key);
+    insert(key, value_of_key<K, V>::get(key));
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-k_lsm<K, V, Rlx>::insert(const K &key,
-                         const V &val)
+k_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                  const V &val)
 {
     /* Insert into the distributed lsm; if the largest block is large enough
      * (i.e. the next-largest block size would exceed the relaxation bounds),
@@ -75,14 +87,86 @@ k_lsm<K, V, Rlx>::insert(const K &key,
      *     since the current thread may stall.
      *
      * It seems best to start with option 1), optimizing to 1a) in the future.
+     *
+     * ---
+     *
+     * 1a) is now in place: the final merge of dist lsm's merge_insert() writes
+     * into a block obtained from shared_lsm::get_block() whenever its result
+     * will exceed the bound. Only blocks which reach the bound without a merge
+     * (relaxation <= 1, insert_bulk()) and deregistered blocks are still copied.
      */
 
     m_dist.insert(key, val, &m_shared);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+void
+k_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                  V &&val)
+{
+    m_dist.emplace_into(&m_shared, nullptr, key, std::move(val));
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class T>
+void
+k_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                  typename intrusive_object<T>::pointer object)
+{
+    object->initialize(key);
+    m_dist.insert(object, &m_shared);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class... Args>
+void
+k_lsm<K, V, Rlx, Compare>::emplace(const K &key,
+                                   Args &&... args)
+{
+    m_dist.emplace_into(&m_shared, nullptr, key, std::forward<Args>(args)...);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+k_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                  const V &val,
+                                  item_handle<K, V> &handle)
+{
+    m_dist.insert(key, val, &m_shared, handle);
+}
+
+template <class K, class V, int Rlx, class Compare>
 bool
-k_lsm<K, V, Rlx>::delete_min(K &key, V &val)
+k_lsm<K, V, Rlx, Compare>::decrease_key(item_handle<K, V> &handle,
+                                        const K &key)
+{
+    /* Taking the item invalidates all of its references (within dist and
+     * shared lsm blocks alike) through the version increment. */
+
+    K old_key;
+    V val;
+    if (handle.empty() || !handle.take(old_key, val)) {
+        return false;
+    }
+
+    m_dist.emplace_into(&m_shared, &handle, key, std::move(val));
+    COUNT_INC(decrease_keys);
+
+    return true;
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class ForwardIterator>
+void
+k_lsm<K, V, Rlx, Compare>::insert_bulk(ForwardIterator first,
+                                       ForwardIterator last)
+{
+    m_dist.insert_bulk(first, last, &m_shared);
+}
+
+template <class K, class V, int Rlx, class Compare>
+bool
+k_lsm<K, V, Rlx, Compare>::delete_min(K &key, V &val)
 {
     /* Load the best item from the local distributed lsm, and the (relaxed)
      * best item from the global lsm, and return the best of both.
@@ -97,21 +181,21 @@ k_lsm<K, V, Rlx>::delete_min(K &key, V &val)
      * interactions between memory management here.
      */
 
-    typename block<K, V>::peek_t
-            best_dist = block<K, V>::peek_t::EMPTY(),
-            best_shared = block<K, V>::peek_t::EMPTY();
+    typename block<K, V, Compare>::peek_t
+            best_dist = block<K, V, Compare>::peek_t::EMPTY(),
+            best_shared = block<K, V, Compare>::peek_t::EMPTY();
 
     do {
         m_dist.find_min(best_dist);
         m_shared.find_min(best_shared);
 
         if (!best_dist.empty() && !best_shared.empty()) {
-            if (best_dist.m_key <= best_shared.m_key) {
+            if (!Compare()(best_shared.m_key, best_dist.m_key)) {
                 COUNT_INC(dlsm_deletes);
                 return best_dist.take(key, val);
             } else {
                 COUNT_INC(slsm_deletes);
-                return best_shared.take(key, val);
+                return m_shared.take(best_shared, key, val);
             }
         }
 
@@ -122,17 +206,131 @@ k_lsm<K, V, Rlx>::delete_min(K &key, V &val)
 
         if (!best_shared.empty() /* and best_dist is empty */) {
             COUNT_INC(slsm_deletes);
-            return best_shared.take(key, val);
+            return m_shared.take(best_shared, key, val);
         }
     } while (m_dist.spy() > 0);
 
+    const size_t auto_trim = m_auto_trim.load(std::memory_order_relaxed);
+    if (auto_trim != 0 && m_dist.trim_due(auto_trim)) {
+        trim();
+    }
+
     return false;
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+bool
+k_lsm<K, V, Rlx, Compare>::peek_min(K &key)
+{
+    /* Same selection as in delete_min(), but without take() or spy(). */
+
+    typename block<K, V, Compare>::peek_t
+            best_dist = block<K, V, Compare>::peek_t::EMPTY(),
+            best_shared = block<K, V, Compare>::peek_t::EMPTY();
+
+    m_dist.find_min(best_dist);
+    m_shared.find_min(best_shared);
+
+    if (best_dist.empty() && best_shared.empty()) {
+        return false;
+    }
+
+    if (best_shared.empty()
+            || (!best_dist.empty() && !Compare()(best_shared.m_key, best_dist.m_key))) {
+        key = best_dist.m_key;
+    } else {
+        key = best_shared.m_key;
+    }
+
+    return true;
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+k_lsm<K, V, Rlx, Compare>::top_k(K *keys,
+                                 const size_t n)
+{
+    /* As in delete_min_batch(), the merge stops once the shared pivot range
+     * is exhausted. */
+
+    epoch_guard guard(m_shared.epochs());
+    multiway_merge<K, V, MAX_CANDIDATE_RANGES, Compare> merge;
+    m_dist.add_candidates(merge);
+    m_shared.add_candidates(merge);
+    return merge.peek(keys, n);
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+k_lsm<K, V, Rlx, Compare>::delete_min_batch(K *keys,
+                                            V *vals,
+                                            const size_t n)
+{
+    /* Merge the local dist lsm with the pivot range of the shared lsm. Items
+     * outside of the pivot range are not considered, since we cannot tell how
+     * they relate to remaining dist items: once the pivot range is exhausted,
+     * the merge stops and we refresh the shared lsm for another round. */
+
+    size_t taken = 0;
+    while (taken < n) {
+        /* Shared blocks are referenced by the merge until consumed. */
+        epoch_guard guard(m_shared.epochs());
+        multiway_merge<K, V, MAX_CANDIDATE_RANGES, Compare> merge;
+        m_dist.add_candidates(merge);
+        const size_t first_shared_range_ix = m_shared.add_candidates(merge);
+
+        if (merge.items() == 0) {
+            if (m_dist.spy() > 0) {
+                continue;
+            }
+            break;
+        }
+
+        taken += merge.take(keys + taken, vals + taken, n - taken);
+        m_shared.consume_candidates(merge, first_shared_range_ix);
+    }
+
+    COUNT_ADD(batch_deletes, taken);
+    return taken;
+}
+
+template <class K, class V, int Rlx, class Compare>
 bool
-k_lsm<K, V, Rlx>::delete_min(V &val)
+k_lsm<K, V, Rlx, Compare>::delete_min(V &val)
 {
     K key;
     return delete_min(key, val);
 }
+
+template <class K, class V, int Rlx, class Compare>
+template <class T>
+bool
+k_lsm<K, V, Rlx, Compare>::delete_min(K &key,
+                                      typename intrusive_object<T>::pointer &object)
+{
+    V val;
+    if (!delete_min(key, val)) {
+        return false;
+    }
+
+    object = val.m_object;
+    return true;
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class T>
+bool
+k_lsm<K, V, Rlx, Compare>::delete_min(typename intrusive_object<T>::pointer &object)
+{
+    K key;
+    return delete_min(key, object);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class T>
+typename std::enable_if<std::is_same<T, key_only>::value, bool>::type
+k_lsm<K, V, Rlx, Compare>::delete_min(K &key)
+{
+    key_only val;
+    return delete_min(key, val);
+}
@@ -37,7 +37,7 @@ template <class K, class V, int C>
 void
 multi_lsm<K, V, C>::insert(const K &key)
 {
-    insert(key, key);
+    insert(key, value_of_key<K, V>::get(key));
 }
 
 template <class K, class V, int C>
@@ -48,7 +48,7 @@ multi_lsm<K, V, C>::insert(const K &key,
     /* Insert into a random local queue. */
 
     auto q = random_local_queue();
-    q->insert(key, val, nullptr);
+    q->insert(key, val, nullptr, nullptr);
 }
 
 template <class K, class V, int C>
@@ -20,35 +20,39 @@
 #ifndef __ALIGNED_BLOCK_ARRAY_H
 #define __ALIGNED_BLOCK_ARRAY_H
 
-#include <memory>
-
 #include "block_array.h"
+#include "util/memory_resource.h"
 
 namespace kpq {
 
+#ifndef ENABLE_WIDE_CAS
 constexpr static int DEFAULT_ALIGNMENT = 2048;
+#else
+/** The version is stored next to the pointer, see versioned_array_ptr. */
+constexpr static int DEFAULT_ALIGNMENT = CACHE_LINE_SIZE;
+#endif
 
 /**
  * Wraps allocation of a block array instance aligned to a specific amount.
  * This is needed since we partially pack an array's version into its pointer
  * in order to avoid the ABA problem when we compare and swap the global array
- * pointer.
- * Algn must be a power of two.
+ * pointer (unless ENABLE_WIDE_CAS is defined).
+ * Algn must be a power of two. The array is allocated from the given memory
+ * resource.
  */
-template <class K, class V, int Rlx, int Algn = DEFAULT_ALIGNMENT>
+template <class K, class V, int Rlx, int Algn = DEFAULT_ALIGNMENT, class Compare = std::less<K>>
 class aligned_block_array {
 public:
-    aligned_block_array();
+    aligned_block_array(memory_resource *resource = get_default_resource());
     virtual ~aligned_block_array();
 
-    block_array<K, V, Rlx> *ptr() const { return m_ptr; }
+    block_array<K, V, Rlx, Compare> *ptr() const { return m_ptr; }
 
 private:
-    constexpr static size_t ARRAY_SIZE   = sizeof(block_array<K, V, Rlx>);
-    constexpr static size_t BUFFER_SIZE = Algn + ARRAY_SIZE;
+    constexpr static size_t ARRAY_SIZE = sizeof(block_array<K, V, Rlx, Compare>);
 
-    block_array<K, V, Rlx> *m_ptr;
-    uint8_t m_buffer[BUFFER_SIZE];
+    memory_resource *m_resource;
+    block_array<K, V, Rlx, Compare> *m_ptr;
 };
 
 #include "aligned_block_array_inl.h"
@@ -17,31 +17,19 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifdef __GNUC__
-#include <features.h>
-#endif
-
-template <class K, class V, int Rlx, int Algn>
-aligned_block_array<K, V, Rlx, Algn>::aligned_block_array()
+template <class K, class V, int Rlx, int Algn, class Compare>
+aligned_block_array<K, V, Rlx, Algn, Compare>::aligned_block_array(memory_resource *resource) :
+    m_resource(resource)
 {
-    void *buf_ptr = m_buffer;
-
-#ifdef __GNUC__
-#if __GNUC_PREREQ(5, 0)
-    size_t buf_size = BUFFER_SIZE;
-    void *aligned_ptr = std::align(Algn, ARRAY_SIZE, buf_ptr, buf_size);
-#else
-    void *aligned_ptr = (void *)((((intptr_t) buf_ptr) + Algn - 1) & ~(Algn - 1));
-#endif
-#endif
-    assert(aligned_ptr != nullptr);
+    void *aligned_ptr = m_resource->allocate(ARRAY_SIZE, Algn);
     assert(((intptr_t)aligned_ptr & (Algn - 1)) == 0);
 
-    m_ptr = new (aligned_ptr) block_array<K, V, Rlx>();
+    m_ptr = new (aligned_ptr) block_array<K, V, Rlx, Compare>();
 }
 
-template <class K, class V, int Rlx, int Algn>
-aligned_block_array<K, V, Rlx, Algn>::~aligned_block_array()
+template <class K, class V, int Rlx, int Algn, class Compare>
+aligned_block_array<K, V, Rlx, Algn, Compare>::~aligned_block_array()
 {
     m_ptr->~block_array();
+    m_resource->deallocate(m_ptr, ARRAY_SIZE, Algn);
 }
@@ -25,6 +25,7 @@
 #include <vector>
 
 #include "components/block.h"
+#include "components/relaxation.h"
 #include "util/counters.h"
 #include "util/xorshf96.h"
 #include "block_pivots.h"
@@ -32,11 +33,13 @@
 
 namespace kpq {
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare = std::less<K>>
 class block_array {
     /* For access to blocks during publishing. */
-    template <class X, class Y, int Z>
+    template <class X, class Y, int Z, class C>
     friend class shared_lsm_local;
+    template <class X, class Y, int Z, class C>
+    friend class shared_lsm;
 public:
     static constexpr size_t MAX_BLOCKS = 32;
 
@@ -44,28 +47,68 @@ public:
     virtual ~block_array();
 
     /** May only be called when this block is not visible to other threads. */
-    void insert(block<K, V> *block,
-                block_pool<K, V> *pool);
+    void insert(block<K, V, Compare> *block,
+                block_pool<K, V, Compare> *pool);
 
     /** Callable from other threads. */
     bool delete_min(V &val);
-    typename block<K, V>::peek_t peek();
+    typename block<K, V, Compare>::peek_t peek();
+
+    /** Adds the pivot range of each block to merge (growing the range first
+     *  if it contains too few items). Returns the index of the first added
+     *  range. */
+    template <class Merge>
+    size_t add_candidates(Merge &merge);
+
+    /** Advances the lower pivots past all items consumed from the ranges
+     *  previously added by add_candidates(). */
+    template <class Merge>
+    void consume_candidates(const Merge &merge,
+                            const size_t first_range_ix);
 
     /** Copies the given block array into the current instance.
       * The copy is shallow, i.e. only block pointers are copied. */
-    void copy_from(const block_array<K, V, Rlx> *that);
+    void copy_from(const block_array<K, V, Rlx, Compare> *that);
+
+    /** Brings a previous copy of that up to date by copying only the blocks
+     *  (and their pivots) which changed since our version, see
+     *  stamp_changes(). Returns false if this is not possible, or if that
+     *  has been modified concurrently. The current instance is then left
+     *  inconsistent, and copy_from() must be used instead. */
+    bool update_from(const block_array<K, V, Rlx, Compare> *that);
+
+    /** Records all changes since the previous call as having been made
+     *  in the current version. Must be called before this array is made
+     *  visible to other threads. */
+    void stamp_changes();
+
+    /** Sets the relaxation bound used to maintain the pivot range, which
+     *  is recalculated if the bound has changed. */
+    void set_relaxation(const relaxation<Rlx> &rlx);
 
     version_t version() const { return m_version.load(std::memory_order_relaxed); }
     void increment_version() { m_version.fetch_add(1, std::memory_order_relaxed); }
 
 private:
     /** May only be called when this block is not visible to other threads. */
-    void compact(block_pool<K, V> *pool);
+    void compact(block_pool<K, V, Compare> *pool);
     void remove_null_blocks();
 
     /** Utility functions for mutating blocks together with pivots. */
-    void block_insert(const size_t block_ix, block<K, V> *block);
-    void block_set(const size_t block_ix, block<K, V> *block);
+    void block_insert(const size_t block_ix, block<K, V, Compare> *block);
+    void block_set(const size_t block_ix, block<K, V, Compare> *block);
+
+    void mark_changed(const size_t block_ix) { m_changed_blocks |= ((uint32_t)1 << block_ix); }
+
+    /** Returns true if version lhs is more recent than rhs. Versions wrap
+     *  around, and are thus compared by their distance. Versions which lie
+     *  more than 2^31 apart may appear newer than they are, which only
+     *  causes update_from() to copy unchanged blocks or fail. */
+    static bool newer(const version_t lhs,
+                      const version_t rhs)
+    {
+        return (int32_t)(lhs - rhs) > 0;
+    }
 
 private:
 
@@ -74,10 +117,23 @@ private:
      *  one block of each size in array) are preserved while the block array is
      *  visible to other threads.
      */
-    block<K, V> *m_blocks[MAX_BLOCKS];
+    block<K, V, Compare> *m_blocks[MAX_BLOCKS];
     size_t m_size;
 
-    block_pivots<K, V, Rlx, MAX_BLOCKS> m_pivots;
+    block_pivots<K, V, Rlx, MAX_BLOCKS, Compare> m_pivots;
+    relaxation<Rlx> m_relaxation;
+
+    /** The version in which each block (or its pivots) was last changed,
+     *  and in which all pivots were last recalculated (e.g. through growing
+     *  the range). Unchanged blocks of later versions equal those of earlier
+     *  ones, which allows readers to skip them in update_from(). */
+    version_t m_block_versions[MAX_BLOCKS];
+    version_t m_pivots_version;
+
+    /** Changes which have not been stamped yet, one bit per block. */
+    uint32_t m_changed_blocks;
+    bool m_pivots_changed;
+    static_assert(MAX_BLOCKS <= 32, "m_changed_blocks needs a bit for each block");
 
     std::atomic<version_t> m_version;
 
@@ -20,9 +20,13 @@
 #include <algorithm>
 #include <limits>
 
-template <class K, class V, int Rlx>
-block_array<K, V, Rlx>::block_array() :
+template <class K, class V, int Rlx, class Compare>
+block_array<K, V, Rlx, Compare>::block_array() :
     m_size(0),
+    m_block_versions { 0 },
+    m_pivots_version(0),
+    m_changed_blocks(0),
+    m_pivots_changed(false),
     m_version(0),
 #ifndef NDEBUG
     m_gen(0)
@@ -32,37 +36,60 @@ block_array<K, V, Rlx>::block_array() :
 {
 }
 
-template <class K, class V, int Rlx>
-block_array<K, V, Rlx>::~block_array()
+template <class K, class V, int Rlx, class Compare>
+block_array<K, V, Rlx, Compare>::~block_array()
 {
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-block_array<K, V, Rlx>::block_insert(const size_t block_ix,
-                                     block<K, V> *block)
+block_array<K, V, Rlx, Compare>::block_insert(const size_t block_ix,
+                                              block<K, V, Compare> *block)
 {
     memmove(&m_blocks[block_ix + 1],
             &m_blocks[block_ix],
             sizeof(m_blocks[0]) * (m_size - block_ix));
     m_blocks[block_ix] = block;
-    m_pivots.insert(block_ix, m_size, block->first(), m_pivots.pivot_of(block));
+    m_pivots.insert(block_ix, m_size, block->first(), m_pivots.pivot_of(block, m_relaxation));
+
+    for (size_t i = block_ix; i <= m_size; i++) {
+        mark_changed(i);
+    }
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-block_array<K, V, Rlx>::block_set(const size_t block_ix,
-                                  block<K, V> *block)
+block_array<K, V, Rlx, Compare>::block_set(const size_t block_ix,
+                                           block<K, V, Compare> *block)
 {
     // TODO: More efficient pivot recalculation.
     m_blocks[block_ix] = block;
-    m_pivots.set(block_ix, block->first(), m_pivots.pivot_of(block));
+    m_pivots.set(block_ix, block->first(), m_pivots.pivot_of(block, m_relaxation));
+    mark_changed(block_ix);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-block_array<K, V, Rlx>::insert(block<K, V> *new_block,
-                               block_pool<K, V> *pool)
+block_array<K, V, Rlx, Compare>::set_relaxation(const relaxation<Rlx> &rlx)
+{
+    const int value = rlx.get();
+    if (value == m_relaxation.get()) {
+        return;
+    }
+
+    /* Pivots calculated for a larger relaxation may violate the new bound, and
+     * the maximal pivot no longer restricts the range of newly set blocks.
+     * Recalculate them from scratch. */
+
+    m_relaxation.set(value);
+    m_pivots.shrink(m_blocks, m_size, m_relaxation);
+    m_pivots_changed = true;
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+block_array<K, V, Rlx, Compare>::insert(block<K, V, Compare> *new_block,
+                                        block_pool<K, V, Compare> *pool)
 {
     if (m_size == 0) {
         block_set(0, new_block);
@@ -96,6 +123,7 @@ block_array<K, V, Rlx>::insert(block<K, V> *new_block,
 
                 insert_block = merged_block;
                 m_blocks[i - 1] = nullptr;
+                mark_changed(i - 1);
             }
         }
         block_insert(i, insert_block);
@@ -108,18 +136,20 @@ block_array<K, V, Rlx>::insert(block<K, V> *new_block,
      * attempt to improve pivots. */
 
     const size_t ncandidates = m_pivots.count(m_size);
-    if (ncandidates > Rlx + 1) {
+    if (ncandidates > (size_t)m_relaxation.get() + 1) {
         // TODO: Possibly a more efficient reset mechanism which uses knowledge of existing
         // pivots.
-        m_pivots.shrink(m_blocks, m_size);
-    } else if (ncandidates < Rlx / 2) {
-        m_pivots.grow(ncandidates, m_blocks, m_size);
+        m_pivots.shrink(m_blocks, m_size, m_relaxation);
+        m_pivots_changed = true;
+    } else if (ncandidates < (size_t)m_pivots.min_count(m_relaxation)) {
+        m_pivots.grow(ncandidates, m_blocks, m_size, m_relaxation);
+        m_pivots_changed = true;
     }
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-block_array<K, V, Rlx>::compact(block_pool<K, V> *pool)
+block_array<K, V, Rlx, Compare>::compact(block_pool<K, V, Compare> *pool)
 {
     remove_null_blocks();
 
@@ -168,15 +198,16 @@ block_array<K, V, Rlx>::compact(block_pool<K, V> *pool)
         merge_block->merge(big_block, big_first, small_block, small_first);
 
         m_blocks[i + 1] = nullptr;
+        mark_changed(i + 1);
         block_set(i, merge_block);
     }
 
     remove_null_blocks();
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-block_array<K, V, Rlx>::remove_null_blocks() {
+block_array<K, V, Rlx, Compare>::remove_null_blocks() {
 #ifndef NDEBUG
     size_t prev_capacity = std::numeric_limits<size_t>::max();
 #endif
@@ -186,8 +217,11 @@ block_array<K, V, Rlx>::remove_null_blocks() {
         if (b == nullptr) {
             continue;
         }
-        m_blocks[dst] = b;
-        m_pivots.copy(src, dst);
+        if (src != dst) {
+            m_blocks[dst] = b;
+            m_pivots.copy(src, dst);
+            mark_changed(dst);
+        }
         dst++;
 
 #ifndef NDEBUG
@@ -199,22 +233,23 @@ block_array<K, V, Rlx>::remove_null_blocks() {
     m_size = dst;
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-block_array<K, V, Rlx>::delete_min(V &val)
+block_array<K, V, Rlx, Compare>::delete_min(V &val)
 {
-    typename block<K, V>::peek_t best = peek();
+    typename block<K, V, Compare>::peek_t best = peek();
 
     if (best.m_item == nullptr) {
         return false; /* We did our best, give up. */
     }
 
+    /* Not recycled, block arrays may reference items of any origin. */
     return best.m_item->take(best.m_version, val);
 }
 
-template <class K, class V, int Rlx>
-typename block<K, V>::peek_t
-block_array<K, V, Rlx>::peek()
+template <class K, class V, int Rlx, class Compare>
+typename block<K, V, Compare>::peek_t
+block_array<K, V, Rlx, Compare>::peek()
 {
     /* Random selection of any item within the range given by the pivots.
      * First, calculate the number of items within the range. We need to store
@@ -223,27 +258,28 @@ block_array<K, V, Rlx>::peek()
      * might have changed in the meantime).
      */
 
-    typename block<K, V>::peek_t ret;
+    typename block<K, V, Compare>::peek_t ret;
     while (true) {
         int ncandidates = m_pivots.count(m_size);
 
         /* If the range contains too few items, attempt to improve it. */
 
-        if (ncandidates < Rlx / 2) {
-            ncandidates = m_pivots.grow(ncandidates, m_blocks, m_size);
+        if (ncandidates < m_pivots.min_count(m_relaxation)) {
+            ncandidates = m_pivots.grow(ncandidates, m_blocks, m_size, m_relaxation);
+            m_pivots_changed = true;
         }
 
         /* Select a random element within the range, find it, and return it. */
 
         if (ncandidates == 0) {
-            return block<K, V>::peek_t::EMPTY();
+            return block<K, V, Compare>::peek_t::EMPTY();
         }
 
         int selected_element = m_gen() % ncandidates;
 
         size_t block_ix;
-        block<K, V> *b = nullptr;
-        const typename block<K,  V>::block_item *best = nullptr;
+        block<K, V, Compare> *b = nullptr;
+        size_t best_ix = 0;
         for (block_ix = 0; block_ix < m_size; block_ix++) {
             const int elements_in_range = m_pivots.count_in(block_ix);
 
@@ -254,20 +290,20 @@ block_array<K, V, Rlx>::peek()
             }
 
             b = m_blocks[block_ix];
-            best = b->peek_nth(m_pivots.nth_ix_in(selected_element, block_ix));
+            best_ix = m_pivots.nth_ix_in(selected_element, block_ix);
 
             // TODO: If the current block is less than half-filled, trigger a shrink.
 
             break;
         }
 
-        if (best == nullptr) {
+        if (b == nullptr) {
             COUNT_INC(failed_peeks);
             continue;
-        } else if (!best->taken()) {
+        } else if (!b->taken(best_ix)) {
             /* Found a valid element, return it. */
             COUNT_INC(successful_peeks);
-            ret = *best;
+            ret = b->peek_nth(best_ix);
             return ret;
         } else if (block_ix < m_size) {
             /* The selected item has already been taken, fall back to removing
@@ -279,10 +315,10 @@ block_array<K, V, Rlx>::peek()
             assert(count_in_block > 0);
 
             const size_t first_in_block = m_pivots.nth_ix_in(0, block_ix);
-            best = b->peek_nth(first_in_block);
+            best_ix = first_in_block;
 
-            for (size_t i = 0; i < count_in_block; i++, best++) {
-                if (!best->taken()) {
+            for (size_t i = 0; i < count_in_block; i++, best_ix++) {
+                if (!b->taken(best_ix)) {
                     /* Simply taking the first item here would bias peek()
                      * towards the first item in the largest block. Instead,
                      * retry with a random selection.
@@ -293,15 +329,53 @@ block_array<K, V, Rlx>::peek()
                     break;
                 } else {
                     m_pivots.mark_first_taken_in(block_ix);
+                    mark_changed(block_ix);
                 }
             }
         }
     }
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
+size_t
+block_array<K, V, Rlx, Compare>::add_candidates(Merge &merge)
+{
+    const size_t ncandidates = m_pivots.count(m_size);
+    if (ncandidates < (size_t)m_pivots.min_count(m_relaxation)) {
+        m_pivots.grow(ncandidates, m_blocks, m_size, m_relaxation);
+        m_pivots_changed = true;
+    }
+
+    const size_t first_range_ix = merge.size();
+    for (size_t block_ix = 0; block_ix < m_size; block_ix++) {
+        const size_t first = m_pivots.nth_ix_in(0, block_ix);
+        merge.add(m_blocks[block_ix], first, first + m_pivots.count_in(block_ix), true);
+    }
+
+    return first_range_ix;
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
+void
+block_array<K, V, Rlx, Compare>::consume_candidates(const Merge &merge,
+                                                    const size_t first_range_ix)
+{
+    for (size_t block_ix = 0; block_ix < m_size; block_ix++) {
+        const size_t consumed = merge.consumed(first_range_ix + block_ix);
+        for (size_t i = 0; i < consumed; i++) {
+            m_pivots.mark_first_taken_in(block_ix);
+        }
+        if (consumed > 0) {
+            mark_changed(block_ix);
+        }
+    }
+}
+
+template <class K, class V, int Rlx, class Compare>
 void
-block_array<K, V, Rlx>::copy_from(const block_array<K, V, Rlx> *that)
+block_array<K, V, Rlx, Compare>::copy_from(const block_array<K, V, Rlx, Compare> *that)
 {
     do {
         m_version = that->m_version.load(std::memory_order_acquire);
@@ -309,7 +383,72 @@ block_array<K, V, Rlx>::copy_from(const block_array<K, V, Rlx> *that)
 
         m_size = that->m_size;
         memcpy(m_blocks, that->m_blocks, sizeof(m_blocks[0]) * m_size);
+        memcpy(m_block_versions, that->m_block_versions, sizeof(m_block_versions[0]) * m_size);
 
         m_pivots = that->m_pivots;
+        m_relaxation = that->m_relaxation;
+
+        m_pivots_version = that->m_pivots_version;
+        m_changed_blocks = that->m_changed_blocks;
+        m_pivots_changed = that->m_pivots_changed;
     } while (that->m_version.load() != m_version);
 }
+
+template <class K, class V, int Rlx, class Compare>
+bool
+block_array<K, V, Rlx, Compare>::update_from(const block_array<K, V, Rlx, Compare> *that)
+{
+    /* Blocks which have changed locally since our version are copied as
+     * well. Recalculated pivots cannot be mixed with those of another
+     * version. */
+
+    const version_t base_version = m_version.load(std::memory_order_relaxed);
+    const version_t version = that->m_version.load(std::memory_order_acquire);
+    if (m_pivots_changed || newer(base_version, version)) {
+        return false;
+    }
+
+    const size_t size = that->m_size;
+    if (size > MAX_BLOCKS || newer(that->m_pivots_version, base_version)) {
+        return false;
+    }
+
+    m_version = version;
+    m_size = size;
+    for (size_t i = 0; i < size; i++) {
+        const version_t block_version = that->m_block_versions[i];
+        if (!newer(block_version, base_version)
+                && (m_changed_blocks & ((uint32_t)1 << i)) == 0) {
+            continue;
+        }
+
+        m_blocks[i] = that->m_blocks[i];
+        m_pivots.copy(that->m_pivots, i);
+        m_block_versions[i] = block_version;
+        COUNT_INC(slsm_updated_blocks);
+    }
+
+    m_relaxation = that->m_relaxation;
+    m_changed_blocks = 0;
+
+    return (that->m_version.load() == version);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+block_array<K, V, Rlx, Compare>::stamp_changes()
+{
+    const version_t version = this->version();
+    for (size_t i = 0; i < MAX_BLOCKS; i++) {
+        if ((m_changed_blocks & ((uint32_t)1 << i)) != 0) {
+            m_block_versions[i] = version;
+        }
+    }
+
+    if (m_pivots_changed) {
+        m_pivots_version = version;
+    }
+
+    m_changed_blocks = 0;
+    m_pivots_changed = false;
+}
@@ -0,0 +1,272 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BLOCK_COMBINER_H
+#define __BLOCK_COMBINER_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "components/block.h"
+#include "util/backoff.h"
+#include "util/memory_resource.h"
+
+namespace kpq {
+
+/**
+ * Lets threads which repeatedly fail to update the global array hand their
+ * block over to the next thread which inserts into the shared lsm. That
+ * thread merges all pending blocks into its own before attempting its
+ * update. A single successful update thus publishes several blocks.
+ *
+ * A posted block passes through the following states of its slot:
+ * b (pending) -> b | CLAIMED (being merged by the claimer) -> b | MERGED
+ * (contained in the claimer's block) -> nullptr (published). Blocks are
+ * only read by the claimer, and remain owned by their poster, which must
+ * not modify them until they are published or withdrawn.
+ *
+ * Posters never wait for a claimer indefinitely: a block may be withdrawn
+ * in any state before its publication. A claimed or merged block is
+ * withdrawn by moving its slot to b | WITHDRAWN, and only the claimer frees
+ * the slot again, either when confirming its merge (discarding the result)
+ * or when releasing its published blocks. A slot thus never holds the same
+ * block twice during a single claim, and stale confirm() calls cannot
+ * succeed on a reposted block. The poster must not reuse a block withdrawn
+ * while CLAIMED before its claimer has freed the slot, see withdrawn().
+ *
+ * A block withdrawn once merged is published both by its poster and by its
+ * claimer. The duplicate item references are harmless: takes are decided
+ * per item by its version, such that each item is still taken exactly once.
+ */
+template <class K, class V, class Compare = std::less<K>>
+class block_combiner {
+public:
+    static constexpr size_t NUM_SLOTS = 8;
+
+    block_combiner() :
+        m_pending(0)
+    {
+        for (size_t i = 0; i < NUM_SLOTS; i++) {
+            m_slots[i].m_block.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /** Offers b for publication by another thread. Returns the slot index,
+     *  or -1 if all slots are occupied. */
+    int post(block<K, V, Compare> *b)
+    {
+        const uintptr_t desired = reinterpret_cast<uintptr_t>(b);
+        for (size_t i = 0; i < NUM_SLOTS; i++) {
+            uintptr_t expected = 0;
+            if (m_slots[i].m_block.load(std::memory_order_relaxed) == 0
+                    && m_slots[i].m_block.compare_exchange_strong(expected, desired,
+                                                                  std::memory_order_release)) {
+                m_pending.fetch_add(1, std::memory_order_release);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /** Takes b back unless it has already been claimed. */
+    bool retract(const int slot,
+                 block<K, V, Compare> *b)
+    {
+        uintptr_t expected = reinterpret_cast<uintptr_t>(b);
+        if (m_slots[slot].m_block.compare_exchange_strong(expected, 0,
+                                                          std::memory_order_relaxed)) {
+            m_pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /** Takes b back unless it has already been published. If so, merging is
+     *  set to true if a claimer may still be reading b, in which case b
+     *  must not be modified while withdrawn() holds. */
+    bool withdraw(const int slot,
+                  block<K, V, Compare> *b,
+                  bool &merging)
+    {
+        if (retract(slot, b)) {
+            merging = false;
+            return true;
+        }
+
+        const uintptr_t posted = reinterpret_cast<uintptr_t>(b);
+        uintptr_t expected = posted | CLAIMED;
+        if (m_slots[slot].m_block.compare_exchange_strong(expected, posted | WITHDRAWN,
+                                                          std::memory_order_acquire,
+                                                          std::memory_order_relaxed)) {
+            merging = true;
+            return true;
+        }
+
+        /* Merged blocks are no longer read by their claimer. */
+
+        if (expected == (posted | MERGED)
+                && m_slots[slot].m_block.compare_exchange_strong(expected, posted | WITHDRAWN,
+                                                                 std::memory_order_relaxed)) {
+            merging = false;
+            return true;
+        }
+        return false;
+    }
+
+    /** Waits a bounded time for the claimer of b to publish it, and
+     *  withdraws b otherwise. Returns false if b has been withdrawn, in
+     *  which case merging is set as by withdraw(). */
+    bool wait_published(const int slot,
+                        block<K, V, Compare> *b,
+                        bool &merging)
+    {
+        backoff wait;
+        while (!wait.exhausted()) {
+            if (published(slot, b)) {
+                return true;
+            }
+            wait.pause();
+        }
+
+        return !withdraw(slot, b, merging);
+    }
+
+    /** Returns true once the claimer of b has published it. */
+    bool published(const int slot,
+                   const block<K, V, Compare> *b) const
+    {
+        const uintptr_t posted = reinterpret_cast<uintptr_t>(b);
+        const uintptr_t observed = m_slots[slot].m_block.load(std::memory_order_acquire);
+        return ((observed & ~STATE_MASK) != posted);
+    }
+
+    /** Returns true while the claimer of the withdrawn block b has not yet
+     *  freed its slot. For blocks withdrawn while merging, the claimer may
+     *  then still be reading b. */
+    bool withdrawn(const int slot,
+                   const block<K, V, Compare> *b) const
+    {
+        const uintptr_t posted = reinterpret_cast<uintptr_t>(b);
+        return (m_slots[slot].m_block.load(std::memory_order_acquire) == (posted | WITHDRAWN));
+    }
+
+    /** Returns true if b has been claimed but not yet published. */
+    bool claimed(const int slot,
+                 const block<K, V, Compare> *b) const
+    {
+        const uintptr_t posted = reinterpret_cast<uintptr_t>(b);
+        const uintptr_t observed = m_slots[slot].m_block.load(std::memory_order_relaxed);
+        return (observed == (posted | CLAIMED) || observed == (posted | MERGED));
+    }
+
+    /** Claims up to n pending blocks, storing them in blocks and their slot
+     *  indexes in slots. Returns the number of claimed blocks, each of which
+     *  must be confirmed once merged, and released once published. */
+    size_t claim(block<K, V, Compare> **blocks,
+                 int *slots,
+                 const size_t n)
+    {
+        size_t nclaimed = 0;
+        if (m_pending.load(std::memory_order_acquire) == 0) {
+            return nclaimed;
+        }
+
+        for (size_t i = 0; i < NUM_SLOTS && nclaimed < n; i++) {
+            uintptr_t observed = m_slots[i].m_block.load(std::memory_order_acquire);
+            if (observed == 0 || (observed & STATE_MASK) != 0) {
+                continue;
+            }
+
+            if (m_slots[i].m_block.compare_exchange_strong(observed, observed | CLAIMED,
+                                                           std::memory_order_acquire)) {
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                blocks[nclaimed] = reinterpret_cast<block<K, V, Compare> *>(observed);
+                slots[nclaimed] = i;
+                nclaimed++;
+            }
+        }
+
+        return nclaimed;
+    }
+
+    /** Called by the claimer of b once it has merged b. Returns false if b
+     *  has been withdrawn in the meantime, in which case the slot is freed,
+     *  the merge result must be discarded and b must neither be read nor
+     *  released anymore. */
+    bool confirm(const int slot,
+                 const block<K, V, Compare> *b)
+    {
+        const uintptr_t posted = reinterpret_cast<uintptr_t>(b);
+        uintptr_t expected = posted | CLAIMED;
+        if (m_slots[slot].m_block.compare_exchange_strong(expected, posted | MERGED,
+                                                          std::memory_order_acq_rel)) {
+            return true;
+        }
+
+        /* Only we may change the slot of a withdrawn block. The release orders
+         * our reads of b before its reuse by the poster. */
+
+        assert(expected == (posted | WITHDRAWN));
+        m_slots[slot].m_block.store(0, std::memory_order_release);
+        return false;
+    }
+
+    /** Marks the given merged blocks as published and frees their slots.
+     *  Returns the number of blocks which have not been withdrawn, i.e. which
+     *  have been published by us only. */
+    size_t release(block<K, V, Compare> * const *blocks,
+                   const int *slots,
+                   const size_t n)
+    {
+        size_t nreleased = 0;
+        for (size_t i = 0; i < n; i++) {
+            const uintptr_t posted = reinterpret_cast<uintptr_t>(blocks[i]);
+            const uintptr_t observed =
+                m_slots[slots[i]].m_block.exchange(0, std::memory_order_release);
+            assert(observed == (posted | MERGED) || observed == (posted | WITHDRAWN));
+            if (observed == (posted | MERGED)) {
+                nreleased++;
+            }
+        }
+        return nreleased;
+    }
+
+private:
+    /** Blocks are at least pointer-aligned, the two lowest bits are thus free. */
+    static constexpr uintptr_t CLAIMED    = 1;
+    static constexpr uintptr_t MERGED     = 2;
+    static constexpr uintptr_t WITHDRAWN  = 3;
+    static constexpr uintptr_t STATE_MASK = CLAIMED | MERGED;
+
+    struct slot {
+        std::atomic<uintptr_t> m_block;
+        char m_padding[CACHE_LINE_SIZE - sizeof(std::atomic<uintptr_t>)];
+    };
+
+    /** The number of pending (posted but unclaimed) blocks, which lets
+     *  claim() skip the slots in the common case. */
+    std::atomic<size_t> m_pending;
+    char m_padding[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+    slot m_slots[NUM_SLOTS];
+};
+
+}
+
+#endif /* __BLOCK_COMBINER_H */
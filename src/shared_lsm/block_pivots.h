@@ -20,25 +20,37 @@
 #ifndef __BLOCK_PIVOTS_H
 #define __BLOCK_PIVOTS_H
 
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#include "components/relaxation.h"
+
 namespace kpq {
 
 // TODO: Better naming, pivots is very undescriptive to me. Item range? Index boundaries
 // could then be called lower and upper bounds?
 // TODO: Store first and #elems per block to avoid having to recalculate it all the time.
 // Possibly maintain a count of all elems in the range.
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare = std::less<K>>
 class block_pivots {
 public:
     block_pivots();
     virtual ~block_pivots();
 
-    block_pivots &operator=(const block_pivots<K, V, Rlx, MaxBlocks> &that);
+    block_pivots &operator=(const block_pivots<K, V, Rlx, MaxBlocks, Compare> &that);
 
-    size_t shrink(block<K, V> **blocks,
-                  const size_t size);
+    size_t shrink(block<K, V, Compare> **blocks,
+                  const size_t size,
+                  const relaxation<Rlx> &rlx);
     size_t grow(const int initial_range_size,
-                block<K, V> **blocks,
-                const size_t size);
+                block<K, V, Compare> **blocks,
+                const size_t size,
+                const relaxation<Rlx> &rlx);
+
+    /** The pivot range is grown once it contains fewer than min_count(rlx)
+     *  elements. At least one element is required even for tiny relaxations. */
+    static int min_count(const relaxation<Rlx> &rlx) { return std::max(1, rlx.get() / 2); }
 
     /** Counts the number of elements within the pivot range. */
     size_t count(const size_t size);
@@ -49,7 +61,8 @@ public:
 
     void mark_first_taken_in(const size_t block_ix);
 
-    int pivot_of(block<K, V> *block) const;
+    int pivot_of(block<K, V, Compare> *block,
+                 const relaxation<Rlx> &rlx) const;
 
     void insert(const size_t block_ix,
                 const size_t size,
@@ -57,13 +70,39 @@ public:
                 const int pivot);
     void set(const size_t block_ix, const int first_in_block, const int pivot);
     void copy(const size_t src_ix, const size_t dst_ix);
+    /** Copies the pivots of block_ix in that, which must share our maximal
+     *  pivot. */
+    void copy(const block_pivots<K, V, Rlx, MaxBlocks, Compare> &that,
+              const size_t block_ix);
 
 private:
+    /** Keys which support arithmetic in their natural order allow bisecting
+     *  the key space between the current and a known upper pivot. All other
+     *  keys are restricted to Compare. */
+    typedef std::integral_constant<bool, std::is_arithmetic<K>::value
+                                   && std::is_same<Compare, std::less<K>>::value> arithmetic_keys;
+
+    /** Returns true if key lies beyond the maximal pivot (i.e. outside of the
+     *  pivot range) w.r.t. Compare. */
+    bool beyond_maximal_pivot(const K &key) const;
+
+    size_t resize(const int initial_range_size,
+                  const K &initial_upper_bound,
+                  block<K, V, Compare> **blocks,
+                  const size_t size,
+                  const relaxation<Rlx> &rlx);
+    size_t resize(const int initial_range_size,
+                  const K &initial_upper_bound,
+                  block<K, V, Compare> **blocks,
+                  const size_t size,
+                  const relaxation<Rlx> &rlx,
+                  std::true_type);
     size_t resize(const int initial_range_size,
-                  const K initial_lower_bound,
-                  const K initial_upper_bound,
-                  block<K, V> **blocks,
-                  const size_t size);
+                  const K &initial_upper_bound,
+                  block<K, V, Compare> **blocks,
+                  const size_t size,
+                  const relaxation<Rlx> &rlx,
+                  std::false_type);
 
 private:
     static constexpr size_t INVALID_COUNT_FOR_SIZE = -1;
@@ -77,6 +116,9 @@ private:
     int m_upper[MaxBlocks];
     int m_lower[MaxBlocks];
     K m_maximal_pivot;
+    /** Generic keys have no minimal value to initialize m_maximal_pivot with,
+     *  the range is empty until the first resize instead. */
+    bool m_has_maximal_pivot;
 
     /**
      * A cache used to reduce the number of required count recalculations. m_count_for_size
@@ -19,28 +19,30 @@
 
 #include <limits>
 
-template <class K, class V, int Rlx, int MaxBlocks>
-block_pivots<K, V, Rlx, MaxBlocks>::block_pivots() :
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::block_pivots() :
     m_upper { 0 },
     m_lower { 0 },
     m_maximal_pivot(std::numeric_limits<K>::min()),
+    m_has_maximal_pivot(arithmetic_keys::value),
     m_count { 0 },
     m_count_for_size { INVALID_COUNT_FOR_SIZE }
 {
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
-block_pivots<K, V, Rlx, MaxBlocks>::~block_pivots()
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::~block_pivots()
 {
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
-block_pivots<K, V, Rlx, MaxBlocks> &
-block_pivots<K, V, Rlx, MaxBlocks>::operator=(const block_pivots<K, V, Rlx, MaxBlocks> &that)
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+block_pivots<K, V, Rlx, MaxBlocks, Compare> &
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::operator=(const block_pivots<K, V, Rlx, MaxBlocks, Compare> &that)
 {
     memcpy(m_upper, that.m_upper, sizeof(m_upper));
     memcpy(m_lower, that.m_lower, sizeof(m_lower));
     m_maximal_pivot = that.m_maximal_pivot;
+    m_has_maximal_pivot = that.m_has_maximal_pivot;
 
     m_count = that.m_count;
     m_count_for_size = that.m_count_for_size;
@@ -48,17 +50,18 @@ block_pivots<K, V, Rlx, MaxBlocks>::operator=(const block_pivots<K, V, Rlx, MaxB
     return *this;
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 size_t
-block_pivots<K, V, Rlx, MaxBlocks>::shrink(block<K, V> **blocks,
-                                           const size_t size)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::shrink(block<K, V, Compare> **blocks,
+                                                    const size_t size,
+                                                    const relaxation<Rlx> &rlx)
 {
     COUNT_INC(pivot_shrinks);
 
     /* Find the minimal element and initially set pivots s.t. it is the only
      * element in the pivot set. */
 
-    typename block<K, V>::peek_t best = block<K, V>::peek_t::EMPTY();
+    typename block<K, V, Compare>::peek_t best = block<K, V, Compare>::peek_t::EMPTY();
     int best_block_ix = -1;
     int best_item_ix = -1;
     for (size_t i = 0; i < size; i++) {
@@ -70,7 +73,7 @@ block_pivots<K, V, Rlx, MaxBlocks>::shrink(block<K, V> **blocks,
         m_lower[i] = m_upper[i] = candidate_ix;
 
         if ((best.empty() && !candidate.empty()) ||
-                (!best.empty() && !candidate.empty() && candidate.m_key < best.m_key)) {
+                (!best.empty() && !candidate.empty() && Compare()(candidate.m_key, best.m_key))) {
             best = candidate;
             best_block_ix = i;
             best_item_ix = candidate_ix;
@@ -87,37 +90,66 @@ block_pivots<K, V, Rlx, MaxBlocks>::shrink(block<K, V> **blocks,
     m_count = 1;
     m_count_for_size = size;
 
+    /* The maximal pivot must match the reset range in case resize() fails
+     * to find a better solution, which happens e.g. if the relaxation has
+     * been lowered since the previous resize. */
+    const K previous_maximal_pivot = m_maximal_pivot;
+    m_maximal_pivot = best.m_key;
+    m_has_maximal_pivot = true;
+
     return resize(1,
-                  best.m_key,
-                  m_maximal_pivot,
+                  previous_maximal_pivot,
                   blocks,
-                  size);
+                  size,
+                  rlx);
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 size_t
-block_pivots<K, V, Rlx, MaxBlocks>::grow(const int initial_range_size,
-                                         block<K, V> **blocks,
-                                         const size_t size)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::grow(const int initial_range_size,
+                                                  block<K, V, Compare> **blocks,
+                                                  const size_t size,
+                                                  const relaxation<Rlx> &rlx)
 {
     COUNT_INC(pivot_grows);
 
     return resize(initial_range_size,
-                  m_maximal_pivot,
                   std::numeric_limits<K>::max(),
                   blocks,
-                  size);
+                  size,
+                  rlx);
+}
+
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+bool
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::beyond_maximal_pivot(const K &key) const
+{
+    return !(arithmetic_keys::value || m_has_maximal_pivot)
+           || Compare()(m_maximal_pivot, key);
+}
+
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+size_t
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::resize(const int initial_range_size,
+                                                    const K &initial_upper_bound,
+                                                    block<K, V, Compare> **blocks,
+                                                    const size_t size,
+                                                    const relaxation<Rlx> &rlx)
+{
+    return resize(initial_range_size, initial_upper_bound, blocks, size, rlx,
+                  arithmetic_keys());
 }
 
 #define CORRECTED_TENTATIVE_COUNT() (elements_in_tentative_range + 1 - elements_with_maximal_key)
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 size_t
-block_pivots<K, V, Rlx, MaxBlocks>::resize(const int initial_range_size,
-                                           const K initial_lower_bound,
-                                           const K initial_upper_bound,
-                                           block<K, V> **blocks,
-                                           const size_t size)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::resize(const int initial_range_size,
+                                                    const K &initial_upper_bound,
+                                                    block<K, V, Compare> **blocks,
+                                                    const size_t size,
+                                                    const relaxation<Rlx> &rlx,
+                                                    std::true_type)
 {
     /* During iterative improvement of pivots, we may repeatedly go beyond legal
      * limits and must backtrack the previous solution. For that purpose, we
@@ -133,7 +165,7 @@ block_pivots<K, V, Rlx, MaxBlocks>::resize(const int initial_range_size,
     /* Initially, only the minimal element is within the pivot range. */
     int elements_in_range = initial_range_size;
 
-    K lower_bound = initial_lower_bound;
+    K lower_bound = m_maximal_pivot;
     K upper_bound = initial_upper_bound;
     K mid;
 
@@ -161,11 +193,9 @@ block_pivots<K, V, Rlx, MaxBlocks>::resize(const int initial_range_size,
                 continue;
             }
 
-            auto it = b->peek_nth(pivot);
-            const auto end = it + last - pivot;
-            for (; it < end; it++, pivot++) {
-                K key = it->m_key;
-                if (it->taken()) {
+            for (; pivot < last; pivot++) {
+                K key = b->key(pivot);
+                if (b->taken(pivot)) {
                     continue;
                 } else if (key > mid) {
                     break;
@@ -179,7 +209,7 @@ block_pivots<K, V, Rlx, MaxBlocks>::resize(const int initial_range_size,
                     }
                 }
 
-                if (CORRECTED_TENTATIVE_COUNT() > Rlx + 1) {
+                if (CORRECTED_TENTATIVE_COUNT() > rlx.get() + 1) {
                     tentative_pivots[block_ix] = pivot;
                     goto outer;
                 }
@@ -188,12 +218,12 @@ block_pivots<K, V, Rlx, MaxBlocks>::resize(const int initial_range_size,
         }
 
 outer:
-        if (CORRECTED_TENTATIVE_COUNT() > Rlx + 1) {
+        if (CORRECTED_TENTATIVE_COUNT() > rlx.get() + 1) {
             if (upper_bound == mid) {
                 goto out;
             }
             upper_bound = std::min(mid, maximal_key);
-        } else if (elements_in_tentative_range < Rlx / 2) {
+        } else if (elements_in_tentative_range < min_count(rlx)) {
             if (lower_bound == mid) {
                 break;  // Could not improve solution further.
             }
@@ -227,9 +257,82 @@ out:
 
 #undef CORRECTED_TENTATIVE_COUNT
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+size_t
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::resize(const int initial_range_size,
+                                                    const K &,
+                                                    block<K, V, Compare> **blocks,
+                                                    const size_t size,
+                                                    const relaxation<Rlx> &rlx,
+                                                    std::false_type)
+{
+    /* Without key arithmetic, we cannot bisect the key space. Instead, the range
+     * is extended by the smallest items beyond the current upper pivots in
+     * ascending order (i.e. a multiway merge over the sorted blocks) until it reaches
+     * the middle of the legal range [min_count, rlx + 1]. The selected item becomes
+     * the maximal pivot. Blocks are few, so a linear scan for the next candidate
+     * is cheaper than maintaining a heap. */
+
+    const int target = (min_count(rlx) + rlx.get() + 1) / 2;
+    int elements_in_range = initial_range_size;
+
+    Compare compare;
+    while (elements_in_range < target) {
+        int best_block_ix = -1;
+        const K *best = nullptr;
+        for (size_t block_ix = 0; block_ix < size; block_ix++) {
+            auto b = blocks[block_ix];
+            const int last = b->last();
+
+            int &pivot = m_upper[block_ix];
+            while (pivot < last && b->taken(pivot)) {
+                pivot++;
+            }
+
+            if (pivot >= last) {
+                continue;
+            }
+
+            const K &candidate = b->key(pivot);
+            if (best == nullptr || compare(candidate, *best)) {
+                best = &candidate;
+                best_block_ix = block_ix;
+            }
+        }
+
+        if (best == nullptr) {
+            break;  /* All blocks are exhausted. */
+        }
+
+        m_maximal_pivot = *best;
+        m_has_maximal_pivot = true;
+        m_upper[best_block_ix]++;
+        elements_in_range++;
+    }
+
+    /* Items with a key equal to the maximal pivot must be part of the range
+     * since pivot_of() includes them for newly inserted blocks. */
+    if (m_has_maximal_pivot) {
+        for (size_t block_ix = 0; block_ix < size; block_ix++) {
+            auto b = blocks[block_ix];
+            const int last = b->last();
+
+            int &pivot = m_upper[block_ix];
+            while (pivot < last && !compare(m_maximal_pivot, b->key(pivot))) {
+                pivot++;
+            }
+        }
+    }
+
+    m_count_for_size = INVALID_COUNT_FOR_SIZE;
+    m_count = count(size);
+
+    return m_count;
+}
+
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 size_t
-block_pivots<K, V, Rlx, MaxBlocks>::count(const size_t size)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::count(const size_t size)
 {
     if (m_count_for_size == size) {
         return m_count;
@@ -242,27 +345,27 @@ block_pivots<K, V, Rlx, MaxBlocks>::count(const size_t size)
     return m_count;
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 size_t
-block_pivots<K, V, Rlx, MaxBlocks>::count_in(const size_t block_ix) const
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::count_in(const size_t block_ix) const
 {
     assert(block_ix < MaxBlocks);
     assert(m_lower[block_ix] <= m_upper[block_ix]);
     return m_upper[block_ix] - m_lower[block_ix];
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 size_t
-block_pivots<K, V, Rlx, MaxBlocks>::nth_ix_in(const size_t relative_element_ix,
-                                              const size_t block_ix) const
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::nth_ix_in(const size_t relative_element_ix,
+                                                       const size_t block_ix) const
 {
     assert(block_ix < MaxBlocks);
     return m_lower[block_ix] + relative_element_ix;
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 void
-block_pivots<K, V, Rlx, MaxBlocks>::mark_first_taken_in(const size_t block_ix)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::mark_first_taken_in(const size_t block_ix)
 {
     assert(block_ix < MaxBlocks);
     m_lower[block_ix]++;
@@ -271,27 +374,27 @@ block_pivots<K, V, Rlx, MaxBlocks>::mark_first_taken_in(const size_t block_ix)
     }
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 int
-block_pivots<K, V, Rlx, MaxBlocks>::pivot_of(block<K, V> *block) const
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::pivot_of(block<K, V, Compare> *block,
+                                                      const relaxation<Rlx> &rlx) const
 {
     const size_t first = block->first();
-    const size_t upper_bound = std::min(first + Rlx + 1, block->last());
+    const size_t upper_bound = std::min(first + rlx.get() + 1, block->last());
     for (size_t i = first; i < upper_bound; i++) {
-        auto p = block->peek_nth(i);
-        if (!p->taken() && p->m_key > m_maximal_pivot) {
+        if (!block->taken(i) && beyond_maximal_pivot(block->key(i))) {
             return i;
         }
     }
     return upper_bound;
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 void
-block_pivots<K, V, Rlx, MaxBlocks>::insert(const size_t block_ix,
-                                           const size_t size,
-                                           const int first_in_block,
-                                           const int pivot)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::insert(const size_t block_ix,
+                                                    const size_t size,
+                                                    const int first_in_block,
+                                                    const int pivot)
 {
     memmove(&m_upper[block_ix + 1],
             &m_upper[block_ix],
@@ -302,21 +405,21 @@ block_pivots<K, V, Rlx, MaxBlocks>::insert(const size_t block_ix,
     set(block_ix, first_in_block, pivot);
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 void
-block_pivots<K, V, Rlx, MaxBlocks>::set(const size_t block_ix,
-                                        const int first_in_block,
-                                        const int pivot)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::set(const size_t block_ix,
+                                                 const int first_in_block,
+                                                 const int pivot)
 {
     m_lower[block_ix] = first_in_block;
     m_upper[block_ix] = pivot;
     m_count_for_size = INVALID_COUNT_FOR_SIZE;
 }
 
-template <class K, class V, int Rlx, int MaxBlocks>
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
 void
-block_pivots<K, V, Rlx, MaxBlocks>::copy(const size_t src_ix,
-                                         const size_t dst_ix)
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::copy(const size_t src_ix,
+                                                  const size_t dst_ix)
 {
     if (src_ix == dst_ix) {
         return;
@@ -326,3 +429,13 @@ block_pivots<K, V, Rlx, MaxBlocks>::copy(const size_t src_ix,
     m_upper[dst_ix] = m_upper[src_ix];
     m_count_for_size = INVALID_COUNT_FOR_SIZE;
 }
+
+template <class K, class V, int Rlx, int MaxBlocks, class Compare>
+void
+block_pivots<K, V, Rlx, MaxBlocks, Compare>::copy(const block_pivots<K, V, Rlx, MaxBlocks, Compare> &that,
+                                                  const size_t block_ix)
+{
+    m_lower[block_ix] = that.m_lower[block_ix];
+    m_upper[block_ix] = that.m_upper[block_ix];
+    m_count_for_size = INVALID_COUNT_FOR_SIZE;
+}
@@ -21,12 +21,17 @@
 #define __BLOCK_POOL_H
 
 #include "components/block.h"
+#include "util/counters.h"
+#include "util/epoch.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace kpq {
 
-template <class K, class V>
+#ifndef ENABLE_EPOCH_RECLAMATION
+
+template <class K, class V, class Compare = std::less<K>>
 class block_pool {
 private:
     static constexpr int MAX_POWER_OF_2   = 48;
@@ -37,10 +42,12 @@ private:
         BLOCK_FREE,
         BLOCK_LOCAL,
         BLOCK_GLOBAL,
+        BLOCK_PARKED,
     };
 
 public:
-    block_pool() :
+    block_pool(memory_resource *resource = get_default_resource()) :
+        m_resource(resource),
         m_pool { nullptr },
         m_status { BLOCK_FREE },
         m_version { 0 },
@@ -55,29 +62,18 @@ public:
     }
 
     /** Given the current version of the global array, returns a block of capacity 2^i. */
-    block<K, V> *get_block(const size_t i)
+    block<K, V, Compare> *get_block(const size_t i)
     {
-        /* Find the maximum version of globally allocated blocks.
-         * It is safe to reallocate any but the most recent global block.
-         * We could optimize this loop out in the future. */
-        int max_global_version = -1;
-        for (int j = ix(i); j < ix(i + 1); j++) {
-            if (m_status[j] == BLOCK_GLOBAL) {
-                max_global_version = std::max(max_global_version, (int)m_version[j]);
-            }
-        }
-
+        const int max_global_version = this->max_global_version(i);
         for (int j = ix(i); j < ix(i + 1); j++) {
-            if (m_status[j] == BLOCK_FREE
-                    || (m_status[j] == BLOCK_GLOBAL
-                        && (int)m_version[j] != max_global_version)) {
+            if (reusable(j, max_global_version)) {
                 m_status[j] = BLOCK_LOCAL;
                 m_local_ixs[m_local_ixs_size++] = j;
                 if (m_pool[j] == nullptr) {
                     /* Lazy block creation.
                      * 'used' is not needed for the shared lsm. Figure out a way for both
                      * mechanisms to interact when integrating shared & dist lsm's. */
-                    m_pool[j] = new block<K, V>(i);
+                    m_pool[j] = new block<K, V, Compare>(i, m_resource);
                     m_pool[j]->set_used();
                 } else {
                     m_pool[j]->clear();
@@ -89,7 +85,7 @@ public:
         return nullptr;
     }
 
-    void publish(block<K, V> **blocks,
+    void publish(block<K, V, Compare> **blocks,
                  const size_t nblocks,
                  const version_t version)
     {
@@ -108,12 +104,37 @@ public:
         }
     }
 
+    /** Blocks are reused based on their published version, see get_block(). */
+    void retire(block<K, V, Compare> **,
+                const size_t,
+                block<K, V, Compare> **,
+                const size_t,
+                epoch_domain &)
+    {
+    }
+
+    /** Keeps the local block b, which may still be read by another thread,
+     *  from being reused until unpark(b) is called. */
+    void park(block<K, V, Compare> *b)
+    {
+        const int ix = find(b);
+        assert(ix != -1 && m_status[ix] == BLOCK_LOCAL);
+        m_status[ix] = BLOCK_PARKED;
+    }
+
+    void unpark(block<K, V, Compare> *b)
+    {
+        const int ix = find(b);
+        assert(ix != -1 && m_status[ix] == BLOCK_PARKED);
+        m_status[ix] = BLOCK_FREE;
+    }
+
     void free_local()
     {
         free_local_except(nullptr);
     }
 
-    void free_local_except(block<K, V> *that)
+    void free_local_except(block<K, V, Compare> *that)
     {
         int that_ix = -1;
         for (size_t i = 0; i < m_local_ixs_size; i++) {
@@ -132,12 +153,50 @@ public:
         }
     }
 
-    bool contains(const block<K, V> *block) const {
+    bool contains(const block<K, V, Compare> *block) const {
         return (find(block) != -1);
     }
 
+    /** Releases the memory of all blocks which could currently be handed out
+     *  by get_block(), see block::release(). */
+    size_t trim()
+    {
+        size_t released = 0;
+        for (int i = 0; i < MAX_POWER_OF_2; i++) {
+            const int max_global_version = this->max_global_version(i);
+            for (int j = ix(i); j < ix(i + 1); j++) {
+                if (m_pool[j] != nullptr && reusable(j, max_global_version)) {
+                    released += m_pool[j]->release();
+                }
+            }
+        }
+        return released;
+    }
+
 private:
-    int find(const block<K, V> *block) const
+    /** Finds the maximum version of globally allocated blocks of capacity 2^i.
+     *  It is safe to reallocate any but the most recent global block.
+     *  We could optimize this loop out in the future. */
+    int max_global_version(const size_t i) const
+    {
+        int max_global_version = -1;
+        for (int j = ix(i); j < ix(i + 1); j++) {
+            if (m_status[j] == BLOCK_GLOBAL) {
+                max_global_version = std::max(max_global_version, (int)m_version[j]);
+            }
+        }
+        return max_global_version;
+    }
+
+    bool reusable(const int j,
+                  const int max_global_version) const
+    {
+        return m_status[j] == BLOCK_FREE
+                || (m_status[j] == BLOCK_GLOBAL
+                    && (int)m_version[j] != max_global_version);
+    }
+
+    int find(const block<K, V, Compare> *block) const
     {
         const int pow = block->power_of_2();
         for (int j = ix(pow); j < ix(pow + 1); j++) {
@@ -154,18 +213,249 @@ private:
     }
 
 private:
-    block<K, V> *m_pool[BLOCKS_IN_POOL];
+    /** The resource new blocks are allocated from. */
+    memory_resource *m_resource;
+
+    block<K, V, Compare> *m_pool[BLOCKS_IN_POOL];
     block_status m_status[BLOCKS_IN_POOL];
     version_t    m_version[BLOCKS_IN_POOL];
 
     /** Stores indexes allocated during the current insert iteration.
-     *  Valid stati are LOCAL and GLOBAL (if publish() has been called,
-     *  i.e. the current insert has been successfully completed).
+     *  Valid stati are LOCAL, PARKED and GLOBAL (if publish() has been
+     *  called, i.e. the current insert has been successfully completed).
      *  All other indexes are guaranteed not to be set to LOCAL. */
     size_t m_local_ixs_size;
     int m_local_ixs[BLOCKS_IN_POOL];
 };
 
+#else
+
+/**
+ * With ENABLE_EPOCH_RECLAMATION, blocks are never reused while they may still
+ * be referenced. Blocks allocated by the pool are local until they are
+ * published as part of the global array, which then owns them. The thread
+ * which removes a block from the global array retires it into its own pool,
+ * where it is reclaimed once no thread can reference it anymore (see
+ * epoch_domain).
+ *
+ * Reclaimed blocks are kept for reuse up to a limit per capacity and freed
+ * beyond that. Small blocks are kept up to a byte budget per capacity:
+ * while a delayed thread stalls the epoch, nothing is reclaimed, and the
+ * backlog is reclaimed at once afterwards. A fixed count would free most
+ * of it, only to allocate again during the next stall. Since large blocks
+ * are needed rarely, only few of them are kept, and their memory is
+ * released to the OS until they are reused.
+ *
+ * All shared lsm blocks must only be accessed within a critical section of
+ * the epoch domain passed to retire().
+ */
+template <class K, class V, class Compare = std::less<K>>
+class block_pool {
+private:
+    static constexpr int MAX_POWER_OF_2 = 48;
+    static constexpr size_t FREE_BLOCKS_PER_LEVEL       = 16;
+    static constexpr size_t FREE_BYTES_PER_LEVEL        = 64 * 1024;
+    static constexpr size_t FREE_PAGED_BLOCKS_PER_LEVEL = 2;
+
+    struct retired_block {
+        block<K, V, Compare> *m_block;
+        uint64_t m_epoch;
+    };
+
+public:
+    block_pool(memory_resource *resource = get_default_resource()) :
+        m_resource(resource)
+    {
+    }
+
+    virtual ~block_pool() {
+        for (auto b : m_local) {
+            delete b;
+        }
+        for (auto b : m_parked) {
+            delete b;
+        }
+        for (const auto &r : m_retired) {
+            delete r.m_block;
+        }
+        for (int i = 0; i < MAX_POWER_OF_2; i++) {
+            for (auto b : m_free[i]) {
+                delete b;
+            }
+        }
+    }
+
+    /** Returns a local block of capacity 2^i. */
+    block<K, V, Compare> *get_block(const size_t i)
+    {
+        block<K, V, Compare> *b;
+        if (m_free[i].empty()) {
+            b = new block<K, V, Compare>(i, m_resource);
+            b->set_used();
+        } else {
+            b = m_free[i].back();
+            m_free[i].pop_back();
+            b->clear();
+        }
+
+        m_local.push_back(b);
+        return b;
+    }
+
+    /** Passes ownership of all local blocks contained in blocks to the
+     *  global array. */
+    void publish(block<K, V, Compare> **blocks,
+                 const size_t nblocks,
+                 const version_t)
+    {
+        for (size_t i = 0; i < nblocks; i++) {
+            auto it = std::find(m_local.begin(), m_local.end(), blocks[i]);
+            if (it != m_local.end()) {
+                *it = m_local.back();
+                m_local.pop_back();
+            }
+        }
+    }
+
+    /** Called once the global array has been replaced successfully. Retires
+     *  all blocks which have thereby been removed from it, and reclaims
+     *  previously retired blocks where possible. */
+    void retire(block<K, V, Compare> **old_blocks,
+                const size_t old_nblocks,
+                block<K, V, Compare> **new_blocks,
+                const size_t new_nblocks,
+                epoch_domain &domain)
+    {
+        uint64_t epoch = domain.current();
+        for (size_t i = 0; i < old_nblocks; i++) {
+            auto b = old_blocks[i];
+            if (std::find(new_blocks, new_blocks + new_nblocks, b) == new_blocks + new_nblocks) {
+                m_retired.push_back({ b, epoch });
+            }
+        }
+
+        /* Blocks are retired in epoch order. */
+
+        epoch = domain.current();
+        size_t nreclaimed = 0;
+        while (nreclaimed < m_retired.size()
+                && epoch_domain::reclaimable(m_retired[nreclaimed].m_epoch, epoch)) {
+            reclaim(m_retired[nreclaimed++].m_block);
+        }
+        m_retired.erase(m_retired.begin(), m_retired.begin() + nreclaimed);
+
+        if (!m_retired.empty()) {
+            domain.try_advance();
+        }
+    }
+
+    /** Keeps the local block b, which may still be read by another thread,
+     *  from being reclaimed along with the remaining local blocks until
+     *  unpark(b) is called. */
+    void park(block<K, V, Compare> *b)
+    {
+        auto it = std::find(m_local.begin(), m_local.end(), b);
+        assert(it != m_local.end());
+        *it = m_local.back();
+        m_local.pop_back();
+
+        m_parked.push_back(b);
+    }
+
+    /** b has never been visible to threads other than its single reader,
+     *  and is thus reclaimed immediately. */
+    void unpark(block<K, V, Compare> *b)
+    {
+        auto it = std::find(m_parked.begin(), m_parked.end(), b);
+        assert(it != m_parked.end());
+        *it = m_parked.back();
+        m_parked.pop_back();
+
+        reclaim(b);
+    }
+
+    void free_local()
+    {
+        free_local_except(nullptr);
+    }
+
+    /** Local blocks have never been visible to other threads and are thus
+     *  reclaimed immediately. */
+    void free_local_except(block<K, V, Compare> *that)
+    {
+        bool contains_that = false;
+        for (auto b : m_local) {
+            if (b == that) {
+                contains_that = true;
+            } else {
+                reclaim(b);
+            }
+        }
+
+        m_local.clear();
+        if (contains_that) {
+            m_local.push_back(that);
+        }
+    }
+
+    bool contains(const block<K, V, Compare> *block) const {
+        return (std::find(m_local.begin(), m_local.end(), block) != m_local.end());
+    }
+
+    /** Frees all blocks kept for reuse and returns the number of bytes
+     *  thereby released (memory of paged blocks has already been released
+     *  by reclaim()). */
+    size_t trim()
+    {
+        size_t released = 0;
+        for (int i = 0; i < MAX_POWER_OF_2; i++) {
+            for (auto b : m_free[i]) {
+                if (!b->paged()) {
+                    released += b->bytes();
+                }
+                delete b;
+            }
+            m_free[i].clear();
+        }
+        return released;
+    }
+
+private:
+    void reclaim(block<K, V, Compare> *b)
+    {
+        auto &free = m_free[b->power_of_2()];
+        const bool keep = b->paged()
+                ? free.size() < FREE_PAGED_BLOCKS_PER_LEVEL
+                : (free.size() < FREE_BLOCKS_PER_LEVEL
+                   || free.size() * b->bytes() < FREE_BYTES_PER_LEVEL);
+        if (keep) {
+            b->release();
+            free.push_back(b);
+        } else {
+            COUNT_INC(freed_blocks);
+            delete b;
+        }
+    }
+
+private:
+    /** The resource new blocks are allocated from. Blocks are freed into
+     *  the resource they were allocated from, regardless of the pool which
+     *  reclaims them. */
+    memory_resource *m_resource;
+
+    /** Blocks allocated during the current insert which have not been
+     *  published yet. */
+    std::vector<block<K, V, Compare> *> m_local;
+    /** Local blocks which may still be read by another thread, see park(). */
+    std::vector<block<K, V, Compare> *> m_parked;
+    /** Blocks removed from the global array by this thread, stamped with
+     *  the epoch of their removal. */
+    std::vector<retired_block> m_retired;
+    std::vector<block<K, V, Compare> *> m_free[MAX_POWER_OF_2];
+};
+
+#endif /* ENABLE_EPOCH_RECLAMATION */
+
 }
 
 #endif /* __BLOCK_POOL_H */
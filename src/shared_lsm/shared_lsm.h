@@ -20,6 +20,7 @@
 #ifndef __SHARED_LSM_H
 #define __SHARED_LSM_H
 
+#include "components/relaxation.h"
 #include "util/mm.h"
 #include "util/thread_local_ptr.h"
 #include "block_array.h"
@@ -37,26 +38,99 @@ namespace kpq {
  * TODO: Logical (instead of physical) shrinking of blocks.
  */
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare = std::less<K>>
 class shared_lsm {
 public:
-    shared_lsm();
-    virtual ~shared_lsm() { }
+    /** All blocks, items and block arrays are allocated from resource. */
+    explicit shared_lsm(memory_resource *resource = get_default_resource());
+    /** Sets the initial relaxation bound. Unless Rlx is DYNAMIC_RELAXATION,
+     *  it must equal Rlx. */
+    explicit shared_lsm(const int relaxation,
+                        memory_resource *resource = get_default_resource());
+    virtual ~shared_lsm();
 
     void insert(const K &key);
     void insert(const K &key,
                 const V &val);
-    void insert(block<K, V> *b);
+    /** Inserts the items of b. Blocks returned by get_block() are inserted
+     *  as is, while all other blocks are copied. */
+    void insert(block<K, V, Compare> *b);
+
+    /** Returns a block of capacity 2^i from the calling thread's pool, which
+     *  lets callers build a block in place instead of having it copied. It
+     *  must be passed to insert() before any other operation of this thread
+     *  on the shared lsm. */
+    block<K, V, Compare> *get_block(const size_t i);
+
+    /** Inserts all (key, value) pairs in [first, last) as a single block,
+     *  requiring only a single update of the global array. */
+    template <class ForwardIterator>
+    void insert_bulk(ForwardIterator first,
+                     ForwardIterator last);
 
     bool delete_min(V &val);
-    void find_min(typename block<K, V>::peek_t &best);
+    void find_min(typename block<K, V, Compare>::peek_t &best);
+
+    /** Takes best, which has been returned by find_min(). Losing it to
+     *  another thread counts as contention for adaptive relaxation, as it
+     *  does within delete_min(). Used by the k-lsm's delete_min(). */
+    bool take(typename block<K, V, Compare>::peek_t &best,
+              K &key,
+              V &val);
+
+    /** Stores the (relaxed) minimal key in key without removing its item.
+     *  Returns false if the shared lsm appears to be empty. */
+    bool peek_min(K &key);
+
+    /** Stores up to n keys of the pivot range in ascending order in keys
+     *  and returns their number. This is a best-effort snapshot: items may
+     *  be taken concurrently, and no items are removed. */
+    size_t top_k(K *keys,
+                 const size_t n);
+
+    /** Removes up to n items from the pivot range within a single pass and
+     *  returns the number of removed items. */
+    size_t delete_min_batch(K *keys,
+                            V *vals,
+                            const size_t n);
+
+    /** Used by the k-lsm's delete_min_batch(). See shared_lsm_local. */
+    template <class Merge>
+    size_t add_candidates(Merge &merge);
+    template <class Merge>
+    void consume_candidates(const Merge &merge,
+                            const size_t first_range_ix);
+
+    /** Returns the memory of the calling thread's reusable items and blocks
+     *  to the OS and returns the number of released bytes. See
+     *  dist_lsm::trim(). */
+    size_t trim();
+
+    /** The relaxation bound may be changed at any time if Rlx is
+     *  DYNAMIC_RELAXATION. Operations in progress may still observe the
+     *  previous bound. */
+    int relaxation() const { return m_relaxation.get(); }
+    void set_relaxation(const int relaxation) { m_relaxation.set_range(relaxation, relaxation); }
+
+    /** Lets the relaxation bound adapt to contention within [min, max]: it is
+     *  raised while threads conflict on the global array and lowered again
+     *  once they stop doing so. Disabled by set_relaxation(). */
+    void set_adaptive_relaxation(const int min,
+                                 const int max) { m_relaxation.set_range(min, max); }
+
+    /** Shared lsm blocks may only be accessed within a critical section of
+     *  this domain. Public operations enter it themselves; callers only need
+     *  to do so if they keep blocks referenced across operations (e.g.,
+     *  between add_candidates() and consume_candidates()). */
+    epoch_domain &epochs() { return m_global_array.epochs(); }
 
     void init_thread(const size_t) const { }
     constexpr static bool supports_concurrency() { return true; }
 
 private:
-    versioned_array_ptr<K, V, Rlx> m_global_array;
-    thread_local_ptr<shared_lsm_local<K, V, Rlx>> m_local_component;
+    versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> m_global_array;
+    thread_local_ptr<shared_lsm_local<K, V, Rlx, Compare>> m_local_component;
+    kpq::relaxation<Rlx> m_relaxation;
 };
 
 #include "shared_lsm_inl.h"
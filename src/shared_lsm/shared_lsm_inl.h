@@ -17,47 +17,177 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V, int Rlx>
-shared_lsm<K, V, Rlx>::shared_lsm()
+template <class K, class V, int Rlx, class Compare>
+shared_lsm<K, V, Rlx, Compare>::shared_lsm(memory_resource *resource) :
+    m_global_array(resource),
+    m_local_component(resource)
 {
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+shared_lsm<K, V, Rlx, Compare>::shared_lsm(const int relaxation,
+                                           memory_resource *resource) :
+    m_global_array(resource),
+    m_local_component(resource),
+    m_relaxation(relaxation)
+{
+}
+
+template <class K, class V, int Rlx, class Compare>
+shared_lsm<K, V, Rlx, Compare>::~shared_lsm()
+{
+#ifdef ENABLE_EPOCH_RECLAMATION
+    /* Blocks of the global array are owned by the array, see block_pool. */
+    auto array = m_global_array.load();
+    for (size_t i = 0; i < array->m_size; i++) {
+        delete array->m_blocks[i];
+    }
+#endif
+}
+
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm<K, V, Rlx>::insert(const K &key)
+shared_lsm<K, V, Rlx, Compare>::insert(const K &key)
 {
-    insert(key, key);
+    insert(key, value_of_key<K, V>::get(key));
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm<K, V, Rlx>::insert(const K &key,
-                              const V &val)
+shared_lsm<K, V, Rlx, Compare>::insert(const K &key,
+                                       const V &val)
+{
+    epoch_guard guard(m_global_array.epochs());
+    auto local = m_local_component.get();
+    local->insert(key, val, m_global_array, m_relaxation);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+shared_lsm<K, V, Rlx, Compare>::insert(block<K, V, Compare> *b)
+{
+    epoch_guard guard(m_global_array.epochs());
+    auto local = m_local_component.get();
+    local->insert(b, m_global_array, m_relaxation);
+}
+
+template <class K, class V, int Rlx, class Compare>
+block<K, V, Compare> *
+shared_lsm<K, V, Rlx, Compare>::get_block(const size_t i)
 {
     auto local = m_local_component.get();
-    local->insert(key, val, m_global_array);
+    return local->get_block(i);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+template <class ForwardIterator>
 void
-shared_lsm<K, V, Rlx>::insert(block<K, V> *b)
+shared_lsm<K, V, Rlx, Compare>::insert_bulk(ForwardIterator first,
+                                            ForwardIterator last)
 {
+    epoch_guard guard(m_global_array.epochs());
     auto local = m_local_component.get();
-    local->insert(b, m_global_array);
+    local->insert_bulk(first, last, m_global_array, m_relaxation);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-shared_lsm<K, V, Rlx>::delete_min(V &val)
+shared_lsm<K, V, Rlx, Compare>::delete_min(V &val)
+{
+    epoch_guard guard(m_global_array.epochs());
+    auto local = m_local_component.get();
+    return local->delete_min(val, m_global_array, m_relaxation);
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+shared_lsm<K, V, Rlx, Compare>::delete_min_batch(K *keys,
+                                                 V *vals,
+                                                 const size_t n)
+{
+    epoch_guard guard(m_global_array.epochs());
+    auto local = m_local_component.get();
+    const size_t taken = local->delete_min_batch(keys, vals, n, m_global_array, m_relaxation);
+    COUNT_ADD(batch_deletes, taken);
+    return taken;
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
+size_t
+shared_lsm<K, V, Rlx, Compare>::add_candidates(Merge &merge)
 {
+    epoch_guard guard(m_global_array.epochs());
     auto local = m_local_component.get();
-    return local->delete_min(val, m_global_array);
+    return local->add_candidates(merge, m_global_array, m_relaxation);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
 void
-shared_lsm<K, V, Rlx>::find_min(typename block<K, V>::peek_t &best)
+shared_lsm<K, V, Rlx, Compare>::consume_candidates(const Merge &merge,
+                                                   const size_t first_range_ix)
+{
+    epoch_guard guard(m_global_array.epochs());
+    auto local = m_local_component.get();
+    local->consume_candidates(merge, first_range_ix);
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+shared_lsm<K, V, Rlx, Compare>::find_min(typename block<K, V, Compare>::peek_t &best)
+{
+    epoch_guard guard(m_global_array.epochs());
+    auto local = m_local_component.get();
+    local->peek(best, m_global_array, m_relaxation);
+}
+
+template <class K, class V, int Rlx, class Compare>
+bool
+shared_lsm<K, V, Rlx, Compare>::take(typename block<K, V, Compare>::peek_t &best,
+                                     K &key,
+                                     V &val)
+{
+    const bool taken = best.take(key, val);
+    if (!taken) {
+        m_local_component.get()->adapt(true, m_relaxation);
+    }
+
+    return taken;
+}
+
+template <class K, class V, int Rlx, class Compare>
+bool
+shared_lsm<K, V, Rlx, Compare>::peek_min(K &key)
+{
+    typename block<K, V, Compare>::peek_t best = block<K, V, Compare>::peek_t::EMPTY();
+    find_min(best);
+
+    if (best.empty()) {
+        return false;
+    }
+
+    key = best.m_key;
+    return true;
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+shared_lsm<K, V, Rlx, Compare>::top_k(K *keys,
+                                      const size_t n)
+{
+    /* Candidates are added to the merge, but never consumed. */
+
+    epoch_guard guard(m_global_array.epochs());
+    multiway_merge<K, V, block_array<K, V, Rlx, Compare>::MAX_BLOCKS, Compare> merge;
+    add_candidates(merge);
+    return merge.peek(keys, n);
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+shared_lsm<K, V, Rlx, Compare>::trim()
 {
     auto local = m_local_component.get();
-    local->peek(best, m_global_array);
+    return local->trim();
 }
@@ -21,7 +21,12 @@
 #define __SHARED_LSM_LOCAL_H
 
 #include <atomic>
+#include <iterator>
+#include <vector>
 
+#include "components/multiway_merge.h"
+#include "components/relaxation.h"
+#include "util/backoff.h"
 #include "util/mm.h"
 #include "block_array.h"
 #include "block_pool.h"
@@ -29,61 +34,134 @@
 
 namespace kpq {
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare = std::less<K>>
 class shared_lsm_local {
-    template <class X, class Y, int Z>
+    template <class X, class Y, int Z, class C>
     friend class shared_lsm;
 public:
-    shared_lsm_local();
+    /** Blocks, items and block arrays are allocated from resource. */
+    explicit shared_lsm_local(memory_resource *resource = get_default_resource());
     virtual ~shared_lsm_local() { }
 
     void insert(const K &key,
                 const V &val,
-                versioned_array_ptr<K, V, Rlx> &global_array);
-    void insert(block<K, V> *b,
-                versioned_array_ptr<K, V, Rlx> &global_array);
+                versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                relaxation<Rlx> &rlx);
+    void insert(block<K, V, Compare> *b,
+                versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                relaxation<Rlx> &rlx);
+    template <class ForwardIterator>
+    void insert_bulk(ForwardIterator first,
+                     ForwardIterator last,
+                     versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                     relaxation<Rlx> &rlx);
+
+    /** See shared_lsm::get_block(). */
+    block<K, V, Compare> *get_block(const size_t i) { return m_block_pool.get_block(i); }
 
     bool delete_min(V &val,
-                    versioned_array_ptr<K, V, Rlx> &global_array);
-    void peek(typename block<K, V>::peek_t &best,
-              versioned_array_ptr<K, V, Rlx> &global_array);
+                    versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                    relaxation<Rlx> &rlx);
+    void peek(typename block<K, V, Compare>::peek_t &best,
+              versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+              relaxation<Rlx> &rlx);
+
+    /** Claims up to n items from the pivot range in ascending key order and
+     *  returns the number of claimed items. */
+    size_t delete_min_batch(K *keys,
+                            V *vals,
+                            const size_t n,
+                            versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                            relaxation<Rlx> &rlx);
+
+    /** Refreshes the local array copy and adds its pivot ranges to merge.
+     *  Returns the index of the first added range. */
+    template <class Merge>
+    size_t add_candidates(Merge &merge,
+                          versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                          relaxation<Rlx> &rlx);
+    template <class Merge>
+    void consume_candidates(const Merge &merge,
+                            const size_t first_range_ix);
+
+    /** Releases the memory of reusable items and of blocks which are no
+     *  longer part of the global array to the OS and returns the number of
+     *  released bytes. */
+    size_t trim();
 
 private:
+    typedef typename versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare>::packed_t packed_t;
+
     /** The internal function responsible for actual insertion. The given
      *  block must have been allocated by the shared lsm. */
-    void insert_block(block<K, V> *b,
-                      versioned_array_ptr<K, V, Rlx> &global_array);
+    void insert_block(block<K, V, Compare> *b,
+                      versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                      relaxation<Rlx> &rlx);
+
+    /** Posts b to the combiner and waits a bounded time for another thread
+     *  to publish it. Returns false if b could not be posted, or if it has
+     *  been withdrawn since it was not published in time. b is replaced by a
+     *  copy if its claimer may still read it, and parked until it no longer
+     *  does. */
+    bool publish_through(block<K, V, Compare> *&b,
+                         block_combiner<K, V, Compare> &combiner);
+
+    /** Returns parked blocks whose claimers have finished reading them to
+     *  the block pool. */
+    void unpark_blocks(block_combiner<K, V, Compare> &combiner);
 
     /** Refreshes the local array copy and ensures that it is both up to date
      *  and consistent. observed_packed and observed_version are set to the
      *  corresponding values used to perform the copy. */
-    void refresh_local_array_copy(block_array<K, V, Rlx> *&observed_packed,
+    void refresh_local_array_copy(packed_t &observed_packed,
                                   version_t &observed_version,
-                                  versioned_array_ptr<K, V, Rlx> &global_array);
+                                  versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array);
+
+    bool local_array_copy_is_fresh(versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array) const;
 
-    bool local_array_copy_is_fresh(versioned_array_ptr<K, V, Rlx> &global_array) const;
+    /** Records the outcome of an operation on the global array and adapts
+     *  the relaxation bound accordingly (if it is adaptive). */
+    void adapt(const bool contended,
+               relaxation<Rlx> &rlx);
 
 private:
     /** Caches the previously peeked item in case we can short-circuit and simply
      *  return it. */
-    typename block<K, V>::peek_t m_cached_best;
+    typename block<K, V, Compare>::peek_t m_cached_best;
+
+    /** Contention observed by this thread, used for adaptive relaxation. */
+    contention_stats m_contention;
 
     /* ---- Item memory management. ---- */
 
-    item_allocator<item<K, V>, typename item<K, V>::reuse> m_item_pool;
+    item_allocator_of<K, V> m_item_pool;
 
     /* ---- Block memory management. ---- */
 
-    block_pool<K, V> m_block_pool;
+    block_pool<K, V, Compare> m_block_pool;
+
+    /** Blocks withdrawn from the combiner while being merged by another
+     *  thread, which are not reused before their claimer frees the slot. At
+     *  most one per slot. */
+    struct parked_block {
+        int m_slot;
+        block<K, V, Compare> *m_block;
+    };
+    std::vector<parked_block> m_parked;
 
     /* ---- Block array memory management. ---- */
 
     /** Contains a copy of the global block array, updated regularly. */
-    block_array<K, V, Rlx> m_local_array_copy;
-
-    /** Local memory pools for use by block arrays. */
-    aligned_block_array<K, V, Rlx> m_array_pool_odds;
-    aligned_block_array<K, V, Rlx> m_array_pool_evens;
+    block_array<K, V, Rlx, Compare> m_local_array_copy;
+
+    /** Local memory pools for use by block arrays, alternating by version
+     *  parity. Readers detect reuse through the array version. Unlike
+     *  blocks, arrays are not reclaimed through epochs even with
+     *  ENABLE_EPOCH_RECLAMATION: every insert replaces the global array, and
+     *  while the epoch is stalled, retired arrays would pile up at that
+     *  rate. */
+    aligned_block_array<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> m_array_pool_odds;
+    aligned_block_array<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> m_array_pool_evens;
 };
 
 #include "shared_lsm_local_inl.h"
@@ -17,18 +17,23 @@
  *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-template <class K, class V, int Rlx>
-shared_lsm_local<K, V, Rlx>::shared_lsm_local() :
-    m_cached_best(block<K, V>::peek_t::EMPTY())
+template <class K, class V, int Rlx, class Compare>
+shared_lsm_local<K, V, Rlx, Compare>::shared_lsm_local(memory_resource *resource) :
+    m_cached_best(block<K, V, Compare>::peek_t::EMPTY()),
+    m_item_pool(resource),
+    m_block_pool(resource),
+    m_array_pool_odds(resource),
+    m_array_pool_evens(resource)
 {
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm_local<K, V, Rlx>::insert(
+shared_lsm_local<K, V, Rlx, Compare>::insert(
         const K &key,
         const V &val,
-        versioned_array_ptr<K, V, Rlx> &global_array)
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
 {
     auto i = m_item_pool.acquire();
     i->initialize(key, val);
@@ -38,36 +43,105 @@ shared_lsm_local<K, V, Rlx>::insert(
     auto b = m_block_pool.get_block(1);
     b->insert(i, i->version());
 
-    insert_block(b, global_array);
+    insert_block(b, global_array, rlx);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm_local<K, V, Rlx>::insert(
-        block<K, V> *b,
-        versioned_array_ptr<K, V, Rlx> &global_array)
+shared_lsm_local<K, V, Rlx, Compare>::insert(
+        block<K, V, Compare> *b,
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
 {
-    assert(!m_block_pool.contains(b)), "Not called with a dist lsm block";
+    if (m_block_pool.contains(b)) {
+        /* Allocated through get_block(), no need to copy. */
+        insert_block(b, global_array, rlx);
+        return;
+    }
 
     auto c = m_block_pool.get_block(b->power_of_2());
     c->copy(b);
+    COUNT_ADD(slsm_copied_items, c->size());
+
+    insert_block(c, global_array, rlx);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class ForwardIterator>
+void
+shared_lsm_local<K, V, Rlx, Compare>::insert_bulk(
+        ForwardIterator first,
+        ForwardIterator last,
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
+{
+    const size_t n = std::distance(first, last);
+    if (n == 0) {
+        return;
+    }
 
-    insert_block(c, global_array);
+    auto b = m_block_pool.get_block(std::max<size_t>(1, block<K, V, Compare>::power_of_2_for(n)));
+    for (auto it = first; it != last; ++it) {
+        auto i = m_item_pool.acquire();
+        i->initialize(it->first, it->second);
+        b->insert_tail(i, i->version());
+    }
+    b->sort();
+
+    insert_block(b, global_array, rlx);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm_local<K, V, Rlx>::insert_block(
-        block<K, V> *b,
-        versioned_array_ptr<K, V, Rlx> &global_array)
+shared_lsm_local<K, V, Rlx, Compare>::insert_block(
+        block<K, V, Compare> *b,
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
 {
     assert(m_block_pool.contains(b)), "Given block not allocated by shared lsm";
     COUNT_INC(slsm_inserts);
 
+    typedef block_combiner<K, V, Compare> combiner_t;
+    auto &combiner = global_array.combiner();
+    block<K, V, Compare> *claimed[combiner_t::NUM_SLOTS];
+    int claimed_slots[combiner_t::NUM_SLOTS];
+    size_t nclaimed = 0;
+
+    backoff retry_backoff;
+    bool contended = false;
+    bool posted = false;
     while (true) {
+        /* Merge blocks which other threads failed to publish into ours. Once
+         * we have confirmed blocks, we are responsible for publishing them. */
+
+        size_t nconfirmed = nclaimed;
+        const size_t n = combiner.claim(claimed + nclaimed,
+                                        claimed_slots + nclaimed,
+                                        combiner_t::NUM_SLOTS - nclaimed);
+        for (size_t i = nclaimed; i < nclaimed + n; i++) {
+            auto merged = m_block_pool.get_block(
+                    block<K, V, Compare>::power_of_2_for(b->size() + claimed[i]->size()));
+            merged->merge(b, claimed[i]);
+
+            /* The poster may have withdrawn its block while we merged it. */
+
+            if (!combiner.confirm(claimed_slots[i], claimed[i])) {
+                m_block_pool.free_local_except(b);
+                continue;
+            }
+
+            m_block_pool.free_local_except(merged);
+            b = merged;
+            claimed[nconfirmed] = claimed[i];
+            claimed_slots[nconfirmed] = claimed_slots[i];
+            nconfirmed++;
+        }
+        COUNT_ADD(slsm_combined_blocks, nconfirmed - nclaimed);
+        nclaimed = nconfirmed;
+
         /* Fetch a consistent copy of the global array. */
 
-        block_array<K, V, Rlx> *observed_packed;
+        packed_t observed_packed;
         version_t observed_version;
         refresh_local_array_copy(observed_packed, observed_version, global_array);
 
@@ -78,8 +152,10 @@ shared_lsm_local<K, V, Rlx>::insert_block(
                 : m_array_pool_odds;
         auto new_blocks_ptr = new_blocks.ptr();
         new_blocks_ptr->copy_from(&m_local_array_copy);
+        new_blocks_ptr->set_relaxation(rlx);
         new_blocks_ptr->increment_version();
         new_blocks_ptr->insert(b, &m_block_pool);
+        new_blocks_ptr->stamp_changes();
 
         /* Try to update the global array. */
 
@@ -89,35 +165,120 @@ shared_lsm_local<K, V, Rlx>::insert_block(
             m_block_pool.publish(new_blocks_ptr->m_blocks,
                                  new_blocks_ptr->m_size,
                                  new_blocks_ptr->version());
+            m_block_pool.retire(m_local_array_copy.m_blocks,
+                                m_local_array_copy.m_size,
+                                new_blocks_ptr->m_blocks,
+                                new_blocks_ptr->m_size,
+                                global_array.epochs());
             m_block_pool.free_local();
+            const size_t nreleased = combiner.release(claimed, claimed_slots, nclaimed);
+            COUNT_ADD(slsm_duplicated_blocks, nclaimed - nreleased);
             break;
         }
 
         COUNT_INC(slsm_insert_retries);
         m_block_pool.free_local_except(b);
+        contended = true;
+
+        /* Instead of redoing the merge ourselves, let the next successful
+         * inserter publish our block. Our block is offered only once, if it
+         * is withdrawn we retry on our own and back off instead. */
+
+        if (nclaimed == 0 && !posted) {
+            posted = true;
+            if (publish_through(b, combiner)) {
+                m_block_pool.free_local();
+                break;
+            }
+            continue;
+        }
+        retry_backoff.pause();
     }
+
+    adapt(contended, rlx);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-shared_lsm_local<K, V, Rlx>::delete_min(
+shared_lsm_local<K, V, Rlx, Compare>::publish_through(
+        block<K, V, Compare> *&b,
+        block_combiner<K, V, Compare> &combiner)
+{
+    unpark_blocks(combiner);
+
+    const int slot = combiner.post(b);
+    if (slot == -1) {
+        return false;
+    }
+
+    /* Wait for a bounded time only, the claimer might be delayed indefinitely.
+     * If our block has already been merged, we publish it ourselves as well. */
+
+    bool merging = false;
+    if (combiner.wait_published(slot, b, merging)) {
+        return true;
+    }
+
+    /* The claimer may still be reading b, continue with a copy. */
+
+    if (merging) {
+        auto copy = m_block_pool.get_block(b->power_of_2());
+        copy->copy(b);
+        m_block_pool.park(b);
+        m_parked.push_back({ slot, b });
+        b = copy;
+    }
+
+    return false;
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+shared_lsm_local<K, V, Rlx, Compare>::unpark_blocks(
+        block_combiner<K, V, Compare> &combiner)
+{
+    for (size_t i = 0; i < m_parked.size(); ) {
+        const auto &p = m_parked[i];
+        if (combiner.withdrawn(p.m_slot, p.m_block)) {
+            i++;
+            continue;
+        }
+
+        m_block_pool.unpark(p.m_block);
+        m_parked[i] = m_parked.back();
+        m_parked.pop_back();
+    }
+}
+
+template <class K, class V, int Rlx, class Compare>
+bool
+shared_lsm_local<K, V, Rlx, Compare>::delete_min(
         V &val,
-        versioned_array_ptr<K, V, Rlx> &global_array)
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
 {
-    typename block<K, V>::peek_t best = block<K, V>::peek_t::EMPTY();
-    peek(best, global_array);
+    typename block<K, V, Compare>::peek_t best = block<K, V, Compare>::peek_t::EMPTY();
+    peek(best, global_array, rlx);
 
     if (best.m_item == nullptr) {
         return false;  /* We did our best, give up. */
     }
 
-    return best.m_item->take(best.m_version, val);
+    /* Losing the item to another thread is a sign of contention. */
+
+    const bool taken = best.take(val);
+    if (!taken) {
+        adapt(true, rlx);
+    }
+
+    return taken;
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm_local<K, V, Rlx>::peek(typename block<K, V>::peek_t &best,
-                                  versioned_array_ptr<K, V, Rlx> &global_array)
+shared_lsm_local<K, V, Rlx, Compare>::peek(typename block<K, V, Compare>::peek_t &best,
+                                           versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+                                           relaxation<Rlx> &rlx)
 {
     if (local_array_copy_is_fresh(global_array)
             && !m_cached_best.empty()
@@ -127,31 +288,121 @@ shared_lsm_local<K, V, Rlx>::peek(typename block<K, V>::peek_t &best,
         return;
     }
 
-    block_array<K, V, Rlx> *observed_packed;
+    packed_t observed_packed;
     version_t observed_version;
 
+    /* A concurrent modification of the global array during our peek is a sign
+     * of contention. */
+
+    bool contended = false;
+
     COUNT_INC(slsm_peeks_performed);
-    do {
+    while (true) {
         refresh_local_array_copy(observed_packed, observed_version, global_array);
+        m_local_array_copy.set_relaxation(rlx);
         best = m_cached_best = m_local_array_copy.peek();
         COUNT_INC(slsm_peek_attempts);
-    } while (global_array.version() != observed_version);
+
+        if (global_array.version() == observed_version) {
+            break;
+        }
+        contended = true;
+    }
+
+    adapt(contended, rlx);
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+shared_lsm_local<K, V, Rlx, Compare>::delete_min_batch(
+        K *keys,
+        V *vals,
+        const size_t n,
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
+{
+    size_t taken = 0;
+    while (taken < n) {
+        multiway_merge<K, V, block_array<K, V, Rlx, Compare>::MAX_BLOCKS, Compare> merge;
+        const size_t first_range_ix = add_candidates(merge, global_array, rlx);
+
+        if (merge.items() == 0) {
+            break;
+        }
+
+        taken += merge.take(keys + taken, vals + taken, n - taken);
+        consume_candidates(merge, first_range_ix);
+    }
+
+    return taken;
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
+size_t
+shared_lsm_local<K, V, Rlx, Compare>::add_candidates(
+        Merge &merge,
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array,
+        relaxation<Rlx> &rlx)
+{
+    packed_t observed_packed;
+    version_t observed_version;
+    refresh_local_array_copy(observed_packed, observed_version, global_array);
+
+    m_local_array_copy.set_relaxation(rlx);
+    return m_local_array_copy.add_candidates(merge);
+}
+
+template <class K, class V, int Rlx, class Compare>
+template <class Merge>
+void
+shared_lsm_local<K, V, Rlx, Compare>::consume_candidates(const Merge &merge,
+                                                         const size_t first_range_ix)
+{
+    m_local_array_copy.consume_candidates(merge, first_range_ix);
+}
+
+template <class K, class V, int Rlx, class Compare>
+size_t
+shared_lsm_local<K, V, Rlx, Compare>::trim()
+{
+    const size_t released = m_item_pool.trim() + m_block_pool.trim();
+    COUNT_ADD(trimmed_bytes, released);
+    return released;
+}
+
+template <class K, class V, int Rlx, class Compare>
+void
+shared_lsm_local<K, V, Rlx, Compare>::adapt(const bool contended,
+                                            relaxation<Rlx> &rlx)
+{
+    if (!rlx.adaptive()) {
+        return;
+    }
+
+    if (contended) {
+        m_contention.contended();
+    } else {
+        m_contention.uncontended();
+    }
+
+    rlx.adapt(m_contention);
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 bool
-shared_lsm_local<K, V, Rlx>::local_array_copy_is_fresh(
-        versioned_array_ptr<K, V, Rlx> &global_array) const
+shared_lsm_local<K, V, Rlx, Compare>::local_array_copy_is_fresh(
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array) const
 {
     return (m_local_array_copy.version() == global_array.version());
 }
 
-template <class K, class V, int Rlx>
+template <class K, class V, int Rlx, class Compare>
 void
-shared_lsm_local<K, V, Rlx>::refresh_local_array_copy(
-        block_array<K, V, Rlx> *&observed_packed,
+shared_lsm_local<K, V, Rlx, Compare>::refresh_local_array_copy(
+        packed_t &observed_packed,
         version_t &observed_version,
-        versioned_array_ptr<K, V, Rlx> &global_array)
+        versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare> &global_array)
 {
     observed_packed = global_array.load_packed();
     auto observed_unpacked = global_array.unpack(observed_packed);
@@ -161,12 +412,24 @@ shared_lsm_local<K, V, Rlx>::refresh_local_array_copy(
         return;
     }
 
+    /* Usually, only few blocks have changed since our previous copy. */
+
+    if (versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare>::matches(observed_packed,
+                                                                            observed_version)
+            && m_local_array_copy.update_from(observed_unpacked)
+            && global_array.version() == observed_version
+            && observed_version == m_local_array_copy.version()) {
+        COUNT_INC(slsm_array_updates);
+        return;
+    }
+
+    COUNT_INC(slsm_array_copies);
     while (true) {
         observed_packed = global_array.load_packed();
         observed_unpacked = global_array.unpack(observed_packed);
         observed_version = observed_unpacked->version();
 
-        if (!versioned_array_ptr<K, V, Rlx>::matches(observed_packed,
+        if (!versioned_array_ptr<K, V, Rlx, DEFAULT_ALIGNMENT, Compare>::matches(observed_packed,
                                                             observed_version)) {
             continue;
         }
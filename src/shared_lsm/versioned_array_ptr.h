@@ -21,48 +21,98 @@
 #define __VERSIONED_ARRAY_PTR_H
 
 #include <atomic>
+#include <cstring>
 
+#include "util/epoch.h"
 #include "aligned_block_array.h"
 #include "block_array.h"
+#include "block_combiner.h"
 
 namespace kpq {
 
-template <class K, class V, int Rlx, int Algn = DEFAULT_ALIGNMENT>
+/**
+ * The global array pointer, which is tagged with the version of the array in
+ * order to avoid the ABA problem. By default, the lowest log2(Algn) bits of
+ * the version are packed into the pointer itself, which thus only detects
+ * ABA modulo Algn. With ENABLE_WIDE_CAS, the pointer is instead paired with
+ * a 64 bit version and both are updated through a double-width CAS, which
+ * requires neither aligned arrays nor probabilistic matching.
+ */
+template <class K, class V, int Rlx, int Algn = DEFAULT_ALIGNMENT, class Compare = std::less<K>>
 class versioned_array_ptr {
 public:
-    versioned_array_ptr();
+#ifndef ENABLE_WIDE_CAS
+    typedef block_array<K, V, Rlx, Compare> *packed_t;
+#else
+    struct packed_t {
+        block_array<K, V, Rlx, Compare> *m_ptr;
+        uint64_t m_version;
+    };
+#endif
+
+    /** The initial block array and per-thread epoch records are allocated
+     *  from resource. */
+    explicit versioned_array_ptr(memory_resource *resource = get_default_resource());
     virtual ~versioned_array_ptr();
 
     /* Interface subject to change. */
-    block_array<K, V, Rlx> *load();
-    block_array<K, V, Rlx> *load_packed();
+    block_array<K, V, Rlx, Compare> *load();
+    packed_t load_packed();
+    /** desired must be the successor version of expected_packed. */
     bool compare_exchange_strong(
-            block_array<K, V, Rlx> *&expected_packed,
-            aligned_block_array<K, V, Rlx, Algn> &desired);
+            packed_t &expected_packed,
+            aligned_block_array<K, V, Rlx, Algn, Compare> &desired);
 
     version_t version();
 
-    block_array<K, V, Rlx> *unpack(block_array<K, V, Rlx> *ptr)
+    block_array<K, V, Rlx, Compare> *unpack(packed_t ptr)
     {
         return unpacked_ptr(ptr);
     }
 
     /** Returns true, iff the packed version in ptr possibly matches the
-     *  given version. */
-    static bool matches(block_array<K, V, Rlx> *ptr,
+     *  given version (exactly so with ENABLE_WIDE_CAS). */
+    static bool matches(packed_t ptr,
                         version_t version);
 
+    /** Protects blocks reachable through the global array, see block_pool. */
+    epoch_domain &epochs() { return m_epochs; }
+
+    /** Collects blocks of inserts which failed to update the pointer. */
+    block_combiner<K, V, Compare> &combiner() { return m_combiner; }
+
 private:
-    static block_array<K, V, Rlx> *packed_ptr(block_array<K, V, Rlx> *ptr);
-    static block_array<K, V, Rlx> *unpacked_ptr(block_array<K, V, Rlx> *ptr);
+    static packed_t packed_ptr(block_array<K, V, Rlx, Compare> *ptr);
+    static block_array<K, V, Rlx, Compare> *unpacked_ptr(packed_t ptr);
 
 private:
+#ifndef ENABLE_WIDE_CAS
     constexpr static int MASK = Algn - 1;
 
-    std::atomic<block_array<K, V, Rlx> *> m_ptr;
+    std::atomic<block_array<K, V, Rlx, Compare> *> m_ptr;
+#else
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+#error "ENABLE_WIDE_CAS requires a double-width CAS (e.g., compile with -mcx16)"
+#endif
+    /** m_ptr is accessed as a whole through this type by the CAS. */
+    __extension__ typedef unsigned __int128 wide_t __attribute__((__may_alias__));
+    static_assert(sizeof(packed_t) == sizeof(wide_t), "packed_t must fill a wide CAS");
+
+    static wide_t to_wide(const packed_t &packed);
+    static packed_t from_wide(const wide_t &wide);
+
+    /** Both halves are read separately, and a consistent pair is detected
+     *  through the version, which is incremented by each update. Updates
+     *  replace both halves at once through a double-width CAS. */
+    alignas(16) packed_t m_ptr;
+#endif
 
     /** The block array used to initialize the global pointer. */
-    aligned_block_array<K, V, Rlx, Algn> m_initial_value;
+    aligned_block_array<K, V, Rlx, Algn, Compare> m_initial_value;
+
+    epoch_domain m_epochs;
+
+    block_combiner<K, V, Compare> m_combiner;
 };
 
 #include "versioned_array_ptr_inl.h"
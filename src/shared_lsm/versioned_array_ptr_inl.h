@@ -19,73 +19,176 @@
 
 #include <limits>
 
-template <class K, class V, int Rlx, int Algn>
-versioned_array_ptr<K, V, Rlx, Algn>::versioned_array_ptr()
+template <class K, class V, int Rlx, int Algn, class Compare>
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::~versioned_array_ptr()
 {
-    m_ptr = packed_ptr(m_initial_value.ptr());
 }
 
-template <class K, class V, int Rlx, int Algn>
-versioned_array_ptr<K, V, Rlx, Algn>::~versioned_array_ptr()
+template <class K, class V, int Rlx, int Algn, class Compare>
+block_array<K, V, Rlx, Compare> *
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::load()
 {
+    return unpacked_ptr(load_packed());
+}
+
+#ifndef ENABLE_WIDE_CAS
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::versioned_array_ptr(memory_resource *resource) :
+    m_initial_value(resource),
+    m_epochs(resource)
+{
+    m_ptr = packed_ptr(m_initial_value.ptr());
 }
 
-template <class K, class V, int Rlx, int Algn>
+template <class K, class V, int Rlx, int Algn, class Compare>
 bool
-versioned_array_ptr<K, V, Rlx, Algn>::matches(
-        block_array<K, V, Rlx> *ptr,
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::matches(
+        packed_t ptr,
         version_t version)
 {
     return ((intptr_t)ptr & MASK) == (version & MASK);
 }
 
-template <class K, class V, int Rlx, int Algn>
-block_array<K, V, Rlx> *
-versioned_array_ptr<K, V, Rlx, Algn>::packed_ptr(
-        block_array<K, V, Rlx> *ptr)
+template <class K, class V, int Rlx, int Algn, class Compare>
+typename versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_ptr(
+        block_array<K, V, Rlx, Compare> *ptr)
 {
     const intptr_t intptr = (intptr_t)ptr;
     assert((intptr & MASK) == 0);
-    return (block_array<K, V, Rlx> *)(intptr | (ptr->version() & MASK));
+    return (block_array<K, V, Rlx, Compare> *)(intptr | (ptr->version() & MASK));
 }
 
-template <class K, class V, int Rlx, int Algn>
-block_array<K, V, Rlx> *
-versioned_array_ptr<K, V, Rlx, Algn>::unpacked_ptr(
-        block_array<K, V, Rlx> *ptr)
+template <class K, class V, int Rlx, int Algn, class Compare>
+block_array<K, V, Rlx, Compare> *
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::unpacked_ptr(packed_t ptr)
 {
     const intptr_t intptr = (intptr_t)ptr;
-    return (block_array<K, V, Rlx> *)(intptr & ~MASK);
+    return (block_array<K, V, Rlx, Compare> *)(intptr & ~MASK);
 }
 
-template <class K, class V, int Rlx, int Algn>
-block_array<K, V, Rlx> *
-versioned_array_ptr<K, V, Rlx, Algn>::load()
-{
-    return unpacked_ptr(load_packed());
-}
-
-template <class K, class V, int Rlx, int Algn>
+template <class K, class V, int Rlx, int Algn, class Compare>
 version_t
-versioned_array_ptr<K, V, Rlx, Algn>::version()
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::version()
 {
     return load()->version();
 }
 
-template <class K, class V, int Rlx, int Algn>
-block_array<K, V, Rlx> *
-versioned_array_ptr<K, V, Rlx, Algn>::load_packed()
+template <class K, class V, int Rlx, int Algn, class Compare>
+typename versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::load_packed()
 {
     return m_ptr.load(std::memory_order_relaxed);
 }
 
-template <class K, class V, int Rlx, int Algn>
+template <class K, class V, int Rlx, int Algn, class Compare>
 bool
-versioned_array_ptr<K, V, Rlx, Algn>::compare_exchange_strong(
-        block_array<K, V, Rlx> *&expected_packed,
-        aligned_block_array<K, V, Rlx, Algn> &desired)
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::compare_exchange_strong(
+        packed_t &expected_packed,
+        aligned_block_array<K, V, Rlx, Algn, Compare> &desired)
 {
     return m_ptr.compare_exchange_strong(expected_packed,
                                          packed_ptr(desired.ptr()),
                                          std::memory_order_relaxed);
 }
+
+#else /* ENABLE_WIDE_CAS */
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::versioned_array_ptr(memory_resource *resource) :
+    m_initial_value(resource),
+    m_epochs(resource)
+{
+    m_ptr = packed_ptr(m_initial_value.ptr());
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+typename versioned_array_ptr<K, V, Rlx, Algn, Compare>::wide_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::to_wide(const packed_t &packed)
+{
+    wide_t wide;
+    memcpy(&wide, &packed, sizeof(wide));
+    return wide;
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+typename versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::from_wide(const wide_t &wide)
+{
+    packed_t packed;
+    memcpy(&packed, &wide, sizeof(packed));
+    return packed;
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+bool
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::matches(
+        packed_t ptr,
+        version_t version)
+{
+    return ((version_t)ptr.m_version == version);
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+typename versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_ptr(
+        block_array<K, V, Rlx, Compare> *ptr)
+{
+    return { ptr, ptr->version() };
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+block_array<K, V, Rlx, Compare> *
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::unpacked_ptr(packed_t ptr)
+{
+    return ptr.m_ptr;
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+version_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::version()
+{
+    return (version_t)__atomic_load_n(&m_ptr.m_version, __ATOMIC_ACQUIRE);
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+typename versioned_array_ptr<K, V, Rlx, Algn, Compare>::packed_t
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::load_packed()
+{
+    packed_t packed;
+    uint64_t version;
+    do {
+        version = __atomic_load_n(&m_ptr.m_version, __ATOMIC_ACQUIRE);
+        packed.m_ptr = __atomic_load_n(&m_ptr.m_ptr, __ATOMIC_ACQUIRE);
+        packed.m_version = __atomic_load_n(&m_ptr.m_version, __ATOMIC_ACQUIRE);
+    } while (packed.m_version != version);
+
+    return packed;
+}
+
+template <class K, class V, int Rlx, int Algn, class Compare>
+bool
+versioned_array_ptr<K, V, Rlx, Algn, Compare>::compare_exchange_strong(
+        packed_t &expected_packed,
+        aligned_block_array<K, V, Rlx, Algn, Compare> &desired)
+{
+    /* The full version keeps counting beyond the range of version_t. */
+
+    const packed_t replacement = { desired.ptr(), expected_packed.m_version + 1 };
+    const wide_t expected = to_wide(expected_packed);
+
+    const wide_t observed =
+            __sync_val_compare_and_swap(reinterpret_cast<wide_t *>(&m_ptr),
+                                        expected,
+                                        to_wide(replacement));
+    if (observed == expected) {
+        assert((version_t)replacement.m_version == desired.ptr()->version());
+        return true;
+    }
+
+    expected_packed = from_wide(observed);
+    return false;
+}
+
+#endif /* ENABLE_WIDE_CAS */
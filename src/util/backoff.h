@@ -0,0 +1,88 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BACKOFF_H
+#define __BACKOFF_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+namespace kpq
+{
+
+/**
+ * Exponential backoff for retry loops on contended atomics. Each call to
+ * pause() waits twice as long as the previous one, up to MAX_SPINS busy
+ * iterations. Once that limit is reached, the thread yields instead of
+ * spinning.
+ */
+
+class backoff
+{
+public:
+    static constexpr size_t MIN_SPINS = 4;
+    static constexpr size_t MAX_SPINS = 1024;
+
+    backoff() :
+        m_spins(MIN_SPINS)
+    {
+    }
+
+    void pause()
+    {
+        if (exhausted()) {
+            std::this_thread::yield();
+            return;
+        }
+
+        for (size_t i = 0; i < m_spins; i++) {
+            cpu_relax();
+        }
+        m_spins *= 2;
+    }
+
+    /** Returns true once pause() has reached its maximal duration. */
+    bool exhausted() const
+    {
+        return m_spins > MAX_SPINS;
+    }
+
+    void reset()
+    {
+        m_spins = MIN_SPINS;
+    }
+
+private:
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+private:
+    size_t m_spins;
+};
+
+}
+
+#endif /* __BACKOFF_H */
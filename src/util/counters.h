@@ -28,20 +28,36 @@
     D(inserts) \
     D(successful_deletes) \
     D(failed_deletes) \
+    D(batch_deletes) /* Items removed through delete_min_batch(). */ \
+    D(decrease_keys) /* Successful decrease_key() calls. */ \
     D(slsm_inserts) /* Block inserts into shared lsm. */ \
     D(slsm_insert_retries) /* Block insert retries through concurrent modification. */ \
+    D(slsm_copied_items) /* Items copied from dist lsm blocks upon insertion into the shared lsm. */ \
+    D(slsm_combined_blocks) /* Blocks of other threads published along with our own. */ \
+    D(slsm_duplicated_blocks) /* Of these, blocks withdrawn and published by their poster as well. */ \
     D(slsm_deletes) \
     D(dlsm_deletes) \
     D(slsm_peek_cache_hit) /* Number of times the cached item is returned by the slsm. */ \
     D(slsm_peeks_performed) /* Number of times we got past the cached item. */ \
     D(slsm_peek_attempts) /* Number of actual block array peek() calls. */ \
+    D(slsm_array_copies) /* Full copies of the global array. */ \
+    D(slsm_array_updates) /* Refreshes of the local array copy which only copied changed blocks. */ \
+    D(slsm_updated_blocks) /* Blocks copied by such refreshes. */ \
     D(block_shrinks) \
     D(pivot_shrinks) \
     D(pivot_grows) \
     D(successful_peeks) \
     D(failed_peeks) \
     D(requested_spies) \
-    D(aborted_spies)
+    D(aborted_spies) \
+    D(local_spies) /* Successful spies on a thread of the same socket. */ \
+    D(remote_spies) /* Successful spies on a thread of another socket. */ \
+    D(spied_items) /* Item references copied by spies. */ \
+    D(dlsm_take_failures) /* Dist lsm items which were taken by another thread first. */ \
+    D(spied_take_failures) /* Of these, spied items (taken by their victim or another spy). */ \
+    D(migrated_blocks) /* Dist lsm blocks moved to the shared lsm on deregistration. */ \
+    D(trimmed_bytes) /* Memory returned to the OS by trim(). */ \
+    D(freed_blocks) /* Shared lsm blocks freed by epoch-based reclamation. */
 
 namespace kpq
 {
@@ -97,8 +113,10 @@ thread_local counters COUNTERS;
 
 #ifndef ENABLE_COUNTERS
 #define COUNT_INC(C)
+#define COUNT_ADD(C, N)
 #else
 #define COUNT_INC(C) kpq::COUNTERS.C++
+#define COUNT_ADD(C, N) kpq::COUNTERS.C += (N)
 #endif
 
 }
@@ -0,0 +1,172 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EPOCH_H
+#define __EPOCH_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+#include "thread_local_ptr.h"
+
+namespace kpq
+{
+
+#ifdef ENABLE_EPOCH_RECLAMATION
+
+/**
+ * Epoch-based reclamation (Fraser, "Practical lock-freedom", 2004).
+ *
+ * Threads access shared memory only between enter() and exit(), during which
+ * they announce the global epoch observed on entry. The global epoch is
+ * advanced by try_advance() once all threads within a critical section have
+ * observed it. Memory which has been unlinked from all shared structures
+ * during epoch e is no longer referenced once the global epoch has reached
+ * e + 2, and may then be reused or freed (see reclaimable()).
+ *
+ * Critical sections may be nested; only the outermost enter() and exit()
+ * calls take effect.
+ */
+
+class epoch_domain
+{
+public:
+    /** Per-thread records are allocated from resource. */
+    explicit epoch_domain(memory_resource *resource = get_default_resource()) :
+        m_epoch(0), m_records(resource) { }
+
+    void enter()
+    {
+        auto r = m_records.get();
+        if (r->m_nesting++ > 0) {
+            return;
+        }
+
+        const uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+        r->m_announced.store((epoch << 1) | ACTIVE, std::memory_order_relaxed);
+
+        /* Orders the announcement before all subsequent reads of shared
+         * memory. */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void exit()
+    {
+        auto r = m_records.get();
+        assert(r->m_nesting > 0);
+        if (--r->m_nesting > 0) {
+            return;
+        }
+
+        r->m_announced.store(0, std::memory_order_release);
+    }
+
+    /** Also orders all previous unlinks before the returned epoch, which
+     *  may thus be used to stamp retired memory. */
+    uint64_t current() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_relaxed);
+    }
+
+    /** Returns true if memory retired during epoch retired may be reclaimed
+     *  once the global epoch has reached current. */
+    static bool reclaimable(const uint64_t retired,
+                            const uint64_t current) { return retired + 2 <= current; }
+    bool reclaimable(const uint64_t retired) const { return reclaimable(retired, current()); }
+
+    /** Advances the global epoch if all threads within a critical section
+     *  have observed the current epoch, and returns true on success. */
+    bool try_advance()
+    {
+        uint64_t epoch = current();
+        for (size_t i = 0; i < m_records.num_threads(); i++) {
+            auto r = m_records.try_get(i);
+            if (r == nullptr) {
+                continue;
+            }
+
+            const uint64_t announced = r->m_announced.load(std::memory_order_seq_cst);
+            if ((announced & ACTIVE) && (announced >> 1) != epoch) {
+                return false;
+            }
+        }
+
+        return m_epoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+
+private:
+    static constexpr uint64_t ACTIVE = 1;
+
+    struct record {
+        record() : m_announced(0), m_nesting(0) { }
+
+        /** The announced epoch shifted left by one, combined with ACTIVE
+         *  while within a critical section. Read by all threads. */
+        std::atomic<uint64_t> m_announced;
+        /** Only accessed by the owning thread. */
+        uint32_t m_nesting;
+    };
+
+    std::atomic<uint64_t> m_epoch;
+    thread_local_ptr<record> m_records;
+};
+
+#else
+
+/** Without ENABLE_EPOCH_RECLAMATION, shared memory is never freed and
+ *  critical sections are not required. */
+class epoch_domain
+{
+public:
+    explicit epoch_domain(memory_resource * = get_default_resource()) { }
+
+    void enter() { }
+    void exit() { }
+};
+
+#endif /* ENABLE_EPOCH_RECLAMATION */
+
+/** Keeps the calling thread within a critical section of domain for the
+ *  lifetime of the guard. */
+class epoch_guard
+{
+public:
+    explicit epoch_guard(epoch_domain &domain) :
+        m_domain(domain)
+    {
+        m_domain.enter();
+    }
+
+    ~epoch_guard()
+    {
+        m_domain.exit();
+    }
+
+    epoch_guard(const epoch_guard &) = delete;
+    epoch_guard &operator=(const epoch_guard &) = delete;
+
+private:
+    epoch_domain &m_domain;
+};
+
+}
+
+#endif /* __EPOCH_H */
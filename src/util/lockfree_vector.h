@@ -22,21 +22,33 @@
 
 #include <atomic>
 #include <cassert>
+#include <new>
+#include <type_traits>
+
+#include "memory_resource.h"
 
 namespace kpq
 {
 
 /** A lock-free vector of dynamic size, capable of holding up to 2^bucket_count
- *  elements. Allocated memory is freed only on destruction. The amount of memory
- *  used is determined by the highest n passed to get(). */
+ *  elements. Buckets only hold pointers to elements, which are constructed
+ *  lazily on their first get(). Each element is allocated separately,
+ *  aligned to and padded to a multiple of the cache line size, so that
+ *  elements of different threads never share a cache line. Elements are
+ *  allocated from the given memory resource by the thread which first gets
+ *  them, usually their owner. Elements constructible from a memory resource
+ *  are passed the same resource for their own allocations. Allocated memory
+ *  is freed only on destruction. */
 
 template <class T>
 class lockfree_vector
 {
 public:
     static constexpr int bucket_count = 32;
+    static constexpr size_t CACHE_LINE_SIZE = kpq::CACHE_LINE_SIZE;
 
-    lockfree_vector()
+    lockfree_vector(memory_resource *resource = get_default_resource()) :
+        m_resource(resource)
     {
         for (int i = 0; i < bucket_count; i++) {
             m_buckets[i] = nullptr;
@@ -46,31 +58,94 @@ public:
     virtual ~lockfree_vector()
     {
         for (int i = 0; i < bucket_count; i++) {
-            if (m_buckets[i] != nullptr) {
-                delete[] m_buckets[i];
+            std::atomic<T *> *bucket = m_buckets[i].load(std::memory_order_relaxed);
+            if (bucket == nullptr) {
+                continue;
+            }
+
+            for (int j = 0; j < (1 << i); j++) {
+                T *elem = bucket[j].load(std::memory_order_relaxed);
+                if (elem != nullptr) {
+                    destroy(elem);
+                }
             }
+            delete[] bucket;
         }
     }
 
     T *get(const int n)
+    {
+        std::atomic<T *> &slot = slot_of(n);
+
+        T *elem = slot.load(std::memory_order_acquire);
+        if (elem == nullptr) {
+            elem = create();
+            T *expected = nullptr;
+            if (!slot.compare_exchange_strong(expected, elem,
+                                              std::memory_order_acq_rel)) {
+                destroy(elem);
+                elem = expected;
+                assert(elem != nullptr);
+            }
+        }
+
+        return elem;
+    }
+
+    /** As get(), but returns null instead of constructing missing elements. */
+    T *try_get(const int n) const
     {
         const int i = index_of(n);
 
-        T *bucket = m_buckets[i].load(std::memory_order_relaxed);
+        std::atomic<T *> *bucket = m_buckets[i].load(std::memory_order_acquire);
         if (bucket == nullptr) {
-            bucket = new T[1 << i];
-            T *expected = nullptr;
-            if (!m_buckets[i].compare_exchange_strong(expected, bucket)) {
+            return nullptr;
+        }
+
+        return bucket[n + 1 - (1 << i)].load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<T *> &slot_of(const int n)
+    {
+        const int i = index_of(n);
+
+        std::atomic<T *> *bucket = m_buckets[i].load(std::memory_order_acquire);
+        if (bucket == nullptr) {
+            /* Value-initialization sets all slots to null. */
+            bucket = new std::atomic<T *>[1 << i]();
+            std::atomic<T *> *expected = nullptr;
+            if (!m_buckets[i].compare_exchange_strong(expected, bucket,
+                                                      std::memory_order_acq_rel)) {
                 delete[] bucket;
                 bucket = expected;
                 assert(bucket != nullptr);
             }
         }
 
-        return &bucket[n + 1 - (1 << i)];
+        return bucket[n + 1 - (1 << i)];
+    }
+
+    static constexpr size_t ELEM_ALIGNMENT =
+        (alignof(T) > CACHE_LINE_SIZE) ? alignof(T) : CACHE_LINE_SIZE;
+    static constexpr size_t ELEM_SIZE =
+        (sizeof(T) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+    T *create()
+    {
+        void *p = m_resource->allocate(ELEM_SIZE, ELEM_ALIGNMENT);
+        return construct(p, std::is_constructible<T, memory_resource *>());
+    }
+
+    T *construct(void *p, std::true_type) { return new (p) T(m_resource); }
+    T *construct(void *p, std::false_type) { return new (p) T(); }
+
+    void destroy(T *elem)
+    {
+        elem->~T();
+        m_resource->deallocate(elem, ELEM_SIZE, ELEM_ALIGNMENT);
     }
 
-private:
     static int index_of(const int n)
     {
         /* We could optimize this for 64/32 bit ints. */
@@ -89,7 +164,8 @@ private:
     }
 
 private:
-    std::atomic<T *> m_buckets[bucket_count];
+    memory_resource *m_resource;
+    std::atomic<std::atomic<T *> *> m_buckets[bucket_count];
 };
 
 }
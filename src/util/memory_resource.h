@@ -0,0 +1,536 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MEMORY_RESOURCE_H
+#define __MEMORY_RESOURCE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace kpq
+{
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+inline size_t
+page_size()
+{
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/** Allocates size bytes of zeroed, page aligned memory directly from the OS. */
+inline void *
+alloc_pages(const size_t size)
+{
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+/** Like alloc_pages(), but aligns the returned memory to alignment, which
+ *  must be a power of two. */
+inline void *
+alloc_aligned_pages(const size_t size,
+                    const size_t alignment)
+{
+    if (alignment <= page_size()) {
+        return alloc_pages(size);
+    }
+
+    const uintptr_t p = (uintptr_t)alloc_pages(size + alignment);
+    const uintptr_t aligned = (p + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    const uintptr_t end = (aligned + size + page_size() - 1) & ~(uintptr_t)(page_size() - 1);
+
+    if (aligned != p) {
+        munmap((void *)p, aligned - p);
+    }
+    if (end != p + size + alignment) {
+        munmap((void *)end, p + size + alignment - end);
+    }
+
+    return (void *)aligned;
+}
+
+inline void
+free_pages(void *p,
+           const size_t size)
+{
+    munmap(p, size);
+}
+
+/**
+ * Returns the physical memory of all pages fully contained in [p, p + size)
+ * to the OS and returns the number of released bytes. Unlike freeing the
+ * memory, the range remains mapped and simply reads as zero afterwards, and
+ * thus stays safe to read for threads holding stale references into it.
+ * Returns 0 if the kernel refuses to release the range, e.g. for explicit
+ * huge pages (MAP_HUGETLB) on older kernels.
+ */
+inline size_t
+release_pages(void *p,
+              const size_t size)
+{
+    const uintptr_t mask  = page_size() - 1;
+    const uintptr_t first = ((uintptr_t)p + mask) & ~mask;
+    const uintptr_t last  = ((uintptr_t)p + size) & ~mask;
+
+    if (last <= first) {
+        return 0;
+    }
+
+    if (madvise((void *)first, last - first, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    return last - first;
+}
+
+/** Returns the NUMA node the calling thread currently runs on, or 0 if it
+ *  cannot be determined. */
+inline int
+current_numa_node()
+{
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return node;
+}
+
+/** Makes node the preferred NUMA node of the pages in [p, p + size). Pages
+ *  are only placed on first touch, and on other nodes once node is
+ *  exhausted or if the kernel does not support NUMA policies at all. */
+inline void
+bind_pages(void *p,
+           const size_t size,
+           const int node)
+{
+    /* See set_mempolicy(2). */
+    static constexpr int MEMPOLICY_PREFERRED = 1;
+
+    unsigned long mask[4] = { 0 };
+    if (node >= 0 && node < (int)(sizeof(mask) * 8)) {
+        mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+        syscall(SYS_mbind, p, size, MEMPOLICY_PREFERRED, mask, sizeof(mask) * 8, 0);
+    }
+}
+
+/**
+ * The source of all memory of blocks, items and block arrays, modeled after
+ * std::pmr::memory_resource. Resources are passed to the queues (k_lsm,
+ * shared_lsm and dist_lsm) on construction, which pass them on to their
+ * per-thread state and from there to blocks, block_storage, block_pool,
+ * item_allocator and aligned_block_array. All of these default to the
+ * resource returned by get_default_resource() at their construction.
+ *
+ * Resources must be thread-safe, and memory must remain mapped until it is
+ * deallocated: block and item memory is released through release_pages()
+ * while other threads may still read it.
+ */
+class memory_resource
+{
+public:
+    virtual ~memory_resource() { }
+
+    void *allocate(const size_t bytes,
+                   const size_t alignment = alignof(std::max_align_t))
+    {
+        return do_allocate(bytes, alignment);
+    }
+
+    void deallocate(void *p,
+                    const size_t bytes,
+                    const size_t alignment = alignof(std::max_align_t))
+    {
+        do_deallocate(p, bytes, alignment);
+    }
+
+private:
+    virtual void *do_allocate(const size_t bytes,
+                              const size_t alignment) = 0;
+    virtual void do_deallocate(void *p,
+                               const size_t bytes,
+                               const size_t alignment) = 0;
+};
+
+inline size_t
+round_up(const size_t n,
+         const size_t multiple)
+{
+    return (n + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * The default resource. Page aligned requests are mapped directly from the
+ * OS, all others are served by the global heap.
+ */
+class system_resource : public memory_resource
+{
+private:
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        if (alignment >= page_size()) {
+            return alloc_aligned_pages(round_up(bytes, page_size()), alignment);
+        }
+
+        if (alignment <= alignof(std::max_align_t)) {
+            return ::operator new(bytes);
+        }
+
+        void *p;
+        if (posix_memalign(&p, alignment, bytes) != 0) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t alignment) override
+    {
+        if (alignment >= page_size()) {
+            free_pages(p, round_up(bytes, page_size()));
+        } else if (alignment <= alignof(std::max_align_t)) {
+            ::operator delete(p);
+        } else {
+            free(p);
+        }
+    }
+};
+
+inline memory_resource *
+get_system_resource()
+{
+    static system_resource resource;
+    return &resource;
+}
+
+/**
+ * Maps memory from the OS and binds it to a NUMA node. The binding is a
+ * preference, memory is taken from other nodes once the node is exhausted
+ * (or if the kernel does not support NUMA policies at all). Allocations are
+ * rounded up to whole pages, small allocations should thus be served by an
+ * arena_resource on top of this resource.
+ */
+class numa_resource : public memory_resource
+{
+public:
+    numa_resource(const int node) :
+        m_node(node)
+    {
+    }
+
+    int node() const { return m_node; }
+
+private:
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        const size_t size = round_up(bytes, page_size());
+        void *p = alloc_aligned_pages(size, alignment);
+
+        bind_pages(p, size, m_node);
+        return p;
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t) override
+    {
+        free_pages(p, round_up(bytes, page_size()));
+    }
+
+private:
+    const int m_node;
+};
+
+/**
+ * Binds memory to the NUMA node of the allocating thread. Blocks, item
+ * arenas and the per-thread state of the queues are allocated by the
+ * threads which own them, this resource thus keeps each thread's lsm on its
+ * own node regardless of where the heap takes its pages from.
+ *
+ * Allocations of at least threshold bytes are rounded up to whole pages.
+ * Smaller ones (which are mostly small blocks) are passed to upstream, whose
+ * per-thread heaps usually place them on the local node on first touch.
+ */
+class numa_local_resource : public memory_resource
+{
+public:
+    numa_local_resource(memory_resource *upstream = get_system_resource(),
+                        const size_t threshold = 1024) :
+        m_upstream(upstream),
+        m_threshold(threshold)
+    {
+    }
+
+private:
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        if (bytes < m_threshold) {
+            return m_upstream->allocate(bytes, alignment);
+        }
+
+        const size_t size = round_up(bytes, page_size());
+        void *p = alloc_aligned_pages(size, alignment);
+        bind_pages(p, size, current_numa_node());
+        return p;
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t alignment) override
+    {
+        if (bytes < m_threshold) {
+            m_upstream->deallocate(p, bytes, alignment);
+        } else {
+            free_pages(p, round_up(bytes, page_size()));
+        }
+    }
+
+private:
+    memory_resource *m_upstream;
+    const size_t m_threshold;
+};
+
+inline memory_resource *
+get_numa_local_resource()
+{
+    static numa_local_resource resource;
+    return &resource;
+}
+
+/** The default resource of the build, which places memory on the node of
+ *  the allocating thread if ENABLE_NUMA_PLACEMENT is defined. */
+inline memory_resource *
+initial_default_resource()
+{
+#ifdef ENABLE_NUMA_PLACEMENT
+    return get_numa_local_resource();
+#else
+    return get_system_resource();
+#endif
+}
+
+inline std::atomic<memory_resource *> &
+default_resource()
+{
+    static std::atomic<memory_resource *> resource(initial_default_resource());
+    return resource;
+}
+
+inline memory_resource *
+get_default_resource()
+{
+    return default_resource().load(std::memory_order_acquire);
+}
+
+/** Sets the default resource (or the initial one if r is null) and returns
+ *  the previous one. */
+inline memory_resource *
+set_default_resource(memory_resource *r)
+{
+    return default_resource().exchange((r == nullptr) ? initial_default_resource() : r,
+                                       std::memory_order_acq_rel);
+}
+
+/**
+ * Backs large allocations (of at least threshold bytes) with 2 MB pages,
+ * which cuts TLB misses of scans over large blocks. In TRANSPARENT mode,
+ * such allocations are aligned to the huge page size and marked through
+ * madvise(MADV_HUGEPAGE). EXPLICIT mode maps them from the preallocated
+ * huge page pool (MAP_HUGETLB) and falls back to transparent huge pages if
+ * the pool is exhausted. Smaller allocations are passed on to upstream.
+ * Note that explicit huge pages are generally not released by trim(), see
+ * release_pages().
+ */
+class huge_page_resource : public memory_resource
+{
+public:
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    enum mode {
+        TRANSPARENT,
+        EXPLICIT,
+    };
+
+    huge_page_resource(const mode m = TRANSPARENT,
+                       const size_t threshold = HUGE_PAGE_SIZE / 2,
+                       memory_resource *upstream = get_default_resource()) :
+        m_mode(m),
+        m_threshold(threshold),
+        m_upstream(upstream)
+    {
+    }
+
+private:
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        if (bytes < m_threshold) {
+            return m_upstream->allocate(bytes, alignment);
+        }
+
+        const size_t size = round_up(bytes, HUGE_PAGE_SIZE);
+        if (m_mode == EXPLICIT && alignment <= HUGE_PAGE_SIZE) {
+            void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                return p;
+            }
+        }
+
+        /* std::max() takes references, which would ODR-use HUGE_PAGE_SIZE. */
+        const size_t huge_page_size = HUGE_PAGE_SIZE;
+        void *p = alloc_aligned_pages(size, std::max(alignment, huge_page_size));
+        madvise(p, size, MADV_HUGEPAGE);
+        return p;
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t alignment) override
+    {
+        if (bytes < m_threshold) {
+            m_upstream->deallocate(p, bytes, alignment);
+        } else {
+            free_pages(p, round_up(bytes, HUGE_PAGE_SIZE));
+        }
+    }
+
+private:
+    const mode m_mode;
+    const size_t m_threshold;
+    memory_resource *m_upstream;
+};
+
+/**
+ * A bump allocator which carves allocations from chunks of upstream memory.
+ * Deallocation is a no-op, all memory is returned to upstream by release()
+ * or on destruction. Memory usage thus grows with each block that is freed
+ * and allocated again, which makes arenas a good fit for queues of bounded
+ * lifetime.
+ */
+class arena_resource : public memory_resource
+{
+public:
+    arena_resource(memory_resource *upstream = get_default_resource(),
+                   const size_t chunk_size = 1 << 20) :
+        m_upstream(upstream),
+        m_chunk_size(chunk_size),
+        m_next(0),
+        m_end(0)
+    {
+    }
+
+    ~arena_resource()
+    {
+        release();
+    }
+
+    /** Returns all memory to upstream. */
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto &chunk : m_chunks) {
+            m_upstream->deallocate(chunk.m_ptr, chunk.m_size, chunk.m_alignment);
+        }
+        m_chunks.clear();
+        m_next = m_end = 0;
+    }
+
+    /** Returns the number of bytes allocated from upstream. */
+    size_t upstream_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        size_t bytes = 0;
+        for (auto &chunk : m_chunks) {
+            bytes += chunk.m_size;
+        }
+        return bytes;
+    }
+
+private:
+    struct chunk {
+        void *m_ptr;
+        size_t m_size;
+        size_t m_alignment;
+    };
+
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        uintptr_t p = round_up(m_next, alignment);
+        if (p + bytes > m_end) {
+            /* Oversized allocations receive a chunk of their own, which
+             * leaves the current chunk in place. */
+            const size_t chunk_alignment = std::max(alignment, page_size());
+            if (bytes > m_chunk_size / 2) {
+                void *q = m_upstream->allocate(bytes, chunk_alignment);
+                m_chunks.push_back({ q, bytes, chunk_alignment });
+                return q;
+            }
+
+            void *q = m_upstream->allocate(m_chunk_size, chunk_alignment);
+            m_chunks.push_back({ q, m_chunk_size, chunk_alignment });
+            m_next = (uintptr_t)q;
+            m_end = m_next + m_chunk_size;
+            p = round_up(m_next, alignment);
+        }
+
+        m_next = p + bytes;
+        return (void *)p;
+    }
+
+    void do_deallocate(void *,
+                       const size_t,
+                       const size_t) override
+    {
+    }
+
+private:
+    memory_resource *m_upstream;
+    const size_t m_chunk_size;
+
+    mutable std::mutex m_mutex;
+    std::vector<chunk> m_chunks;
+    uintptr_t m_next, m_end;
+};
+
+}
+
+#endif /* __MEMORY_RESOURCE_H */
@@ -20,11 +20,56 @@
 #ifndef __MM_H
 #define __MM_H
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "memory_resource.h"
+#include "thread_local_ptr.h"
 
 namespace kpq
 {
 
+/**
+ * Item classes whose memory may be released by item_allocator::trim()
+ * declare so in their ReuseCheck class, which then also provides
+ * version(item) and reset(item, version) (see item<K, V>::reuse).
+ */
+template <class ReuseCheck, class = void>
+struct releasable_items : public std::false_type { };
+
+template <class ReuseCheck>
+struct releasable_items<ReuseCheck,
+                        typename std::enable_if<ReuseCheck::releasable>::type>
+    : public std::true_type { };
+
+/**
+ * Item classes whose taken items may be handed back to their allocator
+ * through item_allocator::recycle() declare so in their ReuseCheck class.
+ * The item classes of the lsm do so only if ENABLE_ITEM_RECYCLING is
+ * defined, since returning an item touches the header of its block, which
+ * is usually cold at high queue occupancy (see src/bench/insert_path.cpp).
+ */
+template <class ReuseCheck, class = void>
+struct recyclable_items : public std::false_type { };
+
+template <class ReuseCheck>
+struct recyclable_items<ReuseCheck,
+                        typename std::enable_if<ReuseCheck::recyclable>::type>
+    : public std::true_type { };
+
+constexpr size_t
+next_power_of_two(const size_t n,
+                  const size_t p = 1)
+{
+    return (p >= n) ? p : next_power_of_two(n, p << 1);
+}
+
 /**
  * The wait-free memory management scheme by Wimmer (www.pheet.org).
  */
@@ -33,14 +78,58 @@ template <class T, size_t BlockSize>
 class item_allocator_item
 {
 public:
-    T m_items[BlockSize];
+    static constexpr size_t WORDS = (BlockSize + 63) / 64;
+
     item_allocator_item<T, BlockSize> *m_next;
+
+    /** Items of released blocks are reset to this version before reuse,
+     *  see item_allocator::trim(). */
+    uint64_t m_version_base;
+
+    /** The owning allocator and the id of its thread. */
+    void *m_owner;
+    int32_t m_owner_tid;
+
+    /** The link within the owner's return stack. A block is on the stack at
+     *  most once, as guarded by m_queued. */
+    item_allocator_item<T, BlockSize> *m_next_returned;
+    std::atomic<bool> m_queued;
+
+    /** Owner-only state: whether the block has been released by trim(),
+     *  the number of bits set in m_free, and the link within the list of
+     *  blocks with free items. A block is listed iff m_free_count > 0. */
+    bool m_parked;
+    uint32_t m_free_count;
+    item_allocator_item<T, BlockSize> *m_next_free;
+
+    /** Items returned by other threads since the last harvest, and items
+     *  harvested by the owner but not yet handed out again. */
+    std::atomic<uint64_t> m_returned[WORDS];
+    uint64_t m_free[WORDS];
+
+    T m_items[BlockSize];
 };
 
 template <class T, class ReuseCheck, size_t BlockSize = 1024>
 class item_allocator
 {
     static constexpr size_t AMORTIZATION = 1;
+
+    typedef item_allocator_item<T, BlockSize> block_t;
+
+    /** Blocks are placed in slots aligned to their size rounded up to a
+     *  power of two, which lets recycle() locate the block of an item.
+     *  Within its slot, each block is offset by one of COLORS cache lines,
+     *  otherwise all block headers would compete for the same few cache
+     *  sets. Slots are carved from arenas of consecutive slots, since
+     *  separately mapped aligned slots leave gaps which waste cache sets.
+     *  Arenas start at a single slot and double up to MAX_ARENA_BLOCKS, so
+     *  that allocators holding few items commit little memory. */
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr size_t COLORS = 16;
+    static constexpr size_t BLOCK_ALIGNMENT =
+        next_power_of_two(sizeof(block_t) + (COLORS - 1) * CACHE_LINE);
+    static constexpr size_t MAX_ARENA_BLOCKS = 16;
 public:
     typedef T              value_type;
     typedef T             *pointer;
@@ -50,30 +139,60 @@ public:
     typedef std::size_t    size_type;
     typedef std::ptrdiff_t difference_type;
 
-    item_allocator() :
-        m_offset(0),
+    /** The first block is allocated lazily by acquire(), allocators which
+     *  are never used (e.g. those of threads which never insert) thus do not
+     *  allocate any memory. */
+    item_allocator(memory_resource *resource = get_default_resource()) :
+        m_resource(resource),
+        m_head(nullptr),
+        m_released(nullptr),
+        m_returns(nullptr),
+        m_free_blocks(nullptr),
+        m_arena(nullptr),
+        m_arena_left(0),
+        m_offset(BlockSize),
         m_amortized(0),
         m_total_size(BlockSize),
         m_new_block(true),
         is_reusable()
     {
-        m_head = new item_allocator_item<T, BlockSize>();
-        m_head->m_next = m_head;
     }
 
     virtual ~item_allocator()
     {
-        auto next = m_head->m_next;
-        while (next != m_head) {
-            auto nnext = next->m_next;
-            delete next;
-            next = nnext;
+        while (m_released != nullptr) {
+            auto next = m_released->m_next;
+            m_released->~block_t();
+            m_released = next;
+        }
+
+        if (m_head != nullptr) {
+            auto next = m_head->m_next;
+            while (next != m_head) {
+                auto nnext = next->m_next;
+                next->~block_t();
+                next = nnext;
+            }
+            m_head->~block_t();
+        }
+
+        for (const auto &arena : m_arenas) {
+            m_resource->deallocate(arena.m_slots, arena.m_nblocks * BLOCK_ALIGNMENT, BLOCK_ALIGNMENT);
         }
-        delete m_head;
     }
 
+    /**
+     * Items returned through recycle() are handed out first, in O(1) and
+     * without scanning live items. Only once none are left, acquire() falls
+     * back to scanning the allocation ring for reusable items.
+     */
     pointer acquire()
     {
+        pointer item = acquire_returned(recyclable_items<ReuseCheck>());
+        if (item != nullptr) {
+            return item;
+        }
+
         while (true) {
             while (m_offset < BlockSize) {
                 auto item = &m_head->m_items[m_offset++];
@@ -83,13 +202,15 @@ public:
                 }
             }
 
-            if (m_amortized < BlockSize) {
-                auto new_block = new item_allocator_item<T, BlockSize>();
+            if (m_head == nullptr) {
+                m_head = new_block();
+                m_head->m_next = m_head;
+            } else if (m_amortized < BlockSize) {
+                auto new_block = this->new_block();
                 new_block->m_next = m_head->m_next;
                 m_head->m_next = new_block;
                 m_head = new_block;
                 m_total_size += BlockSize;
-                m_new_block = true;
             } else {
                 m_amortized = std::min(m_amortized, m_total_size * AMORTIZATION);
                 m_amortized -= BlockSize;
@@ -100,9 +221,308 @@ public:
         }
     }
 
+    /**
+     * Removes all blocks of which every item is reusable from the allocation
+     * ring (except the current one), releases their memory to the OS and
+     * returns the number of released bytes. Released blocks are reused once
+     * the ring needs to grow again. Since their memory remains mapped,
+     * threads may still read stale references to their items: zeroed
+     * versions never match a referenced version, and items are reset to
+     * versions beyond all previous ones before reuse. Only the owning thread
+     * may call trim(), which does nothing unless releasable_items holds.
+     */
+    size_t trim()
+    {
+        return trim(releasable_items<ReuseCheck>());
+    }
+
+    /**
+     * Hands a just taken item back to the allocator it was acquired from.
+     * May be called by any thread, but only on items of item_allocator
+     * instances and only while the allocator exists. The owning thread
+     * frees items directly. Returns by other threads are batched: the first
+     * item returned to a block since its last harvest pushes the block onto
+     * the owner's lock-free return stack, further items only set their bit
+     * in the block's return mask.
+     */
+    static void recycle(pointer item)
+    {
+        recycle(item, recyclable_items<ReuseCheck>());
+    }
+
+private:
+    static void recycle(pointer,
+                        std::false_type)
+    {
+    }
+
+    static void recycle(pointer item,
+                        std::true_type)
+    {
+        auto block = block_of_slot((uintptr_t)item & ~(uintptr_t)(BLOCK_ALIGNMENT - 1));
+        const size_t i = item - block->m_items;
+        assert(i < BlockSize);
+
+        auto owner = static_cast<item_allocator *>(block->m_owner);
+        if (block->m_owner_tid == tid()) {
+            owner->add_free(block, i / 64, (uint64_t)1 << (i % 64));
+            return;
+        }
+
+        /* A nonzero mask word implies that its block is queued or about to be
+         * harvested, see harvest(). */
+        if (block->m_returned[i / 64].fetch_or((uint64_t)1 << (i % 64)) != 0
+                || block->m_queued.exchange(true)) {
+            return;
+        }
+
+        auto &returns = owner->m_returns;
+        auto head = returns.load(std::memory_order_relaxed);
+        do {
+            block->m_next_returned = head;
+        } while (!returns.compare_exchange_weak(head, block,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+
+    void add_free(block_t *block,
+                  const size_t w,
+                  const uint64_t bits)
+    {
+        const uint64_t added = bits & ~block->m_free[w];
+        if (added == 0) {
+            return;
+        }
+
+        block->m_free[w] |= added;
+        if (block->m_free_count == 0) {
+            block->m_next_free = m_free_blocks;
+            m_free_blocks = block;
+        }
+        block->m_free_count += __builtin_popcountll(added);
+    }
+
+    pointer acquire_returned(std::false_type)
+    {
+        return nullptr;
+    }
+
+    pointer acquire_returned(std::true_type)
+    {
+        while (m_free_blocks != nullptr || harvest()) {
+            auto block = m_free_blocks;
+
+            size_t w = 0;
+            while (block->m_free[w] == 0) {
+                w++;
+            }
+
+            const size_t bit = __builtin_ctzll(block->m_free[w]);
+            block->m_free[w] &= block->m_free[w] - 1;
+            if (--block->m_free_count == 0) {
+                m_free_blocks = block->m_next_free;
+            }
+
+            /* The ring scan may have handed out the item in the meantime. */
+            auto item = &block->m_items[w * 64 + bit];
+            if (is_reusable(*item)) {
+                return item;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /** Moves all returned items into the owner's free masks. Multiple
+     *  producers and a single consumer which takes the entire stack at once
+     *  make the return stack immune to ABA. */
+    bool harvest()
+    {
+        if (m_returns.load(std::memory_order_relaxed) == nullptr) {
+            return false;
+        }
+
+        auto block = m_returns.exchange(nullptr, std::memory_order_acquire);
+        while (block != nullptr) {
+            auto next = block->m_next_returned;
+
+            /* Dequeue before clearing the masks, such that concurrent
+             * returns either show up below or queue the block again. */
+            block->m_queued.store(false);
+
+            for (size_t w = 0; w < block_t::WORDS; w++) {
+                if (block->m_returned[w].load() == 0) {
+                    continue;
+                }
+
+                /* Late returns to released blocks are dropped. */
+                const uint64_t returned = block->m_returned[w].exchange(0);
+                if (!block->m_parked) {
+                    add_free(block, w, returned);
+                }
+            }
+
+            block = next;
+        }
+
+        return (m_free_blocks != nullptr);
+    }
+
+    size_t trim(std::false_type)
+    {
+        return 0;
+    }
+
+    size_t trim(std::true_type)
+    {
+        if (m_head == nullptr) {
+            return 0;
+        }
+
+        size_t released = 0;
+        auto prev = m_head;
+        auto block = m_head->m_next;
+        while (block != m_head) {
+            auto next = block->m_next;
+
+            uint64_t max_version = 0;
+            bool reusable = true;
+            for (size_t i = 0; i < BlockSize && reusable; i++) {
+                reusable = is_reusable(block->m_items[i]);
+                max_version = std::max<uint64_t>(max_version,
+                                                  ReuseCheck::version(block->m_items[i]));
+            }
+
+            if (reusable) {
+                /* Reusable versions are multiples of 4 for all item classes. */
+                block->m_version_base = (max_version & ~(uint64_t)0x3) + 4;
+                released += release_pages(block->m_items, sizeof(block->m_items));
+
+                block->m_parked = true;
+
+                prev->m_next = next;
+                block->m_next = m_released;
+                m_released = block;
+                m_total_size -= BlockSize;
+            } else {
+                prev = block;
+            }
+
+            block = next;
+        }
+
+        /* Drop released blocks from the free list. */
+        auto link = &m_free_blocks;
+        while (*link != nullptr) {
+            auto block = *link;
+            if (block->m_parked) {
+                std::fill(block->m_free, block->m_free + block_t::WORDS, 0);
+                block->m_free_count = 0;
+                *link = block->m_next_free;
+            } else {
+                link = &block->m_next_free;
+            }
+        }
+
+        return released;
+    }
+
+    item_allocator_item<T, BlockSize> *new_block()
+    {
+        if (m_released != nullptr) {
+            auto block = m_released;
+            m_released = block->m_next;
+            block->m_parked = false;
+            reset_versions(block, releasable_items<ReuseCheck>());
+
+            /* Late returns of items taken before the block was released may
+             * still show up in its masks, items are thus checked before
+             * being handed out. */
+            m_new_block = false;
+            return block;
+        }
+
+        m_new_block = true;
+
+        if (m_arena_left == 0) {
+            const size_t nblocks = m_arenas.empty()
+                    ? 1
+                    : (2 * m_arenas.back().m_nblocks < MAX_ARENA_BLOCKS
+                       ? 2 * m_arenas.back().m_nblocks
+                       : MAX_ARENA_BLOCKS);
+            m_arena = static_cast<char *>(m_resource->allocate(nblocks * BLOCK_ALIGNMENT,
+                                                               BLOCK_ALIGNMENT));
+            m_arenas.push_back({ m_arena, nblocks });
+            m_arena_left = nblocks;
+        }
+
+        auto block = new (block_of_slot((uintptr_t)m_arena)) block_t();
+        m_arena += BLOCK_ALIGNMENT;
+        m_arena_left--;
+        set_owner(block, recyclable_items<ReuseCheck>());
+        return block;
+    }
+
+    void set_owner(block_t *,
+                   std::false_type)
+    {
+    }
+
+    void set_owner(block_t *block,
+                   std::true_type)
+    {
+        set_tid();
+        block->m_owner = this;
+        block->m_owner_tid = tid();
+    }
+
+    static block_t *block_of_slot(const uintptr_t slot)
+    {
+        const size_t color = (slot / BLOCK_ALIGNMENT) % COLORS;
+        return reinterpret_cast<block_t *>(slot + color * CACHE_LINE);
+    }
+
+    void reset_versions(item_allocator_item<T, BlockSize> *,
+                        std::false_type)
+    {
+    }
+
+    void reset_versions(item_allocator_item<T, BlockSize> *block,
+                        std::true_type)
+    {
+        for (size_t i = 0; i < BlockSize; i++) {
+            ReuseCheck::reset(block->m_items[i], block->m_version_base);
+        }
+    }
+
 private:
+    memory_resource *m_resource;
+
     item_allocator_item<T, BlockSize> *m_head;
 
+    /** Blocks whose memory has been released by trim(), linked through
+     *  m_next. */
+    item_allocator_item<T, BlockSize> *m_released;
+
+    /** Blocks with items returned by recycle(), linked through
+     *  m_next_returned, and blocks with harvested free items, linked
+     *  through m_next_free. m_returns is written by other threads and
+     *  padded to its own cache line. */
+    char m_returns_padding[CACHE_LINE_SIZE];
+    std::atomic<item_allocator_item<T, BlockSize> *> m_returns;
+    char m_returns_padding_end[CACHE_LINE_SIZE - sizeof(m_returns)];
+    item_allocator_item<T, BlockSize> *m_free_blocks;
+
+    struct arena {
+        void *m_slots;
+        size_t m_nblocks;
+    };
+
+    /** All arenas, and the remainder of the current one. */
+    std::vector<arena> m_arenas;
+    char *m_arena;
+    size_t m_arena_left;
+
     size_t m_offset;
     size_t m_amortized;
     size_t m_total_size;
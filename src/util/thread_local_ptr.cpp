@@ -19,6 +19,13 @@
 
 #include "thread_local_ptr.h"
 
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
+
 namespace kpq
 {
 
@@ -27,11 +34,68 @@ static constexpr int32_t TID_UNSET = -1;
 static thread_local int32_t m_tid = TID_UNSET;
 static std::atomic<int32_t> m_max_tid(0);
 
+/** Ids of exited threads, kept as a min-heap so that the smallest ids are
+ *  handed out first. Acquiring and releasing ids happens only once per
+ *  thread, a mutex is therefore sufficient. */
+static std::mutex m_free_tids_mutex;
+static std::vector<int32_t> m_free_tids;
+
+/**
+ * Returns the id of the current thread to the free list on thread exit.
+ * The next thread to receive the id takes over everything stored at its index
+ * by thread_local_ptr's, including e.g. the items contained in a local lsm.
+ * The mutex orders all accesses of the exited thread before those of the
+ * new owner.
+ *
+ * This is the destructor of a pthread key rather than of a thread_local
+ * object: the order of thread_local destructors is unspecified, and
+ * thread_local objects which access their thread's elements while being
+ * destroyed must still find the exiting thread's id. Key destructors only
+ * run once all thread_local objects of the thread have been destroyed.
+ */
+static void
+release_tid(void *)
+{
+    std::lock_guard<std::mutex> lock(m_free_tids_mutex);
+    m_free_tids.push_back(m_tid);
+    std::push_heap(m_free_tids.begin(), m_free_tids.end(), std::greater<int32_t>());
+    m_tid = TID_UNSET;
+}
+
+static pthread_key_t
+create_tid_key()
+{
+    pthread_key_t key;
+    const int ret = pthread_key_create(&key, release_tid);
+    assert(ret == 0);
+    (void)ret;
+    return key;
+}
+
+static int32_t
+acquire_tid()
+{
+    std::lock_guard<std::mutex> lock(m_free_tids_mutex);
+    if (m_free_tids.empty()) {
+        return m_max_tid.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::pop_heap(m_free_tids.begin(), m_free_tids.end(), std::greater<int32_t>());
+    const int32_t tid = m_free_tids.back();
+    m_free_tids.pop_back();
+
+    return tid;
+}
+
 void
 set_tid()
 {
     if (m_tid == TID_UNSET) {
-        m_tid = m_max_tid.fetch_add(1, std::memory_order_relaxed);
+        m_tid = acquire_tid();
+
+        /* Key destructors are only called for non-null values. */
+        static const pthread_key_t key = create_tid_key();
+        pthread_setspecific(key, &m_tid);
     }
 }
 
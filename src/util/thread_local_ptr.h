@@ -35,12 +35,25 @@ int32_t max_tid();
 /**
  * A thread-local pointer to an element of type T, based on a dynamically growing
  * array and the current thread id.
+ *
+ * Thread ids are recycled: once a thread exits, its id (and thus its element)
+ * is passed on to the next thread calling set_tid(). The array size is
+ * therefore bounded by the maximal number of simultaneously live threads,
+ * and elements must remain valid across owners. A thread keeps its id until
+ * all of its thread_local objects have been destroyed, which may thus still
+ * access the thread's elements.
  */
 
 template <class T>
 class thread_local_ptr
 {
 public:
+    /** Elements are allocated from resource, see lockfree_vector. */
+    thread_local_ptr(memory_resource *resource = get_default_resource()) :
+        m_items(resource)
+    {
+    }
+
     T *get()
     {
         set_tid();
@@ -53,13 +66,21 @@ public:
         return m_items.get(tid);
     }
 
+    /** Returns the element of thread tid, or null if no element has been
+     *  allocated for it yet. */
+    T *try_get(const int32_t tid) const
+    {
+        assert(tid < max_tid());
+        return m_items.try_get(tid);
+    }
+
     /** Returns the current thread id. */
     static size_t current_thread()
     {
         return tid();
     }
 
-    /** Returns the current thread count. */
+    /** Returns the highest number of thread ids handed out so far. */
     static size_t num_threads()
     {
         return max_tid();
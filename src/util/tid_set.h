@@ -0,0 +1,142 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TID_SET_H
+#define __TID_SET_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "lockfree_vector.h"
+
+namespace kpq
+{
+
+/**
+ * A set of thread ids from which elements can be drawn uniformly at random.
+ *
+ * Elements are kept densely in the first size() slots of a lockfree_vector,
+ * which never moves or frees its slots. Draws are thus lock-free and take
+ * constant time. Insertions and removals are rare (e.g. once per thread), and are
+ * serialized by a mutex; a removal moves the last element into the freed slot.
+ * A concurrent draw may therefore return an element which has just been
+ * removed, or miss one which has just been inserted.
+ */
+class tid_set
+{
+public:
+    static constexpr int32_t NO_TID = -1;
+
+    tid_set(memory_resource *resource = get_default_resource()) :
+        m_slots(resource),
+        m_size(0)
+    {
+    }
+
+    /** Adds tid unless it is already contained. */
+    void insert(const int32_t tid)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (contains_locked(tid)) {
+            return;
+        }
+
+        const size_t ix = m_size.load(std::memory_order_relaxed);
+        m_slots.get(ix)->store(tid, std::memory_order_relaxed);
+        set_position(tid, ix);
+        m_size.store(ix + 1, std::memory_order_release);
+    }
+
+    /** Removes tid if it is contained. */
+    void erase(const int32_t tid)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!contains_locked(tid)) {
+            return;
+        }
+
+        const size_t ix = m_positions[tid] - 1;
+        const size_t last = m_size.load(std::memory_order_relaxed) - 1;
+        const int32_t moved = m_slots.get(last)->load(std::memory_order_relaxed);
+
+        m_slots.get(ix)->store(moved, std::memory_order_relaxed);
+        m_positions[moved] = ix + 1;
+        m_positions[tid] = 0;
+        m_size.store(last, std::memory_order_release);
+    }
+
+    bool contains(const int32_t tid)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return contains_locked(tid);
+    }
+
+    size_t size() const
+    {
+        return m_size.load(std::memory_order_acquire);
+    }
+
+    /** Returns an element chosen uniformly at random by gen, or NO_TID if
+     *  the set is empty. */
+    template <class Gen>
+    int32_t draw(Gen &gen) const
+    {
+        const size_t size = m_size.load(std::memory_order_acquire);
+        if (size == 0) {
+            return NO_TID;
+        }
+
+        return m_slots.try_get(gen() % size)->load(std::memory_order_relaxed);
+    }
+
+private:
+    bool contains_locked(const int32_t tid) const
+    {
+        assert(tid >= 0);
+        return (static_cast<size_t>(tid) < m_positions.size()
+                && m_positions[tid] != 0);
+    }
+
+    void set_position(const int32_t tid,
+                      const size_t ix)
+    {
+        if (static_cast<size_t>(tid) >= m_positions.size()) {
+            m_positions.resize(tid + 1, 0);
+        }
+        m_positions[tid] = ix + 1;
+    }
+
+private:
+    /** Slots [0, m_size) hold the elements. Slots are created before m_size
+     *  is released, readers may therefore use try_get(). */
+    lockfree_vector<std::atomic<int32_t>> m_slots;
+    std::atomic<size_t> m_size;
+
+    /** The slot index + 1 of each contained tid, and 0 for all others.
+     *  Protected by m_mutex. */
+    std::mutex m_mutex;
+    std::vector<size_t> m_positions;
+};
+
+}
+
+#endif /* __TID_SET_H */
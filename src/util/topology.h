@@ -0,0 +1,123 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TOPOLOGY_H
+#define __TOPOLOGY_H
+
+#include <cstdio>
+#include <sched.h>
+#include <vector>
+
+namespace kpq
+{
+
+/**
+ * The location of each CPU within the machine, read from sysfs on first use.
+ * CPUs without topology information (e.g. on systems without sysfs) are
+ * considered separate cores of a single socket.
+ */
+class cpu_topology
+{
+public:
+    /** Distances between two CPUs, in ascending order of access costs. */
+    enum distance {
+        SAME_CORE = 0, /**< Hardware threads of a single core. */
+        SAME_SOCKET,
+        REMOTE,
+        DISTANCES,
+    };
+
+    static const cpu_topology &instance()
+    {
+        static cpu_topology topology;
+        return topology;
+    }
+
+    /** Returns the CPU the calling thread currently runs on, or -1. */
+    static int current_cpu()
+    {
+        return sched_getcpu();
+    }
+
+    distance distance_between(const int cpu,
+                              const int other_cpu) const
+    {
+        if (cpu == other_cpu) {
+            return SAME_CORE;
+        }
+
+        if (!known(cpu) || !known(other_cpu)) {
+            return SAME_SOCKET;
+        }
+
+        if (m_packages[cpu] != m_packages[other_cpu]) {
+            return REMOTE;
+        }
+
+        return (m_cores[cpu] == m_cores[other_cpu]) ? SAME_CORE : SAME_SOCKET;
+    }
+
+private:
+    cpu_topology()
+    {
+        for (int cpu = 0; ; cpu++) {
+            const int package = read_topology(cpu, "physical_package_id");
+            const int core = read_topology(cpu, "core_id");
+            if (package < 0 || core < 0) {
+                break;
+            }
+
+            m_packages.push_back(package);
+            m_cores.push_back(core);
+        }
+    }
+
+    bool known(const int cpu) const
+    {
+        return cpu >= 0 && cpu < (int)m_packages.size();
+    }
+
+    static int read_topology(const int cpu,
+                             const char *name)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+        FILE *f = fopen(path, "r");
+        if (f == nullptr) {
+            return -1;
+        }
+
+        int value;
+        if (fscanf(f, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(f);
+
+        return value;
+    }
+
+private:
+    std::vector<int> m_packages;
+    std::vector<int> m_cores;
+};
+
+}
+
+#endif /* __TOPOLOGY_H */
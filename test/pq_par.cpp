@@ -18,6 +18,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <thread>
 #include <random>
 
@@ -204,6 +205,182 @@ TYPED_TEST(pq_par_test, ConcurrentInsDel)
     }
 }
 
+template <class T>
+static void
+batch_delete(T *pq,
+             std::vector<uint32_t> *deleted)
+{
+    uint32_t keys[64], vals[64];
+    size_t taken;
+    while ((taken = pq->delete_min_batch(keys, vals, 64)) > 0) {
+        deleted->insert(deleted->end(), keys, keys + taken);
+    }
+}
+
+TYPED_TEST(pq_par_test, ConcurrentDeleteMinBatch)
+{
+    this->generate_elements(NELEMS * NTHREADS);
+
+    std::vector<std::thread> threads(NTHREADS);
+    std::vector<std::vector<uint32_t>> deleted(NTHREADS);
+
+    for (int i = 0; i < NTHREADS; i++) {
+        threads[i] = std::thread(batch_delete<gtest_TypeParam_>,
+                                 this->m_pq,
+                                 &deleted[i]);
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    /* Items may remain in other threads' local lsms, but no item may be
+     * returned twice. */
+
+    std::vector<uint32_t> all_deleted;
+    for (auto &d : deleted) {
+        all_deleted.insert(all_deleted.end(), d.begin(), d.end());
+    }
+    batch_delete(this->m_pq, &all_deleted);
+
+    std::sort(all_deleted.begin(), all_deleted.end());
+    std::sort(this->m_elements.begin(), this->m_elements.end());
+    ASSERT_TRUE(std::includes(this->m_elements.begin(), this->m_elements.end(),
+                              all_deleted.begin(), all_deleted.end()));
+}
+
+template <class T>
+static void
+decrease_keys(T *pq,
+              const int seed,
+              const int n,
+              std::vector<uint32_t> *deleted)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<> rand_int;
+
+    std::vector<item_handle<uint32_t, uint32_t>> handles(n);
+    std::vector<uint32_t> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = rand_int(gen);
+        pq->insert(keys[i], keys[i], handles[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!pq->decrease_key(handles[i], keys[i] / 2)) {
+            continue;  /* Already deleted by another thread. */
+        }
+
+        uint32_t k, v;
+        if (pq->delete_min(k, v)) {
+            deleted->push_back(v);
+        }
+    }
+}
+
+TEST(pq_par_decrease_key_test, ConcurrentDecreaseKey)
+{
+    typedef k_lsm<uint32_t, uint32_t, RELAXATION> pq_t;
+    pq_t pq;
+
+    std::vector<std::thread> threads(NTHREADS);
+    std::vector<std::vector<uint32_t>> deleted(NTHREADS);
+
+    for (int i = 0; i < NTHREADS; i++) {
+        threads[i] = std::thread(decrease_keys<pq_t>, &pq, i, NELEMS, &deleted[i]);
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    /* Decreasing a key must never duplicate an item. As in
+     * ConcurrentDeleteMinBatch, items may remain in other threads' local
+     * lsms. */
+
+    std::vector<uint32_t> all_deleted;
+    for (auto &d : deleted) {
+        all_deleted.insert(all_deleted.end(), d.begin(), d.end());
+    }
+
+    uint32_t k, v;
+    while (pq.delete_min(k, v)) {
+        all_deleted.push_back(v);
+    }
+
+    std::vector<uint32_t> elements;
+    for (int i = 0; i < NTHREADS; i++) {
+        std::mt19937 gen(i);
+        std::uniform_int_distribution<> rand_int;
+        for (int j = 0; j < NELEMS; j++) {
+            elements.push_back(rand_int(gen));
+        }
+    }
+
+    std::sort(all_deleted.begin(), all_deleted.end());
+    std::sort(elements.begin(), elements.end());
+    ASSERT_TRUE(std::includes(elements.begin(), elements.end(),
+                              all_deleted.begin(), all_deleted.end()));
+}
+
+struct intrusive_task : public item_hook<uint32_t, intrusive_task> {
+    std::atomic<int> m_deletions;
+};
+
+template <class T>
+static void
+intrusive_ins_del(T *pq,
+                  const int seed,
+                  intrusive_task *tasks,
+                  const int n)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<> rand_int;
+
+    for (int i = 0; i < n; i++) {
+        pq->insert(rand_int(gen), &tasks[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        intrusive_task *task;
+        if (pq->delete_min(task)) {
+            task->m_deletions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+TEST(pq_par_intrusive_test, ConcurrentInsDel)
+{
+    typedef k_lsm<uint32_t, intrusive<intrusive_task>, RELAXATION> pq_t;
+    pq_t pq;
+
+    std::vector<intrusive_task> tasks(NTHREADS * NELEMS);
+    for (auto &task : tasks) {
+        task.m_deletions.store(0, std::memory_order_relaxed);
+    }
+
+    std::vector<std::thread> threads(NTHREADS);
+    for (int i = 0; i < NTHREADS; i++) {
+        threads[i] = std::thread(intrusive_ins_del<pq_t>, &pq, i, &tasks[i * NELEMS], NELEMS);
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    /* No object may be handed out twice, including those remaining in
+     * other threads' local lsms which are only reachable through spying. */
+
+    intrusive_task *task;
+    while (pq.delete_min(task)) {
+        task->m_deletions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    for (auto &task : tasks) {
+        ASSERT_GE(1, task.m_deletions.load(std::memory_order_relaxed));
+    }
+}
+
 template <class T>
 static void
 random_delete_strict(T *pq,
@@ -253,6 +430,72 @@ TYPED_TEST(pq_par_test, ConcurrentInsDelSameThread)
     }
 }
 
+/** A value which is not trivially copyable (and thus moved out of items
+ *  only after a successful take) and detects torn moves: all words equal
+ *  the key until the value is moved from. */
+struct large_payload {
+    static constexpr int WORDS = 64;
+
+    large_payload() { std::fill(m_words, m_words + WORDS, 0); }
+    explicit large_payload(const uint32_t key) { std::fill(m_words, m_words + WORDS, key); }
+    large_payload(const large_payload &) = delete;
+    large_payload &operator=(large_payload &&that)
+    {
+        std::copy(that.m_words, that.m_words + WORDS, m_words);
+        std::fill(that.m_words, that.m_words + WORDS, 0);
+        return *this;
+    }
+
+    bool matches(const uint32_t key) const
+    {
+        return std::all_of(m_words, m_words + WORDS,
+                           [key](const uint32_t w) { return w == key; });
+    }
+
+    uint32_t m_words[WORDS];
+};
+
+template <class T>
+static void
+large_payload_ins_del(T *pq,
+                      const int seed,
+                      const int n,
+                      std::atomic<int> *mismatches)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<uint32_t> rand_int(1, std::numeric_limits<uint32_t>::max());
+
+    uint32_t key;
+    large_payload val;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 2; j++) {
+            key = rand_int(gen);
+            pq->emplace(key, key);
+        }
+        if (pq->delete_min(key, val) && !val.matches(key)) {
+            mismatches->fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+TEST(pq_par_large_payload_test, ConcurrentInsDel)
+{
+    typedef k_lsm<uint32_t, large_payload, RELAXATION> pq_t;
+    pq_t pq;
+
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads(NTHREADS);
+    for (int i = 0; i < NTHREADS; i++) {
+        threads[i] = std::thread(large_payload_ins_del<pq_t>, &pq, i, NELEMS, &mismatches);
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(0, mismatches.load());
+}
+
 int
 main(int argc,
      char **argv)
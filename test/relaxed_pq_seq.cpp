@@ -18,7 +18,9 @@
  */
 
 #include <gtest/gtest.h>
+#include <memory>
 #include <random>
+#include <set>
 #include <vector>
 #include <thread>
 
@@ -32,6 +34,26 @@ using namespace kpq;
 
 #define RELAXATION (32)
 
+/** The rank error of a single-threaded k-lsm once insertions and deletions
+ *  are interleaved: the shared pivot range holds up to RELAXATION + 1 items,
+ *  and the local dist lsm fewer than (RELAXATION + 1) / 2 further items. */
+#define K_LSM_RANK_ERROR (RELAXATION + (RELAXATION + 1) / 2 - 1)
+
+/** Queues with a runtime relaxation, initialized to RELAXATION. */
+template <class K, class V>
+class k_lsm_dyn : public k_lsm<K, V, DYNAMIC_RELAXATION>
+{
+public:
+    k_lsm_dyn() : k_lsm<K, V, DYNAMIC_RELAXATION>(RELAXATION) { }
+};
+
+template <class K, class V>
+class shared_lsm_dyn : public shared_lsm<K, V, DYNAMIC_RELAXATION>
+{
+public:
+    shared_lsm_dyn() : shared_lsm<K, V, DYNAMIC_RELAXATION>(RELAXATION) { }
+};
+
 template <class T>
 class PQTest : public ::testing::Test
 {
@@ -64,6 +86,38 @@ protected:
         std::sort(m_elements.begin(), m_elements.end());
     }
 
+    /** Like generate_elements(), but inserts elements in batches of the given
+     *  size through insert_bulk(). */
+    virtual void generate_elements_bulk(const int n,
+                                        const int batch_size)
+    {
+        std::mt19937 gen(DEFAULT_SEED);
+        std::uniform_int_distribution<> rand_int;
+
+        m_elements.clear();
+
+        delete m_pq;
+        m_pq = new T();
+
+        std::vector<std::pair<uint32_t, uint32_t>> batch;
+        batch.reserve(batch_size);
+
+        m_elements.reserve(n);
+        for (int i = 0; i < n; i++) {
+            const uint32_t v = rand_int(gen);
+
+            m_elements.push_back(v);
+            batch.push_back({ v, v });
+
+            if ((int)batch.size() == batch_size || i == n - 1) {
+                m_pq->insert_bulk(batch.begin(), batch.end());
+                batch.clear();
+            }
+        }
+
+        std::sort(m_elements.begin(), m_elements.end());
+    }
+
     /** Returns the relaxed upper bound for the key returned by i'th delete_min
      *  operation. */
     virtual uint32_t relaxed_upper_bound(const int i)
@@ -84,6 +138,8 @@ protected:
 
 typedef ::testing::Types< k_lsm<uint32_t, uint32_t, RELAXATION>
                         , shared_lsm<uint32_t, uint32_t, RELAXATION>
+                        , k_lsm_dyn<uint32_t, uint32_t>
+                        , shared_lsm_dyn<uint32_t, uint32_t>
                         > TestTypes;
 TYPED_TEST_CASE(PQTest, TestTypes);
 
@@ -135,6 +191,856 @@ TYPED_TEST(PQTest, ExtractAllDiffSizes)
     }
 }
 
+TYPED_TEST(PQTest, InsertBulk)
+{
+    std::vector<int> batch_sizes { 1, 3, 8, 15, 16, 17, 100, 1024, 5000 };
+    for (int batch_size : batch_sizes) {
+        this->generate_elements_bulk(PQ_SIZE, batch_size);
+
+        uint32_t v;
+        for (int i = 0; i < PQ_SIZE; i++) {
+            ASSERT_TRUE(this->m_pq->delete_min(v));
+            ASSERT_LE(v, this->relaxed_upper_bound(i));
+        }
+
+        ASSERT_FALSE(this->m_pq->delete_min(v));
+    }
+}
+
+TYPED_TEST(PQTest, InsertBulkMixed)
+{
+    this->generate_elements(0);
+
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+    std::uniform_int_distribution<> rand_size(0, 40);
+
+    std::vector<std::pair<uint32_t, uint32_t>> batch;
+    for (int i = 0; i < 256; i++) {
+        const uint32_t v = rand_int(gen);
+        this->m_elements.push_back(v);
+        this->m_pq->insert(v, v);
+
+        batch.clear();
+        const int batch_size = rand_size(gen);
+        for (int j = 0; j < batch_size; j++) {
+            const uint32_t w = rand_int(gen);
+            this->m_elements.push_back(w);
+            batch.push_back({ w, w });
+        }
+        this->m_pq->insert_bulk(batch.begin(), batch.end());
+    }
+
+    std::sort(this->m_elements.begin(), this->m_elements.end());
+
+    uint32_t v;
+    for (int i = 0; i < (int)this->m_elements.size(); i++) {
+        ASSERT_TRUE(this->m_pq->delete_min(v));
+        ASSERT_LE(v, this->relaxed_upper_bound(i));
+    }
+
+    ASSERT_FALSE(this->m_pq->delete_min(v));
+}
+
+TYPED_TEST(PQTest, DeleteMinBatch)
+{
+    std::vector<size_t> batch_sizes { 1, 2, 7, 32, 33, 100, 1024 };
+    for (size_t batch_size : batch_sizes) {
+        this->generate_elements(PQ_SIZE);
+
+        std::vector<uint32_t> keys(batch_size), vals(batch_size);
+
+        int i = 0;
+        while (i < PQ_SIZE) {
+            const size_t taken = this->m_pq->delete_min_batch(keys.data(), vals.data(), batch_size);
+            ASSERT_LT(0u, taken);
+            ASSERT_GE(batch_size, taken);
+
+            for (size_t j = 0; j < taken; j++, i++) {
+                ASSERT_EQ(keys[j], vals[j]);
+                ASSERT_LE(keys[j], this->relaxed_upper_bound(i));
+            }
+        }
+
+        ASSERT_EQ(PQ_SIZE, i);
+        ASSERT_EQ(0u, this->m_pq->delete_min_batch(keys.data(), vals.data(), batch_size));
+    }
+}
+
+TYPED_TEST(PQTest, DeleteMinBatchInterleaved)
+{
+    this->generate_elements(0);
+
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+    std::uniform_int_distribution<> rand_size(1, 64);
+
+    std::multiset<uint32_t> elements;
+    uint32_t keys[64], vals[64];
+
+    for (int i = 0; i < 1024; i++) {
+        const int ninserts = rand_size(gen);
+        for (int j = 0; j < ninserts; j++) {
+            const uint32_t v = rand_int(gen);
+            elements.insert(v);
+            this->m_pq->insert(v, v);
+        }
+
+        const size_t taken = this->m_pq->delete_min_batch(keys, vals, rand_size(gen));
+        for (size_t j = 0; j < taken; j++) {
+            auto it = elements.find(keys[j]);
+            ASSERT_NE(elements.end(), it);
+            elements.erase(it);
+        }
+    }
+
+    size_t taken;
+    while ((taken = this->m_pq->delete_min_batch(keys, vals, 64)) > 0) {
+        for (size_t j = 0; j < taken; j++) {
+            auto it = elements.find(keys[j]);
+            ASSERT_NE(elements.end(), it);
+            elements.erase(it);
+        }
+    }
+
+    ASSERT_TRUE(elements.empty());
+}
+
+TYPED_TEST(PQTest, PeekMin)
+{
+    uint32_t k, v;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(this->m_pq->peek_min(k));
+        ASSERT_TRUE(this->m_pq->peek_min(v));
+        ASSERT_EQ(k, v);
+
+        ASSERT_TRUE(this->m_pq->delete_min(v));
+        ASSERT_EQ(k, v);
+        ASSERT_LE(v, this->relaxed_upper_bound(i));
+    }
+
+    ASSERT_FALSE(this->m_pq->peek_min(k));
+}
+
+TYPED_TEST(PQTest, TopK)
+{
+    std::vector<size_t> sizes { 1, 7, 32, 100 };
+    std::vector<uint32_t> keys(100);
+
+    for (size_t n : sizes) {
+        const size_t peeked = this->m_pq->top_k(keys.data(), n);
+        ASSERT_LT(0u, peeked);
+        ASSERT_GE(n, peeked);
+
+        for (size_t j = 0; j < peeked; j++) {
+            ASSERT_LE(keys[j], this->relaxed_upper_bound(j));
+            if (j > 0) {
+                ASSERT_LE(keys[j - 1], keys[j]);
+            }
+        }
+    }
+
+    /* No items have been removed. */
+
+    uint32_t v;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(this->m_pq->delete_min(v));
+    }
+
+    ASSERT_FALSE(this->m_pq->delete_min(v));
+    ASSERT_EQ(0u, this->m_pq->top_k(keys.data(), 100));
+}
+
+TYPED_TEST(PQTest, Relaxation)
+{
+    ASSERT_EQ(RELAXATION, this->m_pq->relaxation());
+    this->m_pq->set_relaxation(RELAXATION);
+    ASSERT_EQ(RELAXATION, this->m_pq->relaxation());
+}
+
+template <class T>
+static void
+set_relaxation_and_extract_all(const int initial_relaxation,
+                               const int relaxation)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    T pq(initial_relaxation);
+    pq.set_relaxation(relaxation);
+    ASSERT_EQ(relaxation, pq.relaxation());
+
+    std::vector<uint32_t> elements;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        const uint32_t v = rand_int(gen);
+        elements.push_back(v);
+        pq.insert(v, v);
+    }
+
+    std::sort(elements.begin(), elements.end());
+
+    uint32_t v;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(pq.delete_min(v));
+        ASSERT_LE(v, elements[std::min(i + relaxation, PQ_SIZE - 1)]);
+    }
+
+    ASSERT_FALSE(pq.delete_min(v));
+}
+
+TEST(DynamicRelaxationTest, SetRelaxation)
+{
+    for (int relaxation : { 1, 4, 16, 256, 4096 }) {
+        set_relaxation_and_extract_all<k_lsm<uint32_t, uint32_t, DYNAMIC_RELAXATION>>(
+                RELAXATION, relaxation);
+        set_relaxation_and_extract_all<shared_lsm<uint32_t, uint32_t, DYNAMIC_RELAXATION>>(
+                RELAXATION, relaxation);
+    }
+}
+
+TEST(DynamicRelaxationTest, ChangeWhileInUse)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    k_lsm<uint32_t, uint32_t, DYNAMIC_RELAXATION> pq(4096);
+    std::multiset<uint32_t> elements;
+
+    for (int i = 0; i < PQ_SIZE; i++) {
+        const uint32_t v = rand_int(gen);
+        elements.insert(v);
+        pq.insert(v, v);
+    }
+
+    /* Tightening the bound also applies to previously inserted items. */
+
+    pq.set_relaxation(4);
+
+    uint32_t v;
+    for (int i = 0; pq.delete_min(v); i++) {
+        auto it = elements.find(v);
+        ASSERT_NE(elements.end(), it);
+        elements.erase(it);
+
+        if (i % 4 == 0) {
+            const uint32_t w = rand_int(gen);
+            elements.insert(w);
+            pq.insert(w, w);
+        }
+    }
+
+    ASSERT_TRUE(elements.empty());
+}
+
+TEST(DynamicRelaxationTest, AdaptiveRelaxation)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    shared_lsm<uint32_t, uint32_t, DYNAMIC_RELAXATION> pq(RELAXATION);
+    pq.set_adaptive_relaxation(4, 4096);
+    ASSERT_EQ(RELAXATION, pq.relaxation());
+
+    /* A single thread never contends and thus lowers the bound to its
+     * minimum. */
+
+    std::vector<uint32_t> elements;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        const uint32_t v = rand_int(gen);
+        elements.push_back(v);
+        pq.insert(v, v);
+    }
+
+    ASSERT_EQ(4, pq.relaxation());
+
+    std::sort(elements.begin(), elements.end());
+
+    uint32_t v;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(pq.delete_min(v));
+        ASSERT_LE(v, elements[std::min(i + RELAXATION, PQ_SIZE - 1)]);
+    }
+    ASSERT_FALSE(pq.delete_min(v));
+
+    /* Setting a fixed bound disables adaptivity. */
+
+    pq.set_relaxation(RELAXATION);
+    for (int i = 0; i < PQ_SIZE; i++) {
+        pq.insert(i, i);
+    }
+    ASSERT_EQ(RELAXATION, pq.relaxation());
+}
+
+TEST(DynamicRelaxationTest, LostTakesRaiseRelaxation)
+{
+    constexpr int MAX_ROUNDS = 16;
+
+    shared_lsm<uint32_t, uint32_t, DYNAMIC_RELAXATION> pq(RELAXATION);
+    pq.set_adaptive_relaxation(4, 4096);
+
+    /* Few enough uncontended inserts not to lower the bound. */
+
+    for (int i = 0; i < 2 * MAX_ROUNDS; i++) {
+        pq.insert(i, i);
+    }
+
+    /* Peeking twice returns the same item, which can only be taken once.
+     * The second take thus loses the item just as if it had been taken by
+     * another thread. */
+
+    uint32_t key, val;
+    for (int i = 0; i < MAX_ROUNDS && pq.relaxation() == RELAXATION; i++) {
+        auto first = block<uint32_t, uint32_t>::peek_t::EMPTY();
+        auto second = block<uint32_t, uint32_t>::peek_t::EMPTY();
+        pq.find_min(first);
+        pq.find_min(second);
+
+        ASSERT_TRUE(pq.take(first, key, val));
+        ASSERT_FALSE(pq.take(second, key, val));
+    }
+
+    ASSERT_LT(RELAXATION, pq.relaxation());
+    ASSERT_GE(4096, pq.relaxation());
+}
+
+TEST(DecreaseKeyTest, DecreaseKey)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    k_lsm<uint32_t, uint32_t, RELAXATION> pq;
+
+    /* Values are indices into handles and keys. */
+
+    std::vector<item_handle<uint32_t, uint32_t>> handles(PQ_SIZE);
+    std::vector<uint32_t> keys(PQ_SIZE);
+    for (uint32_t i = 0; i < PQ_SIZE; i++) {
+        keys[i] = rand_int(gen);
+        pq.insert(keys[i], i, handles[i]);
+    }
+
+    for (uint32_t i = 0; i < PQ_SIZE; i += 2) {
+        keys[i] /= 2;
+        ASSERT_TRUE(pq.decrease_key(handles[i], keys[i]));
+    }
+
+    std::vector<uint32_t> sorted_keys(keys);
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+
+    /* Each value is returned exactly once, with its latest key. */
+
+    std::vector<bool> deleted(PQ_SIZE, false);
+    uint32_t key, val;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(pq.delete_min(key, val));
+        ASSERT_FALSE(deleted[val]);
+        ASSERT_EQ(keys[val], key);
+        ASSERT_LE(key, sorted_keys[std::min(i + K_LSM_RANK_ERROR, PQ_SIZE - 1)]);
+        deleted[val] = true;
+    }
+
+    ASSERT_FALSE(pq.delete_min(key, val));
+    ASSERT_FALSE(pq.decrease_key(handles[0], 0));
+}
+
+/** A composite key ordered by deadline first and tenant second. */
+struct deadline_key {
+    uint32_t m_deadline;
+    uint32_t m_tenant;
+};
+
+struct deadline_key_less {
+    bool operator()(const deadline_key &lhs, const deadline_key &rhs) const
+    {
+        return (lhs.m_deadline < rhs.m_deadline)
+               || (lhs.m_deadline == rhs.m_deadline && lhs.m_tenant < rhs.m_tenant);
+    }
+};
+
+/** Deletes all items from pq and checks that each key is within the
+ *  relaxation bound of the sorted sequence of keys. */
+template <class PQ, class K, class Compare>
+static void
+check_relaxed_order(PQ &pq,
+                    std::vector<K> keys,
+                    const Compare &compare)
+{
+    const int n = keys.size();
+    std::sort(keys.begin(), keys.end(), compare);
+
+    K key;
+    uint32_t val;
+    for (int i = 0; i < n; i++) {
+        ASSERT_TRUE(pq.delete_min(key, val));
+        ASSERT_FALSE(compare(keys[std::min(i + K_LSM_RANK_ERROR, n - 1)], key));
+    }
+    ASSERT_FALSE(pq.delete_min(key, val));
+}
+
+TEST(CompareTest, MaxPriority)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    k_lsm<uint32_t, uint32_t, RELAXATION, std::greater<uint32_t>> pq;
+
+    std::vector<uint32_t> keys(PQ_SIZE);
+    for (int i = 0; i < PQ_SIZE; i++) {
+        keys[i] = rand_int(gen);
+        pq.insert(keys[i], i);
+    }
+
+    check_relaxed_order(pq, keys, std::greater<uint32_t>());
+}
+
+/** Deletes all items from pq in batches and checks that each batch is
+ *  ordered by compare, and that each key is within the relaxation bound. */
+template <class PQ, class Compare>
+static void
+check_delete_min_batch(PQ &pq,
+                       const Compare &compare)
+{
+    constexpr size_t BATCH_SIZE = 100;
+
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    std::vector<uint32_t> elements(PQ_SIZE);
+    for (int i = 0; i < PQ_SIZE; i++) {
+        elements[i] = rand_int(gen);
+        pq.insert(elements[i], elements[i]);
+    }
+    std::sort(elements.begin(), elements.end(), compare);
+
+    std::vector<uint32_t> keys(BATCH_SIZE), vals(BATCH_SIZE);
+
+    int i = 0;
+    while (i < PQ_SIZE) {
+        const size_t taken = pq.delete_min_batch(keys.data(), vals.data(), BATCH_SIZE);
+        ASSERT_LT(0u, taken);
+
+        for (size_t j = 0; j < taken; j++, i++) {
+            ASSERT_EQ(keys[j], vals[j]);
+            ASSERT_FALSE(compare(elements[std::min(i + K_LSM_RANK_ERROR, PQ_SIZE - 1)], keys[j]));
+            if (j > 0) {
+                ASSERT_FALSE(compare(keys[j], keys[j - 1]));
+            }
+        }
+    }
+
+    ASSERT_EQ(0u, pq.delete_min_batch(keys.data(), vals.data(), BATCH_SIZE));
+}
+
+TEST(CompareTest, DeleteMinBatch)
+{
+    k_lsm<uint32_t, uint32_t, RELAXATION, std::greater<uint32_t>> k_pq;
+    check_delete_min_batch(k_pq, std::greater<uint32_t>());
+
+    shared_lsm<uint32_t, uint32_t, RELAXATION, std::greater<uint32_t>> shared_pq;
+    check_delete_min_batch(shared_pq, std::greater<uint32_t>());
+}
+
+TEST(CompareTest, CompositeKey)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_deadline(0, 255);
+    std::uniform_int_distribution<> rand_tenant(0, 15);
+
+    k_lsm<deadline_key, uint32_t, RELAXATION, deadline_key_less> pq;
+
+    /* Deletions interleaved with insertions exercise resizing of the pivot
+     * range in both directions. */
+
+    std::vector<deadline_key> keys;
+    deadline_key key;
+    uint32_t val;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        keys.push_back({ (uint32_t)rand_deadline(gen), (uint32_t)rand_tenant(gen) });
+        pq.insert(keys.back(), i);
+
+        if (i % 4 == 0) {
+            ASSERT_TRUE(pq.delete_min(key, val));
+            keys[val] = { std::numeric_limits<uint32_t>::max(), 0 };
+        }
+    }
+
+    std::vector<deadline_key> remaining;
+    for (auto &k : keys) {
+        if (k.m_deadline != std::numeric_limits<uint32_t>::max()) {
+            remaining.push_back(k);
+        }
+    }
+
+    check_relaxed_order(pq, remaining, deadline_key_less());
+}
+
+TEST(KeyOnlyTest, ExtractAll)
+{
+    static_assert(sizeof(item<uint32_t, key_only>) < sizeof(item<uint32_t, uint32_t>),
+                  "key_only items must not store a value");
+
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    k_lsm<uint32_t, key_only, RELAXATION> pq;
+
+    std::vector<uint32_t> keys(PQ_SIZE);
+    for (int i = 0; i < PQ_SIZE; i++) {
+        keys[i] = rand_int(gen);
+        pq.insert(keys[i]);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    uint32_t key;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(pq.delete_min(key));
+        ASSERT_LE(key, keys[std::min(i + RELAXATION, PQ_SIZE - 1)]);
+    }
+    ASSERT_FALSE(pq.delete_min(key));
+}
+
+TEST(MoveOnlyValueTest, ExtractAll)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    k_lsm<uint32_t, std::unique_ptr<uint32_t>, RELAXATION> pq;
+
+    for (int i = 0; i < PQ_SIZE; i++) {
+        const uint32_t key = rand_int(gen);
+        if (i % 2 == 0) {
+            pq.insert(key, std::unique_ptr<uint32_t>(new uint32_t(key)));
+        } else {
+            pq.emplace(key, new uint32_t(key));
+        }
+    }
+
+    uint32_t key;
+    std::unique_ptr<uint32_t> val;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(pq.delete_min(key, val));
+        ASSERT_NE(nullptr, val.get());
+        ASSERT_EQ(key, *val);
+    }
+    ASSERT_FALSE(pq.delete_min(key, val));
+}
+
+static void
+insert_and_exit(k_lsm<uint32_t, uint32_t, RELAXATION> *pq,
+                const std::vector<uint32_t> *keys,
+                const bool deregister)
+{
+    for (uint32_t key : *keys) {
+        pq->insert(key, key);
+    }
+
+    if (deregister) {
+        pq->deregister_thread();
+    }
+}
+
+TEST(DeregisterTest, MigratesToShared)
+{
+    /* Few enough items to remain within the inserting thread's dist lsm. */
+    std::vector<uint32_t> keys { 5, 3, 8, 1, 7 };
+    std::vector<uint32_t> sorted_keys(keys);
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+
+    uint32_t peeked[RELAXATION];
+
+    /* Without deregistration, items are only reachable through spying,
+     * which top_k() does not perform. */
+
+    k_lsm<uint32_t, uint32_t, RELAXATION> stranded_pq;
+    std::thread(insert_and_exit, &stranded_pq, &keys, false).join();
+    ASSERT_EQ(0u, stranded_pq.top_k(peeked, RELAXATION));
+
+    /* Deregistered threads leave their items in the shared lsm. */
+
+    k_lsm<uint32_t, uint32_t, RELAXATION> pq;
+    std::thread(insert_and_exit, &pq, &keys, true).join();
+    ASSERT_EQ(keys.size(), pq.top_k(peeked, RELAXATION));
+
+    uint32_t v;
+    std::vector<uint32_t> deleted;
+    while (pq.delete_min(v)) {
+        deleted.push_back(v);
+    }
+    std::sort(deleted.begin(), deleted.end());
+    ASSERT_EQ(sorted_keys, deleted);
+}
+
+TEST(DeregisterTest, Participants)
+{
+    dist_lsm<uint32_t, uint32_t, RELAXATION> pq;
+    ASSERT_EQ(0u, pq.num_participants());
+
+    pq.insert(1, 1);
+    ASSERT_EQ(1u, pq.num_participants());
+
+    /* Participation does not end with an empty local lsm. */
+
+    uint32_t v;
+    ASSERT_TRUE(pq.delete_min(v));
+    ASSERT_FALSE(pq.delete_min(v));
+    ASSERT_EQ(1u, pq.num_participants());
+
+    pq.deregister_thread();
+    ASSERT_EQ(0u, pq.num_participants());
+
+    /* Items left behind remain reachable through spying. */
+
+    pq.insert(2, 2);
+    pq.deregister_thread();
+    ASSERT_EQ(1u, pq.num_participants());
+
+    std::thread([&pq]() { pq.insert(3, 3); }).join();
+    ASSERT_EQ(2u, pq.num_participants());
+}
+
+/**
+ * Merged blocks which exceed the relaxation bound are built within the shared
+ * lsm instead of being copied into it.
+ */
+TEST(HandoffTest, NoCopies)
+{
+    static constexpr uint32_t NITEMS = 16 * RELAXATION;
+
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<uint32_t> rand_int;
+
+    k_lsm<uint32_t, uint32_t, RELAXATION> pq;
+
+    const size_t slsm_inserts = COUNTERS.slsm_inserts;
+    const size_t slsm_copied_items = COUNTERS.slsm_copied_items;
+
+    for (uint32_t i = 0; i < NITEMS; i++) {
+        const uint32_t v = rand_int(gen);
+        pq.insert(v, v);
+    }
+
+    ASSERT_LT(slsm_inserts, COUNTERS.slsm_inserts);
+    ASSERT_EQ(slsm_copied_items, COUNTERS.slsm_copied_items);
+
+    uint32_t v;
+    for (uint32_t i = 0; i < NITEMS; i++) {
+        ASSERT_TRUE(pq.delete_min(v));
+    }
+    ASSERT_FALSE(pq.delete_min(v));
+}
+
+struct intrusive_task : public item_hook<uint32_t, intrusive_task> {
+    uint32_t m_id;
+};
+
+TEST(IntrusiveTest, Reinsert)
+{
+    std::mt19937 gen(DEFAULT_SEED);
+    std::uniform_int_distribution<> rand_int;
+
+    k_lsm<uint32_t, intrusive<intrusive_task>, RELAXATION> pq;
+
+    std::vector<intrusive_task> tasks(PQ_SIZE);
+    std::vector<uint32_t> keys(PQ_SIZE);
+    for (uint32_t i = 0; i < PQ_SIZE; i++) {
+        tasks[i].m_id = i;
+        keys[i] = rand_int(gen);
+        pq.insert(keys[i], &tasks[i]);
+    }
+
+    /* Removed objects may be reinserted right away. */
+
+    uint32_t key;
+    intrusive_task *task;
+    for (int i = 0; i < PQ_SIZE / 2; i++) {
+        ASSERT_TRUE(pq.delete_min(key, task));
+        ASSERT_EQ(keys[task->m_id], key);
+        keys[task->m_id] = rand_int(gen);
+        pq.insert(keys[task->m_id], task);
+    }
+
+    std::vector<uint32_t> sorted_keys(keys);
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+
+    std::vector<bool> deleted(PQ_SIZE, false);
+    for (int i = 0; i < PQ_SIZE; i++) {
+        ASSERT_TRUE(pq.delete_min(key, task));
+        ASSERT_FALSE(deleted[task->m_id]);
+        ASSERT_EQ(keys[task->m_id], key);
+        ASSERT_LE(key, sorted_keys[std::min(i + K_LSM_RANK_ERROR, PQ_SIZE - 1)]);
+        deleted[task->m_id] = true;
+    }
+    ASSERT_FALSE(pq.delete_min(task));
+}
+
+static void
+fill_and_drain(k_lsm<uint32_t, uint32_t, RELAXATION> &pq,
+               const int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<uint32_t> rand_int;
+
+    std::vector<uint32_t> keys;
+    for (int i = 0; i < PQ_SIZE; i++) {
+        keys.push_back(rand_int(gen));
+        pq.insert(keys.back(), keys.back());
+    }
+
+    uint32_t v;
+    std::vector<uint32_t> deleted;
+    while (pq.delete_min(v)) {
+        deleted.push_back(v);
+    }
+
+    std::sort(keys.begin(), keys.end());
+    std::sort(deleted.begin(), deleted.end());
+    ASSERT_EQ(keys, deleted);
+}
+
+TEST(TrimTest, AfterPeak)
+{
+    k_lsm<uint32_t, uint32_t, RELAXATION> pq;
+
+    fill_and_drain(pq, DEFAULT_SEED);
+    ASSERT_GT(pq.trim(), 0u);
+
+    /* Released memory is reused transparently. */
+
+    fill_and_drain(pq, DEFAULT_SEED + 1);
+    ASSERT_GT(pq.trim(), 0u);
+}
+
+TEST(TrimTest, AutoTrim)
+{
+    k_lsm<uint32_t, uint32_t, RELAXATION> pq;
+    pq.set_auto_trim(2);
+
+    fill_and_drain(pq, DEFAULT_SEED);
+    const size_t trimmed = COUNTERS.trimmed_bytes;
+
+    /* fill_and_drain() ends with the first of two empty deletions. */
+
+    uint32_t v;
+    ASSERT_FALSE(pq.delete_min(v));
+    ASSERT_GT(COUNTERS.trimmed_bytes, trimmed);
+    ASSERT_EQ(0u, pq.trim());
+}
+
+static void
+insert_range_and_wait(dist_lsm<uint32_t, uint32_t, RELAXATION> *pq,
+                      const uint32_t first,
+                      const uint32_t last,
+                      std::atomic<int> *inserted,
+                      std::atomic<bool> *done)
+{
+    for (uint32_t key = first; key < last; key++) {
+        pq->insert(key, key);
+    }
+    inserted->fetch_add(1);
+
+    /* Thread ids and their local lsms are recycled once a thread exits. */
+    while (!done->load()) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * Items of other threads are only reachable through spying. Spying by
+ * topology remembers its last victim, but must eventually move on to all
+ * others and never hand out an item twice.
+ */
+TEST(SpyTest, TopologyPolicy)
+{
+    static constexpr int NTHREADS = 4;
+    /* Spies only copy the head block, all items of each thread are thus
+     * inserted into a single block. */
+    static constexpr uint32_t NITEMS = 1024;
+
+    dist_lsm<uint32_t, uint32_t, RELAXATION> pq;
+    pq.set_spy_policy(SPY_TOPOLOGY);
+    ASSERT_EQ(SPY_TOPOLOGY, pq.spy_policy());
+
+    std::atomic<int> inserted(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NTHREADS; i++) {
+        threads.emplace_back(insert_range_and_wait, &pq, i * NITEMS, (i + 1) * NITEMS,
+                             &inserted, &done);
+    }
+    while (inserted.load() != NTHREADS) {
+        std::this_thread::yield();
+    }
+
+    const size_t spies = COUNTERS.local_spies + COUNTERS.remote_spies;
+
+    uint32_t v;
+    std::set<uint32_t> deleted;
+    for (uint32_t i = 0; i < 100 * NTHREADS * NITEMS && deleted.size() < NTHREADS * NITEMS; i++) {
+        if (pq.delete_min(v)) {
+            ASSERT_TRUE(deleted.insert(v).second);
+        }
+    }
+
+    done.store(true);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    ASSERT_EQ(NTHREADS * NITEMS, deleted.size());
+    ASSERT_LT(spies, COUNTERS.local_spies + COUNTERS.remote_spies);
+}
+
+/**
+ * Stealing copies only a bounded number of each victim's smallest items,
+ * but all items must remain reachable.
+ */
+TEST(SpyTest, Steal)
+{
+    static constexpr int NTHREADS = 4;
+    static constexpr uint32_t NITEMS = 1000;
+    static constexpr size_t STEAL = 16;
+
+    dist_lsm<uint32_t, uint32_t, RELAXATION> pq;
+    pq.set_spy_steal(STEAL);
+    ASSERT_EQ(STEAL, pq.spy_steal());
+
+    std::atomic<int> inserted(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NTHREADS; i++) {
+        threads.emplace_back(insert_range_and_wait, &pq, i * NITEMS, (i + 1) * NITEMS,
+                             &inserted, &done);
+    }
+    while (inserted.load() != NTHREADS) {
+        std::this_thread::yield();
+    }
+
+    const size_t spies = COUNTERS.local_spies + COUNTERS.remote_spies;
+    const size_t spied_items = COUNTERS.spied_items;
+    const size_t spied_take_failures = COUNTERS.spied_take_failures;
+
+    uint32_t v;
+    std::set<uint32_t> deleted;
+    for (uint32_t i = 0; i < 100 * NTHREADS * NITEMS && deleted.size() < NTHREADS * NITEMS; i++) {
+        if (pq.delete_min(v)) {
+            ASSERT_TRUE(deleted.insert(v).second);
+        }
+    }
+
+    done.store(true);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    /* Unlike copies of the largest block, stolen items span all blocks. */
+    ASSERT_EQ(NTHREADS * NITEMS, deleted.size());
+    ASSERT_LE(COUNTERS.spied_items - spied_items,
+              STEAL * (COUNTERS.local_spies + COUNTERS.remote_spies - spies));
+
+    /* Victims are idle, and consecutive steals do not overlap. */
+    ASSERT_EQ(spied_take_failures, COUNTERS.spied_take_failures);
+}
+
 TYPED_TEST(PQTest, InsDel)
 {
     this->generate_elements(0);
@@ -18,7 +18,9 @@
  */
 
 #include <gtest/gtest.h>
+#include <memory>
 #include <random>
+#include <set>
 #include <vector>
 #include <thread>
 
@@ -80,6 +82,70 @@ TEST(BlockArrayTest, Copy)
     delete b;
 }
 
+static block<uint32_t, uint32_t> *
+new_block_of(block_pool<uint32_t, uint32_t> &pool,
+             const uint32_t first_key,
+             const size_t power_of_2,
+             std::vector<std::unique_ptr<item<uint32_t, uint32_t>>> &items)
+{
+    auto b = pool.get_block(power_of_2);
+    for (size_t i = 0; i < ((size_t)1 << power_of_2); i++) {
+        items.emplace_back(new item<uint32_t, uint32_t>());
+        auto it = items.back().get();
+        it->initialize(first_key + i, first_key + i);
+        b->insert_tail(it, it->version());
+    }
+    return b;
+}
+
+/**
+ * Copies of older versions only need to copy the blocks which have been
+ * changed since, unless pivots have been recalculated.
+ */
+TEST(BlockArrayTest, Update)
+{
+    block_pool<uint32_t, uint32_t> pool;
+    std::vector<std::unique_ptr<item<uint32_t, uint32_t>>> items;
+
+    /* Blocks of larger keys leave the pivot range (and thus the remaining
+     * pivots) untouched. */
+
+    default_block_array versions[3];
+    const uint32_t first_keys[] = { 0, 1000, 2000 };
+    for (size_t v = 0; v < 3; v++) {
+        if (v > 0) {
+            versions[v].copy_from(&versions[v - 1]);
+        }
+        versions[v].increment_version();
+        versions[v].insert(new_block_of(pool, first_keys[v], 6 - v, items), &pool);
+        versions[v].stamp_changes();
+    }
+
+    default_block_array bs;
+    bs.copy_from(&versions[0]);
+    ASSERT_TRUE(bs.update_from(&versions[2]));
+    ASSERT_EQ(versions[2].version(), bs.version());
+
+    std::set<uint32_t> deleted;
+    uint32_t x;
+    while (bs.delete_min(x)) {
+        ASSERT_TRUE(deleted.insert(x).second);
+    }
+    ASSERT_EQ(items.size(), deleted.size());
+
+    /* Smaller keys require recalculating the pivots. */
+
+    default_block_array smaller;
+    smaller.copy_from(&versions[0]);
+    smaller.increment_version();
+    smaller.insert(new_block_of(pool, 0, 5, items), &pool);
+    smaller.stamp_changes();
+
+    default_block_array cs;
+    cs.copy_from(&versions[0]);
+    ASSERT_FALSE(cs.update_from(&smaller));
+}
+
 TEST(BlockArrayTest, DeleteMinEmpty)
 {
     default_block_array bs;
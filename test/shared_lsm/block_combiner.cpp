@@ -0,0 +1,402 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "shared_lsm/block_combiner.h"
+#include "shared_lsm/shared_lsm_local.h"
+
+using namespace kpq;
+
+#define NTHREADS (16)
+#define RELAXATION (32)
+
+typedef block<uint32_t, uint32_t> block_t;
+typedef block_combiner<uint32_t, uint32_t> combiner_t;
+
+TEST(BlockCombinerTest, SanityCheck)
+{
+    combiner_t c;
+}
+
+TEST(BlockCombinerTest, PostClaimRelease)
+{
+    combiner_t c;
+    block_t b(0);
+
+    block_t *claimed[combiner_t::NUM_SLOTS];
+    int slots[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(0u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+    ASSERT_FALSE(c.published(slot, &b));
+    ASSERT_FALSE(c.claimed(slot, &b));
+
+    ASSERT_EQ(1u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+    ASSERT_EQ(&b, claimed[0]);
+    ASSERT_EQ(slot, slots[0]);
+    ASSERT_TRUE(c.claimed(slot, &b));
+    ASSERT_FALSE(c.published(slot, &b));
+
+    /* Claimed blocks can be neither claimed again nor retracted. */
+    ASSERT_EQ(0u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+    ASSERT_FALSE(c.retract(slot, &b));
+
+    ASSERT_TRUE(c.confirm(slot, &b));
+    ASSERT_TRUE(c.claimed(slot, &b));
+    ASSERT_FALSE(c.published(slot, &b));
+
+    c.release(claimed, slots, 1);
+    ASSERT_TRUE(c.published(slot, &b));
+}
+
+TEST(BlockCombinerTest, Retract)
+{
+    combiner_t c;
+    block_t b(0);
+
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+    ASSERT_TRUE(c.retract(slot, &b));
+
+    block_t *claimed[combiner_t::NUM_SLOTS];
+    int slots[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(0u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+}
+
+TEST(BlockCombinerTest, SlotsExhausted)
+{
+    combiner_t c;
+    std::vector<std::unique_ptr<block_t>> bs;
+
+    for (size_t i = 0; i < combiner_t::NUM_SLOTS; i++) {
+        bs.emplace_back(new block_t(0));
+        ASSERT_NE(-1, c.post(bs.back().get()));
+    }
+
+    block_t b(0);
+    ASSERT_EQ(-1, c.post(&b));
+
+    /* Claims are bounded by the given capacity. */
+    block_t *claimed[combiner_t::NUM_SLOTS];
+    int slots[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(2u, c.claim(claimed, slots, 2));
+    ASSERT_TRUE(c.confirm(slots[0], claimed[0]));
+    ASSERT_TRUE(c.confirm(slots[1], claimed[1]));
+    c.release(claimed, slots, 2);
+    ASSERT_NE(-1, c.post(&b));
+}
+
+/**
+ * A poster does not wait for a delayed claimer, but withdraws its block.
+ * The claimer then discards its merge and frees the slot.
+ */
+TEST(BlockCombinerTest, WithdrawFromDelayedClaimer)
+{
+    combiner_t c;
+    block_t b(0);
+
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+
+    block_t *claimed[combiner_t::NUM_SLOTS];
+    int slots[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(1u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+
+    /* The claimer is delayed before confirming its merge. */
+
+    bool merging = false;
+    ASSERT_FALSE(c.wait_published(slot, &b, merging));
+    ASSERT_TRUE(merging);
+    ASSERT_FALSE(c.claimed(slot, &b));
+    ASSERT_TRUE(c.withdrawn(slot, &b));
+
+    /* The slot is not reused before the claimer resumes. */
+
+    block_t b2(0);
+    const int slot2 = c.post(&b2);
+    ASSERT_NE(-1, slot2);
+    ASSERT_NE(slot, slot2);
+
+    ASSERT_FALSE(c.confirm(slots[0], claimed[0]));
+    ASSERT_FALSE(c.withdrawn(slot, &b));
+
+    ASSERT_EQ(1u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+    ASSERT_EQ(&b2, claimed[0]);
+
+    block_t b3(0);
+    ASSERT_EQ(slot, c.post(&b3));
+}
+
+/**
+ * A block withdrawn while claimed may be reposted by its poster and claimed
+ * again before its first claimer resumes. The first claimer's stale confirm
+ * must neither succeed nor disturb the second claim.
+ */
+TEST(BlockCombinerTest, RepostWithdrawnWhileClaimed)
+{
+    combiner_t c;
+    block_t b(0);
+
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+
+    block_t *claimed1[combiner_t::NUM_SLOTS];
+    int slots1[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(1u, c.claim(claimed1, slots1, combiner_t::NUM_SLOTS));
+
+    bool merging = false;
+    ASSERT_TRUE(c.withdraw(slot, &b, merging));
+    ASSERT_TRUE(merging);
+
+    const int slot2 = c.post(&b);
+    ASSERT_NE(-1, slot2);
+    ASSERT_NE(slot, slot2);
+
+    block_t *claimed2[combiner_t::NUM_SLOTS];
+    int slots2[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(1u, c.claim(claimed2, slots2, combiner_t::NUM_SLOTS));
+    ASSERT_EQ(&b, claimed2[0]);
+
+    ASSERT_FALSE(c.confirm(slots1[0], claimed1[0]));
+    ASSERT_TRUE(c.claimed(slot2, &b));
+    ASSERT_FALSE(c.published(slot2, &b));
+
+    ASSERT_TRUE(c.confirm(slots2[0], claimed2[0]));
+    c.release(claimed2, slots2, 1);
+    ASSERT_TRUE(c.published(slot2, &b));
+}
+
+/**
+ * Parked blocks are not handed out again until they are unparked.
+ */
+TEST(BlockCombinerTest, ParkedBlocksAreNotReused)
+{
+    block_pool<uint32_t, uint32_t> pool;
+
+    block_t *b = pool.get_block(0);
+    pool.park(b);
+    pool.free_local();
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_NE(b, pool.get_block(0));
+        pool.free_local();
+    }
+
+    pool.unpark(b);
+    ASSERT_EQ(b, pool.get_block(0));
+}
+
+/**
+ * A merged block may be withdrawn as well, in which case its claimer still
+ * frees the slot once it publishes its merge result.
+ */
+TEST(BlockCombinerTest, WithdrawMerged)
+{
+    combiner_t c;
+    block_t b(0);
+
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+
+    block_t *claimed[combiner_t::NUM_SLOTS];
+    int slots[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(1u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+    ASSERT_TRUE(c.confirm(slots[0], claimed[0]));
+
+    /* The claimer is delayed before publishing its merge result. */
+
+    bool merging = true;
+    ASSERT_FALSE(c.wait_published(slot, &b, merging));
+    ASSERT_FALSE(merging);
+    ASSERT_FALSE(c.claimed(slot, &b));
+    ASSERT_TRUE(c.withdrawn(slot, &b));
+
+    block_t b2(0);
+    const int slot2 = c.post(&b2);
+    ASSERT_NE(-1, slot2);
+    ASSERT_NE(slot, slot2);
+
+    ASSERT_EQ(0u, c.release(claimed, slots, 1));
+    ASSERT_FALSE(c.withdrawn(slot, &b));
+
+    block_t b3(0);
+    ASSERT_EQ(slot, c.post(&b3));
+}
+
+/**
+ * A claimer which stalls after merging a block does not block the insert of
+ * its poster. Both publish the block's items, each of which is nonetheless
+ * deleted exactly once.
+ */
+TEST(BlockCombinerTest, StalledClaimer)
+{
+    versioned_array_ptr<uint32_t, uint32_t, RELAXATION> global_array;
+    relaxation<RELAXATION> rlx;
+    shared_lsm_local<uint32_t, uint32_t, RELAXATION> poster;
+    shared_lsm_local<uint32_t, uint32_t, RELAXATION> claimer;
+
+    item<uint32_t, uint32_t> it;
+    it.initialize(1, 1);
+
+    block_t b(0);
+    b.set_used();
+    b.insert(&it, it.version());
+
+    auto &c = global_array.combiner();
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+
+    /* The claimer merges b and stalls before its global array update. */
+
+    block_t *claimed[combiner_t::NUM_SLOTS];
+    int slots[combiner_t::NUM_SLOTS];
+    ASSERT_EQ(1u, c.claim(claimed, slots, combiner_t::NUM_SLOTS));
+    block_t merged(0);
+    merged.set_used();
+    merged.copy(&b);
+    ASSERT_TRUE(c.confirm(slots[0], claimed[0]));
+
+    bool merging;
+    ASSERT_FALSE(c.wait_published(slot, &b, merging));
+    ASSERT_FALSE(merging);
+    poster.insert(&b, global_array, rlx);
+
+    /* The claimer resumes and publishes its merge result. */
+
+    claimer.insert(&merged, global_array, rlx);
+    ASSERT_EQ(0u, c.release(claimed, slots, 1));
+
+    uint32_t v;
+    std::vector<uint32_t> deleted;
+    while (poster.delete_min(v, global_array, rlx)) {
+        deleted.push_back(v);
+    }
+    ASSERT_EQ(std::vector<uint32_t>({ 1 }), deleted);
+}
+
+static void
+post_and_wait(combiner_t *c,
+              block_t *b,
+              std::atomic<int> *published)
+{
+    for (int i = 0; i < 100; i++) {
+        int slot;
+        while ((slot = c->post(b)) == -1) {
+            std::this_thread::yield();
+        }
+
+        bool merging;
+        if (c->wait_published(slot, b, merging)) {
+            published->fetch_add(1);
+        }
+    }
+}
+
+/**
+ * Every posted block is either withdrawn by its poster or released by its
+ * claimer, and its poster observes publication exactly for blocks which are
+ * released without having been withdrawn.
+ */
+TEST(BlockCombinerTest, Concurrent)
+{
+    combiner_t c;
+    std::vector<std::unique_ptr<block_t>> bs;
+    std::atomic<int> published(0);
+    std::atomic<bool> done(false);
+    std::atomic<int> released(0);
+
+    std::thread claimer([&]() {
+        block_t *claimed[combiner_t::NUM_SLOTS];
+        int slots[combiner_t::NUM_SLOTS];
+        while (!done.load()) {
+            const size_t n = c.claim(claimed, slots, combiner_t::NUM_SLOTS);
+            size_t nconfirmed = 0;
+            for (size_t i = 0; i < n; i++) {
+                std::this_thread::yield();
+                if (c.confirm(slots[i], claimed[i])) {
+                    claimed[nconfirmed] = claimed[i];
+                    slots[nconfirmed] = slots[i];
+                    nconfirmed++;
+                }
+            }
+            std::this_thread::yield();
+            released.fetch_add(c.release(claimed, slots, nconfirmed));
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NTHREADS; i++) {
+        bs.emplace_back(new block_t(0));
+        threads.emplace_back(post_and_wait, &c, bs.back().get(), &published);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    done.store(true);
+    claimer.join();
+
+    ASSERT_EQ(released.load(), published.load());
+}
+
+/**
+ * A posted block is published by the next insert into the shared lsm.
+ */
+TEST(BlockCombinerTest, PublishedByInsert)
+{
+    versioned_array_ptr<uint32_t, uint32_t, RELAXATION> global_array;
+    relaxation<RELAXATION> rlx;
+    shared_lsm_local<uint32_t, uint32_t, RELAXATION> local;
+
+    item<uint32_t, uint32_t> it;
+    it.initialize(1, 1);
+
+    block_t b(0);
+    b.set_used();
+    b.insert(&it, it.version());
+
+    auto &c = global_array.combiner();
+    const int slot = c.post(&b);
+    ASSERT_NE(-1, slot);
+
+    local.insert(2, 2, global_array, rlx);
+    ASSERT_TRUE(c.published(slot, &b));
+
+    uint32_t v;
+    std::set<uint32_t> deleted;
+    while (local.delete_min(v, global_array, rlx)) {
+        deleted.insert(v);
+    }
+    ASSERT_EQ(std::set<uint32_t>({ 1, 2 }), deleted);
+}
+
+int
+main(int argc,
+     char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -46,9 +46,11 @@ TEST(VersionedArrayPtrTest, Sequential)
 
     auto old_ptr = ptr.load_packed();
     auto old_version = ptr.load()->version();
-    ASSERT_NE(nullptr, old_ptr);
+    ASSERT_NE(nullptr, ptr.unpack(old_ptr));
     ASSERT_EQ(0, ptr.load()->version());
+#ifndef ENABLE_WIDE_CAS
     ASSERT_EQ(old_version & MASK, ((intptr_t)old_ptr) & MASK);
+#endif
     ASSERT_TRUE(vap::matches(old_ptr, old_version));
 
     aba new_array;
@@ -60,11 +62,39 @@ TEST(VersionedArrayPtrTest, Sequential)
     auto new_ptr = ptr.load_packed();
 
     ASSERT_EQ(new_array.ptr(), ptr.load());
+    ASSERT_EQ(new_version, ptr.version());
+#ifndef ENABLE_WIDE_CAS
     ASSERT_EQ(new_array.ptr()->version(), ((intptr_t)new_ptr) & MASK);
+#endif
     ASSERT_FALSE(vap::matches(new_ptr, old_version));
     ASSERT_TRUE(vap::matches(new_ptr, new_version));
 }
 
+#ifdef ENABLE_WIDE_CAS
+/**
+ * Unlike the packed pointer, the wide pointer distinguishes versions which
+ * are equal modulo the array alignment.
+ */
+TEST(VersionedArrayPtrTest, ExactVersion)
+{
+    vap ptr;
+    aba new_array;
+
+    auto old_ptr = ptr.load_packed();
+    for (int i = 0; i < ARRAY_ALIGNMENT; i++) {
+        new_array.ptr()->copy_from(ptr.unpack(old_ptr));
+        new_array.ptr()->increment_version();
+        ASSERT_TRUE(ptr.compare_exchange_strong(old_ptr, new_array));
+        old_ptr = ptr.load_packed();
+    }
+
+    ASSERT_EQ(ARRAY_ALIGNMENT, ptr.version());
+    ASSERT_EQ(new_array.ptr(), ptr.unpack(old_ptr));
+    ASSERT_TRUE(vap::matches(old_ptr, ARRAY_ALIGNMENT));
+    ASSERT_FALSE(vap::matches(old_ptr, 0));
+}
+#endif
+
 static void
 compare_exchange_local(std::atomic<bool> *can_continue,
                        std::atomic<int> *num_done,
@@ -73,7 +103,7 @@ compare_exchange_local(std::atomic<bool> *can_continue,
     constexpr int N = 1024;
 
     aba new_array;
-    ba *old_array;
+    vap::packed_t old_array;
 
     while (!can_continue->load()) { }
 
@@ -0,0 +1,109 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <future>
+#include <gtest/gtest.h>
+#include <thread>
+
+#define ENABLE_EPOCH_RECLAMATION
+#include "util/epoch.h"
+
+using namespace kpq;
+
+TEST(EpochTest, AdvanceWhenQuiescent)
+{
+    epoch_domain domain;
+    const uint64_t retired = domain.current();
+
+    ASSERT_FALSE(domain.reclaimable(retired));
+    ASSERT_TRUE(domain.try_advance());
+    ASSERT_TRUE(domain.try_advance());
+    ASSERT_TRUE(domain.reclaimable(retired));
+}
+
+TEST(EpochTest, CriticalSectionBlocksReclamation)
+{
+    epoch_domain domain;
+
+    domain.enter();
+    const uint64_t retired = domain.current();
+
+    /* The first advance is possible since the critical section has observed
+     * the current epoch, the second is not. */
+
+    ASSERT_TRUE(domain.try_advance());
+    ASSERT_FALSE(domain.try_advance());
+    ASSERT_FALSE(domain.reclaimable(retired));
+
+    domain.exit();
+
+    ASSERT_TRUE(domain.try_advance());
+    ASSERT_TRUE(domain.reclaimable(retired));
+}
+
+TEST(EpochTest, Nesting)
+{
+    epoch_domain domain;
+
+    {
+        epoch_guard outer(domain);
+        {
+            epoch_guard inner(domain);
+        }
+
+        ASSERT_TRUE(domain.try_advance());
+        ASSERT_FALSE(domain.try_advance());
+    }
+
+    ASSERT_TRUE(domain.try_advance());
+}
+
+TEST(EpochTest, OtherThread)
+{
+    epoch_domain domain;
+    std::promise<void> entered;
+    std::promise<void> can_exit;
+
+    std::thread t([&]() {
+        epoch_guard guard(domain);
+        entered.set_value();
+        can_exit.get_future().wait();
+    });
+
+    entered.get_future().wait();
+    const uint64_t retired = domain.current();
+
+    ASSERT_TRUE(domain.try_advance());
+    ASSERT_FALSE(domain.try_advance());
+    ASSERT_FALSE(domain.reclaimable(retired));
+
+    can_exit.set_value();
+    t.join();
+
+    ASSERT_TRUE(domain.try_advance());
+    ASSERT_TRUE(domain.reclaimable(retired));
+}
+
+int
+main(int argc,
+     char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -98,6 +98,33 @@ TEST(LockfreeVectorTest, AllocHigh)
     ASSERT_EQ(*x2, 2);
 }
 
+TEST(LockfreeVectorTest, TryGet)
+{
+    kpq::lockfree_vector<uint32_t> v;
+
+    ASSERT_EQ(v.try_get(0), nullptr);
+    ASSERT_EQ(v.try_get(5), nullptr);
+
+    uint32_t *x = v.get(5);
+    *x = 5;
+
+    /* Elements are constructed individually, not per bucket. */
+
+    ASSERT_EQ(v.try_get(5), x);
+    ASSERT_EQ(v.try_get(4), nullptr);
+    ASSERT_EQ(v.try_get(0), nullptr);
+}
+
+TEST(LockfreeVectorTest, CacheLineAligned)
+{
+    kpq::lockfree_vector<uint32_t> v;
+
+    for (int i = 0; i < 64; i++) {
+        const uintptr_t p = reinterpret_cast<uintptr_t>(v.get(i));
+        ASSERT_EQ(0u, p % kpq::lockfree_vector<uint32_t>::CACHE_LINE_SIZE);
+    }
+}
+
 static void
 alloc_bucket(kpq::lockfree_vector<uint32_t> *v,
              const int i,
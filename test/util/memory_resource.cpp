@@ -0,0 +1,264 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "k_lsm/k_lsm.h"
+#include "util/memory_resource.h"
+
+using namespace kpq;
+
+/** Counts the bytes currently allocated through it. */
+class counting_resource : public memory_resource
+{
+public:
+    counting_resource() : m_bytes(0), m_allocations(0) { }
+
+    size_t bytes() const { return m_bytes; }
+    size_t allocations() const { return m_allocations; }
+
+private:
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        m_bytes += bytes;
+        m_allocations++;
+        return get_system_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t alignment) override
+    {
+        m_bytes -= bytes;
+        get_system_resource()->deallocate(p, bytes, alignment);
+    }
+
+private:
+    std::atomic<size_t> m_bytes;
+    std::atomic<size_t> m_allocations;
+};
+
+static bool
+is_aligned(const void *p,
+           const size_t alignment)
+{
+    return ((uintptr_t)p & (alignment - 1)) == 0;
+}
+
+TEST(MemoryResourceTest, SystemAlignment)
+{
+    memory_resource *r = get_system_resource();
+
+    for (size_t alignment = 8; alignment <= (1 << 22); alignment <<= 1) {
+        void *p = r->allocate(100, alignment);
+        ASSERT_NE(nullptr, p);
+        ASSERT_TRUE(is_aligned(p, alignment));
+        memset(p, 0x2a, 100);
+        r->deallocate(p, 100, alignment);
+    }
+}
+
+TEST(MemoryResourceTest, DefaultResource)
+{
+    counting_resource r;
+
+    ASSERT_EQ(get_system_resource(), get_default_resource());
+    ASSERT_EQ(get_system_resource(), set_default_resource(&r));
+    ASSERT_EQ(&r, get_default_resource());
+    ASSERT_EQ(&r, set_default_resource(nullptr));
+    ASSERT_EQ(get_system_resource(), get_default_resource());
+}
+
+TEST(MemoryResourceTest, ArenaBump)
+{
+    counting_resource upstream;
+
+    {
+        arena_resource arena(&upstream, 1 << 16);
+
+        char *p = static_cast<char *>(arena.allocate(100, 8));
+        char *q = static_cast<char *>(arena.allocate(100, 64));
+        ASSERT_TRUE(is_aligned(q, 64));
+        ASSERT_LT(p, q);
+        ASSERT_GE(q, p + 100);
+        ASSERT_EQ(1u, upstream.allocations());
+
+        /* Oversized allocations do not discard the current chunk. */
+        void *large = arena.allocate(1 << 16, 4096);
+        ASSERT_TRUE(is_aligned(large, 4096));
+        char *r = static_cast<char *>(arena.allocate(100, 8));
+        ASSERT_EQ(2u, upstream.allocations());
+        ASSERT_GT(r, q);
+        ASSERT_LT(r, p + (1 << 16));
+
+        arena.deallocate(p, 100, 8);
+        ASSERT_EQ(arena.upstream_bytes(), upstream.bytes());
+
+        arena.release();
+        ASSERT_EQ(0u, upstream.bytes());
+        ASSERT_EQ(0u, arena.upstream_bytes());
+
+        arena.allocate(100, 8);
+        ASSERT_NE(0u, upstream.bytes());
+    }
+
+    ASSERT_EQ(0u, upstream.bytes());
+}
+
+TEST(MemoryResourceTest, HugePages)
+{
+    static constexpr size_t HUGE_PAGE_SIZE = huge_page_resource::HUGE_PAGE_SIZE;
+    counting_resource upstream;
+
+    /* Explicit huge pages fall back to transparent ones if none are
+     * reserved. */
+    for (auto mode : { huge_page_resource::TRANSPARENT, huge_page_resource::EXPLICIT }) {
+        huge_page_resource r(mode, 1 << 20, &upstream);
+
+        void *small = r.allocate(4096, 64);
+        ASSERT_EQ(4096u, upstream.bytes());
+
+        void *p = r.allocate(3 << 20, 64);
+        ASSERT_NE(nullptr, p);
+        ASSERT_TRUE(is_aligned(p, HUGE_PAGE_SIZE));
+        ASSERT_EQ(4096u, upstream.bytes());
+        memset(p, 0x2a, 3 << 20);
+
+        r.deallocate(p, 3 << 20, 64);
+        r.deallocate(small, 4096, 64);
+        ASSERT_EQ(0u, upstream.bytes());
+    }
+}
+
+TEST(MemoryResourceTest, Numa)
+{
+    numa_resource r(0);
+    ASSERT_EQ(0, r.node());
+
+    void *p = r.allocate(1 << 20, 4096);
+    ASSERT_TRUE(is_aligned(p, 4096));
+    memset(p, 0x2a, 1 << 20);
+    r.deallocate(p, 1 << 20, 4096);
+}
+
+TEST(MemoryResourceTest, NumaLocal)
+{
+    counting_resource upstream;
+    numa_local_resource r(&upstream, 1024);
+
+    ASSERT_GE(current_numa_node(), 0);
+
+    void *small = r.allocate(100, 64);
+    ASSERT_EQ(100u, upstream.bytes());
+
+    void *p = r.allocate(1 << 20, 4096);
+    ASSERT_TRUE(is_aligned(p, 4096));
+    ASSERT_EQ(100u, upstream.bytes());
+    memset(p, 0x2a, 1 << 20);
+
+    r.deallocate(p, 1 << 20, 4096);
+    r.deallocate(small, 100, 64);
+    ASSERT_EQ(0u, upstream.bytes());
+}
+
+/**
+ * Allocates all memory of a k-lsm from a counting default resource and
+ * verifies that it is returned once the queue is gone.
+ */
+TEST(MemoryResourceTest, DefaultResourceQueue)
+{
+    static constexpr int NTHREADS = 4;
+    static constexpr int NITEMS = 1 << 14;
+
+    counting_resource r;
+    set_default_resource(&r);
+
+    {
+        k_lsm<uint32_t, uint32_t, 16> pq;
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < NTHREADS; i++) {
+            threads.emplace_back([&pq, i]() {
+                for (int j = 0; j < NITEMS; j++) {
+                    pq.insert(j * NTHREADS + i, j);
+                }
+                uint32_t v;
+                for (int j = 0; j < NITEMS / 2; j++) {
+                    pq.delete_min(v);
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        ASSERT_GT(r.bytes(), NTHREADS * NITEMS * sizeof(uint32_t));
+    }
+
+    set_default_resource(nullptr);
+    ASSERT_EQ(0u, r.bytes());
+}
+
+/**
+ * Queues constructed with a resource allocate all their memory from it,
+ * and none from the default resource.
+ */
+TEST(MemoryResourceTest, InstanceResourceQueue)
+{
+    static constexpr int NITEMS = 1 << 14;
+
+    counting_resource default_r, r1, r2;
+    set_default_resource(&default_r);
+
+    {
+        k_lsm<uint32_t, uint32_t, 16> pq1(&r1);
+        k_lsm<uint32_t, uint32_t, DYNAMIC_RELAXATION> pq2(16, &r2);
+
+        std::thread([&]() {
+            for (int i = 0; i < NITEMS; i++) {
+                pq1.insert(i, i);
+                pq2.insert(i, i);
+            }
+            uint32_t v;
+            for (int i = 0; i < NITEMS / 2; i++) {
+                pq1.delete_min(v);
+                pq2.delete_min(v);
+            }
+        }).join();
+
+        ASSERT_GT(r1.bytes(), NITEMS * sizeof(uint32_t));
+        ASSERT_GT(r2.bytes(), NITEMS * sizeof(uint32_t));
+    }
+
+    set_default_resource(nullptr);
+    ASSERT_EQ(0u, default_r.allocations());
+    ASSERT_EQ(0u, r1.bytes());
+    ASSERT_EQ(0u, r2.bytes());
+}
+
+int
+main(int argc,
+     char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
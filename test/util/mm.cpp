@@ -18,7 +18,13 @@
  */
 
 #include <gtest/gtest.h>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
 
+#define ENABLE_ITEM_RECYCLING
+#include "components/item.h"
 #include "util/mm.h"
 
 struct simple_reuse {
@@ -54,6 +60,56 @@ TEST(MMTest, AllocMany)
     }
 }
 
+/** Records the sizes of all allocations made through it. */
+class recording_resource : public kpq::memory_resource
+{
+public:
+    std::vector<size_t> m_sizes;
+
+private:
+    void *do_allocate(const size_t bytes,
+                      const size_t alignment) override
+    {
+        m_sizes.push_back(bytes);
+        return kpq::get_system_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p,
+                       const size_t bytes,
+                       const size_t alignment) override
+    {
+        kpq::get_system_resource()->deallocate(p, bytes, alignment);
+    }
+};
+
+/**
+ * The first acquire() allocates a single block, further arenas grow
+ * geometrically up to a bounded size.
+ */
+TEST(MMTest, ArenaGrowth)
+{
+    static constexpr size_t BLOCK_SIZE = 4;
+    static constexpr size_t NARENAS = 7;
+
+    recording_resource r;
+    {
+        kpq::item_allocator<uint32_t, simple_reuse, BLOCK_SIZE> alloc(&r);
+        ASSERT_TRUE(r.m_sizes.empty());
+
+        ASSERT_NE(alloc.acquire(), nullptr);
+        ASSERT_EQ(1u, r.m_sizes.size());
+
+        while (r.m_sizes.size() < NARENAS) {
+            ASSERT_NE(alloc.acquire(), nullptr);
+        }
+    }
+
+    const size_t slot = r.m_sizes[0];
+    const std::vector<size_t> expected { slot, 2 * slot, 4 * slot, 8 * slot,
+                                         16 * slot, 16 * slot, 16 * slot };
+    ASSERT_EQ(expected, r.m_sizes);
+}
+
 /**
  * Verifies that a reusable item is actually reused, and non-reusable items
  * aren't. The block size is set to ITERATIONS, which should ensure that
@@ -101,6 +157,116 @@ TEST(MMTest, ReuseCheck)
     ASSERT_TRUE(reused);
 }
 
+TEST(MMTest, ReleasePages)
+{
+    const size_t size = 4 * kpq::page_size();
+    void *p = kpq::alloc_pages(size);
+    memset(p, 0x2a, size);
+
+    /* Only pages fully contained in the range are released. */
+    ASSERT_EQ(size, kpq::release_pages(p, size));
+    ASSERT_EQ(size - kpq::page_size(), kpq::release_pages((char *)p + 1, size - 1));
+    ASSERT_EQ(0, ((char *)p)[size - 1]);
+
+    /* Ranges the kernel refuses to release are not counted. */
+    kpq::free_pages(p, size);
+    ASSERT_EQ(0u, kpq::release_pages(p, size));
+}
+
+/**
+ * Releases blocks of taken items and verifies that stale references to
+ * their items can neither be taken before nor after the blocks are reused.
+ */
+TEST(MMTest, Trim)
+{
+    typedef kpq::item<uint32_t, uint32_t> item_t;
+    static constexpr size_t BLOCK_SIZE = 1024;
+    static constexpr size_t NITEMS = 4 * BLOCK_SIZE;
+
+    kpq::item_allocator<item_t, item_t::reuse, BLOCK_SIZE> alloc;
+
+    std::vector<item_t *> xs;
+    std::vector<kpq::version_t> versions;
+
+    for (size_t i = 0; i < NITEMS; i++) {
+        item_t *x = alloc.acquire();
+        x->initialize(i, i);
+        xs.push_back(x);
+        versions.push_back(x->version());
+    }
+
+    uint32_t key, val;
+    for (size_t i = 0; i < NITEMS; i++) {
+        ASSERT_TRUE(xs[i]->take(versions[i], key, val));
+    }
+
+    ASSERT_GT(alloc.trim(), 0u);
+    ASSERT_EQ(0u, alloc.trim());
+
+    for (size_t i = 0; i < NITEMS; i++) {
+        ASSERT_FALSE(xs[i]->take(versions[i], key, val));
+    }
+
+    std::set<item_t *> old_items(xs.begin(), xs.end());
+    bool reused = false;
+    for (size_t i = 0; i < NITEMS; i++) {
+        item_t *x = alloc.acquire();
+        x->initialize(i, i);
+        reused |= (old_items.count(x) != 0);
+    }
+
+    ASSERT_TRUE(reused);
+    for (size_t i = 0; i < NITEMS; i++) {
+        ASSERT_NE(versions[i], xs[i]->version());
+        ASSERT_FALSE(xs[i]->take(versions[i], key, val));
+    }
+}
+
+/**
+ * Takes scattered items on another thread and verifies that the allocator
+ * hands out exactly the recycled items next, each of them only once.
+ */
+TEST(MMTest, Recycle)
+{
+    typedef kpq::item<uint32_t, uint32_t> item_t;
+    typedef kpq::item_allocator<item_t, item_t::reuse> alloc_t;
+    static constexpr size_t NITEMS = 4096;
+    static constexpr size_t STRIDE = 7;
+
+    alloc_t alloc;
+
+    std::vector<item_t *> xs;
+    for (size_t i = 0; i < NITEMS; i++) {
+        item_t *x = alloc.acquire();
+        x->initialize(i, i);
+        xs.push_back(x);
+    }
+
+    std::set<item_t *> taken;
+    std::thread t([&]() {
+        uint32_t key, val;
+        for (size_t i = 0; i < NITEMS; i += STRIDE) {
+            if (xs[i]->take(xs[i]->version(), key, val)) {
+                alloc_t::recycle(xs[i]);
+                taken.insert(xs[i]);
+            }
+        }
+    });
+    t.join();
+
+    ASSERT_EQ((NITEMS + STRIDE - 1) / STRIDE, taken.size());
+
+    std::set<item_t *> reused;
+    for (size_t i = 0; i < taken.size(); i++) {
+        item_t *x = alloc.acquire();
+        ASSERT_EQ(1u, taken.count(x));
+        ASSERT_TRUE(reused.insert(x).second);
+        x->initialize(i, i);
+    }
+
+    ASSERT_EQ(0u, reused.count(alloc.acquire()));
+}
+
 int
 main(int argc,
      char **argv)
@@ -18,6 +18,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <future>
 #include <thread>
 
 #include "util/thread_local_ptr.h"
@@ -32,6 +33,8 @@ static void
 write_local(kpq::thread_local_ptr<uint32_t> *p,
             const int i,
             std::atomic<bool> *can_continue,
+            std::atomic<int> *written,
+            std::shared_future<void> can_exit,
             uint32_t **result)
 {
     while (!can_continue->load(std::memory_order_relaxed)) {
@@ -43,6 +46,10 @@ write_local(kpq::thread_local_ptr<uint32_t> *p,
 
     *x = i;
     *result = x;
+
+    /* Thread ids are recycled, stay alive until all threads hold one. */
+    written->fetch_add(1, std::memory_order_relaxed);
+    can_exit.wait();
 }
 
 TEST(ThreadLocalPtrTest, ManyThreads)
@@ -53,15 +60,23 @@ TEST(ThreadLocalPtrTest, ManyThreads)
 
     std::vector<std::thread> threads(NTHREADS);
     std::atomic<bool> can_continue(false);
+    std::atomic<int> written(0);
+    std::promise<void> exit_promise;
+    std::shared_future<void> can_exit(exit_promise.get_future());
 
     uint32_t *results[NTHREADS];
 
     for (int i = 0; i < NTHREADS; i++) {
-        threads[i] = std::thread(write_local, &p, i, &can_continue, &results[i]);
+        threads[i] = std::thread(write_local, &p, i, &can_continue, &written, can_exit, &results[i]);
     }
 
     can_continue.store(true, std::memory_order_relaxed);
 
+    while (written.load(std::memory_order_relaxed) < NTHREADS) {
+        std::this_thread::yield();
+    }
+    exit_promise.set_value();
+
     for (auto &thread : threads) {
         thread.join();
     }
@@ -71,6 +86,98 @@ TEST(ThreadLocalPtrTest, ManyThreads)
     }
 }
 
+static void
+reuse_local(kpq::thread_local_ptr<uint32_t> *p,
+            int32_t *tid,
+            uint32_t *previous)
+{
+    uint32_t *x = p->get();
+    *tid = kpq::tid();
+    *previous = *x;
+    *x = *tid + 1;
+}
+
+TEST(ThreadLocalPtrTest, TidReuse)
+{
+    constexpr static int NTHREADS = 64;
+
+    kpq::thread_local_ptr<uint32_t> p;
+
+    int32_t first_tid;
+    uint32_t previous;
+    std::thread(reuse_local, &p, &first_tid, &previous).join();
+
+    const size_t num_threads = p.num_threads();
+
+    /* Consecutive threads receive the same id and take over its element. */
+
+    for (int i = 0; i < NTHREADS; i++) {
+        int32_t tid;
+        std::thread(reuse_local, &p, &tid, &previous).join();
+
+        ASSERT_EQ(first_tid, tid);
+        ASSERT_EQ((uint32_t)tid + 1, previous);
+    }
+
+    ASSERT_EQ(num_threads, p.num_threads());
+}
+
+static kpq::thread_local_ptr<uint32_t> *teardown_ptr;
+static int32_t teardown_tid;
+
+/**
+ * Stands in for per-thread state which is torn down on thread exit, and
+ * clears the element of its thread.
+ */
+class local_teardown
+{
+public:
+    ~local_teardown()
+    {
+        teardown_tid = kpq::tid();
+        *teardown_ptr->get() = 0;
+    }
+};
+
+static void
+use_local_with_teardown(int32_t *tid,
+                        uint32_t *previous)
+{
+    /* Constructed before the thread receives its id, destroyed afterwards. */
+    static thread_local local_teardown teardown;
+    (void)teardown;
+
+    uint32_t *x = teardown_ptr->get();
+    *tid = kpq::tid();
+    *previous = *x;
+    *x = *tid + 1;
+}
+
+TEST(ThreadLocalPtrTest, TidReleasedAfterTeardown)
+{
+    constexpr static int NTHREADS = 64;
+
+    kpq::thread_local_ptr<uint32_t> p;
+    teardown_ptr = &p;
+
+    int32_t first_tid;
+    uint32_t previous;
+    std::thread(use_local_with_teardown, &first_tid, &previous).join();
+    ASSERT_EQ(first_tid, teardown_tid);
+
+    /* The id is only recycled once the previous thread has torn down its
+     * state, which thus never leaks to the next thread. */
+
+    for (int i = 0; i < NTHREADS; i++) {
+        int32_t tid;
+        std::thread(use_local_with_teardown, &tid, &previous).join();
+
+        ASSERT_EQ(first_tid, tid);
+        ASSERT_EQ(tid, teardown_tid);
+        ASSERT_EQ(0u, previous);
+    }
+}
+
 int
 main(int argc,
      char **argv)
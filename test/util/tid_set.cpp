@@ -0,0 +1,151 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "util/tid_set.h"
+#include "util/xorshf96.h"
+
+using namespace kpq;
+
+#define NTHREADS (8)
+#define NDRAWS (100000)
+
+TEST(TidSetTest, SanityCheck)
+{
+    tid_set s;
+    xorshf96 gen(42);
+
+    ASSERT_EQ(0u, s.size());
+    ASSERT_TRUE(s.draw(gen) == tid_set::NO_TID);
+}
+
+TEST(TidSetTest, InsertErase)
+{
+    tid_set s;
+    xorshf96 gen(42);
+
+    s.insert(3);
+    s.insert(7);
+    s.insert(3);
+    ASSERT_EQ(2u, s.size());
+    ASSERT_TRUE(s.contains(3));
+    ASSERT_TRUE(s.contains(7));
+    ASSERT_FALSE(s.contains(5));
+
+    s.erase(3);
+    s.erase(5);
+    ASSERT_EQ(1u, s.size());
+    ASSERT_FALSE(s.contains(3));
+    ASSERT_TRUE(s.contains(7));
+
+    for (int i = 0; i < 16; i++) {
+        ASSERT_EQ(7, s.draw(gen));
+    }
+
+    s.erase(7);
+    ASSERT_EQ(0u, s.size());
+    ASSERT_TRUE(s.draw(gen) == tid_set::NO_TID);
+}
+
+/**
+ * Every element is drawn equally often, regardless of gaps between the
+ * contained ids.
+ */
+TEST(TidSetTest, Uniform)
+{
+    tid_set s;
+    xorshf96 gen(42);
+
+    for (int32_t tid = 0; tid < 64; tid++) {
+        s.insert(tid);
+    }
+    for (int32_t tid = 1; tid < 60; tid++) {
+        s.erase(tid);
+    }
+
+    /* 0, 60, 61, 62, 63 remain. */
+
+    ASSERT_EQ(5u, s.size());
+
+    std::vector<int> counts(64, 0);
+    for (int i = 0; i < NDRAWS; i++) {
+        counts[s.draw(gen)]++;
+    }
+
+    for (int32_t tid : { 0, 60, 61, 62, 63 }) {
+        ASSERT_NEAR(NDRAWS / 5, counts[tid], NDRAWS / 50);
+    }
+}
+
+static void
+insert_erase(tid_set *s,
+             const int32_t tid)
+{
+    for (int i = 0; i < 1000; i++) {
+        s->insert(tid);
+        s->erase(tid);
+    }
+    s->insert(tid);
+}
+
+/**
+ * Concurrent draws only return ids which have been inserted.
+ */
+TEST(TidSetTest, Concurrent)
+{
+    tid_set s;
+    std::atomic<bool> done(false);
+    std::atomic<int> invalid(0);
+
+    std::thread drawer([&]() {
+        xorshf96 gen(42);
+        while (!done.load()) {
+            const int32_t tid = s.draw(gen);
+            if (tid != tid_set::NO_TID && (tid < 0 || tid >= NTHREADS)) {
+                invalid.fetch_add(1);
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NTHREADS; i++) {
+        threads.emplace_back(insert_erase, &s, i);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    done.store(true);
+    drawer.join();
+
+    ASSERT_EQ(0, invalid.load());
+    ASSERT_EQ(static_cast<size_t>(NTHREADS), s.size());
+}
+
+int
+main(int argc,
+     char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
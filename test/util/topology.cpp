@@ -0,0 +1,55 @@
+/*
+ *  Copyright 2015 Jakob Gruber
+ *
+ *  This file is part of kpqueue.
+ *
+ *  kpqueue is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  kpqueue is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with kpqueue.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "util/topology.h"
+
+using namespace kpq;
+
+TEST(TopologyTest, CurrentCpu)
+{
+    ASSERT_GE(cpu_topology::current_cpu(), 0);
+}
+
+TEST(TopologyTest, Distances)
+{
+    const auto &topology = cpu_topology::instance();
+    const int cpu = cpu_topology::current_cpu();
+    const int ncpus = std::thread::hardware_concurrency();
+
+    ASSERT_EQ(cpu_topology::SAME_CORE, topology.distance_between(cpu, cpu));
+
+    /* Distances are symmetric, and unknown CPUs are never remote. */
+    for (int other = -1; other <= ncpus; other++) {
+        ASSERT_EQ(topology.distance_between(cpu, other),
+                  topology.distance_between(other, cpu));
+    }
+    ASSERT_EQ(cpu_topology::SAME_SOCKET, topology.distance_between(cpu, -1));
+    ASSERT_EQ(cpu_topology::SAME_SOCKET, topology.distance_between(cpu, 1 << 20));
+}
+
+int
+main(int argc,
+     char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}